@@ -0,0 +1,135 @@
+/**
+ * @file datapipe-bench.c
+ * Microbenchmark for datapipe dispatch
+ * @author Carl Klemm <carl@uvos.xyz>
+ *
+ * sphone is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * sphone is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with sphone.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "datapipe.h"
+#include "sphone-log.h"
+
+#define MAX_SUBSCRIBERS 512
+
+static volatile int sink;
+
+static void bench_trigger(gconstpointer data, gpointer user_data)
+{
+	sink += GPOINTER_TO_INT(data) + GPOINTER_TO_INT(user_data);
+}
+
+static gpointer bench_filter(gpointer data, gpointer user_data)
+{
+	(void)user_data;
+	return data;
+}
+
+static void bench_remove_self_trigger(gconstpointer data, gpointer user_data)
+{
+	(void)data;
+	remove_trigger_from_datapipe(user_data, bench_remove_self_trigger, user_data);
+}
+
+static void bench_reorder_trigger(gconstpointer data, gpointer user_data)
+{
+	datapipe_struct *pipe = user_data;
+	(void)data;
+	remove_trigger_from_datapipe(pipe, bench_reorder_trigger, pipe);
+	append_trigger_to_datapipe(pipe, bench_trigger, GINT_TO_POINTER(1));
+	remove_trigger_from_datapipe(pipe, bench_trigger, GINT_TO_POINTER(0));
+}
+
+static double bench_triggers(datapipe_struct *pipe, unsigned int iterations)
+{
+	gint64 start = g_get_monotonic_time();
+	for(unsigned int i = 0; i < iterations; ++i)
+		execute_datapipe_output_triggers(pipe, GINT_TO_POINTER(1));
+	gint64 end = g_get_monotonic_time();
+	return ((double)(end - start)*1000.0)/iterations;
+}
+
+static double bench_filters(datapipe_struct *pipe, unsigned int iterations)
+{
+	gint64 start = g_get_monotonic_time();
+	for(unsigned int i = 0; i < iterations; ++i)
+		execute_datapipe_filters(pipe, GINT_TO_POINTER(1));
+	gint64 end = g_get_monotonic_time();
+	return ((double)(end - start)*1000.0)/iterations;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int iterations = 20000;
+	datapipe_struct pipe;
+
+	if(argc > 1)
+		iterations = strtoul(argv[1], NULL, 10);
+	if(iterations == 0)
+		iterations = 1;
+
+	sphone_log_open("datapipe-bench", LOG_USER, SPHONE_LOG_STDERR);
+	setup_datapipe(&pipe);
+
+	/* A trigger that removes itself mid dispatch must not disturb the snapshot being iterated */
+	append_trigger_to_datapipe(&pipe, bench_remove_self_trigger, &pipe);
+	append_trigger_to_datapipe(&pipe, bench_trigger, GINT_TO_POINTER(0));
+	sink = 0;
+	execute_datapipe(&pipe, GINT_TO_POINTER(1));
+	execute_datapipe(&pipe, GINT_TO_POINTER(1));
+	if(sink != 2) {
+		fprintf(stderr, "Self removing trigger broke dispatch\n");
+		return 1;
+	}
+	remove_trigger_from_datapipe(&pipe, bench_trigger, GINT_TO_POINTER(0));
+
+	/* Callbacks removed mid dispatch must not be called, even after the pipe was changed several times */
+	append_trigger_to_datapipe(&pipe, bench_reorder_trigger, &pipe);
+	append_trigger_to_datapipe(&pipe, bench_trigger, GINT_TO_POINTER(0));
+	sink = 0;
+	execute_datapipe(&pipe, GINT_TO_POINTER(1));
+	if(sink != 0) {
+		fprintf(stderr, "Removed trigger was called\n");
+		return 1;
+	}
+	execute_datapipe(&pipe, GINT_TO_POINTER(1));
+	if(sink != 2) {
+		fprintf(stderr, "Added trigger was not called\n");
+		return 1;
+	}
+	remove_trigger_from_datapipe(&pipe, bench_trigger, GINT_TO_POINTER(1));
+
+	printf("%12s %16s %16s\n", "subscribers", "triggers ns/op", "filters ns/op");
+
+	unsigned int count = 0;
+	for(unsigned int subscribers = 1; subscribers <= MAX_SUBSCRIBERS; subscribers *= 2) {
+		for(; count < subscribers; ++count) {
+			append_trigger_to_datapipe(&pipe, bench_trigger, GINT_TO_POINTER(count));
+			append_filter_to_datapipe(&pipe, bench_filter, GINT_TO_POINTER(count));
+		}
+
+		double trigger_ns = bench_triggers(&pipe, iterations);
+		double filter_ns = bench_filters(&pipe, iterations);
+		printf("%12u %16.1f %16.1f\n", subscribers, trigger_ns, filter_ns);
+	}
+
+	for(unsigned int i = 0; i < count; ++i) {
+		remove_trigger_from_datapipe(&pipe, bench_trigger, GINT_TO_POINTER(i));
+		remove_filter_from_datapipe(&pipe, bench_filter, GINT_TO_POINTER(i));
+	}
+	free_datapipe(&pipe);
+	sphone_log_close();
+
+	return 0;
+}
@@ -0,0 +1,224 @@
+/**
+ * @file types-bench.c
+ * Round trip check and microbenchmark for the binary encoding of types
+ * @author Carl Klemm <carl@uvos.xyz>
+ *
+ * sphone is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * sphone is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with sphone.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "types.h"
+#include "comm.h"
+#include "sphone-conf.h"
+#include "sphone-log.h"
+
+/* types.c and phonenumber.c only need these to print and to look up the number prefixes */
+CommBackend *sphone_comm_get_backend(int id)
+{
+	(void)id;
+	return NULL;
+}
+
+gchar *sphone_conf_get_string(const gchar *group, const gchar *key, const gchar *defaultval, gpointer keyfileptr)
+{
+	(void)group;
+	(void)key;
+	(void)keyfileptr;
+	return g_strdup(defaultval);
+}
+
+static Contact *bench_contact(void)
+{
+	Contact *contact = contact_new();
+	contact->name = g_strdup("Alice");
+	contact->line_identifier = sphone_intern("+491701234567");
+	contact->line_identifier_field = SPHONE_FIELD_PHONE;
+	contact->backend = 2;
+	return contact;
+}
+
+static bool bench_contact_equal(const Contact *a, const Contact *b)
+{
+	if(!a || !b)
+		return a == b;
+	return g_strcmp0(a->name, b->name) == 0 && a->line_identifier == b->line_identifier &&
+		a->line_identifier_field == b->line_identifier_field && a->backend == b->backend;
+}
+
+static CallProperties *bench_call(void)
+{
+	CallProperties *call = call_properties_new();
+	call->contact = bench_contact();
+	call->line_identifier = sphone_intern("+491701234567");
+	call->state = SPHONE_CALL_ACTIVE;
+	call->backend = 2;
+	call->backend_data = g_strdup("/ril_0/voicecall01");
+	call->start_time = 1700000000;
+	call->end_time = 1700000060;
+	call->answered = true;
+	call->needs_route = true;
+	call->changes = SPHONE_CALL_CHANGED_STATE | SPHONE_CALL_CHANGED_ANSWERED;
+	return call;
+}
+
+static bool bench_call_equal(const CallProperties *a, const CallProperties *b)
+{
+	return bench_contact_equal(a->contact, b->contact) && a->line_identifier == b->line_identifier &&
+		a->state == b->state && a->backend == b->backend && g_strcmp0(a->backend_data, b->backend_data) == 0 &&
+		a->start_time == b->start_time && a->end_time == b->end_time && a->emergency == b->emergency &&
+		a->answered == b->answered && a->needs_route == b->needs_route && a->outbound == b->outbound &&
+		a->changes == b->changes;
+}
+
+static MessageProperties *bench_message(void)
+{
+	MessageProperties *msg = message_properties_new();
+	msg->contact = bench_contact();
+	msg->line_identifier = sphone_intern("+491701234567");
+	msg->technology = g_strdup("sms");
+	msg->text = g_ref_string_new("See you at eight");
+	msg->backend = 2;
+	msg->time = 1700000000;
+	msg->outbound = true;
+	return msg;
+}
+
+static bool bench_message_equal(const MessageProperties *a, const MessageProperties *b)
+{
+	return bench_contact_equal(a->contact, b->contact) && a->line_identifier == b->line_identifier &&
+		g_strcmp0(a->technology, b->technology) == 0 && g_strcmp0(a->text, b->text) == 0 &&
+		a->backend == b->backend && g_strcmp0(a->backend_data, b->backend_data) == 0 &&
+		a->time == b->time && a->outbound == b->outbound;
+}
+
+static bool bench_notification_equal(const Notification *a, const Notification *b)
+{
+	return g_strcmp0(a->title, b->title) == 0 && g_strcmp0(a->text, b->text) == 0;
+}
+
+static bool bench_equal(sphone_type_tag_t tag, gconstpointer a, gconstpointer b)
+{
+	switch(tag) {
+		case SPHONE_TYPE_CONTACT:
+			return bench_contact_equal(a, b);
+		case SPHONE_TYPE_CALL:
+			return bench_call_equal(a, b);
+		case SPHONE_TYPE_MESSAGE:
+			return bench_message_equal(a, b);
+		case SPHONE_TYPE_NOTIFICATION:
+			return bench_notification_equal(a, b);
+		case SPHONE_TYPE_VARIANT:
+			return g_variant_equal(a, b);
+		default:
+			return false;
+	}
+}
+
+static double bench_encode(const MessageProperties *msg, unsigned int iterations)
+{
+	GByteArray *stream = g_byte_array_new();
+	sphone_types_stream_begin(stream);
+	guint header_size = stream->len;
+
+	gint64 start = g_get_monotonic_time();
+	for(unsigned int i = 0; i < iterations; ++i) {
+		sphone_types_stream_append(stream, SPHONE_TYPE_MESSAGE, msg);
+		g_byte_array_set_size(stream, header_size);
+	}
+	gint64 end = g_get_monotonic_time();
+
+	g_byte_array_unref(stream);
+	return ((double)(end - start)*1000.0)/iterations;
+}
+
+static double bench_decode(GBytes *bytes, unsigned int iterations)
+{
+	gint64 start = g_get_monotonic_time();
+	for(unsigned int i = 0; i < iterations; ++i) {
+		sphone_type_tag_t tag;
+		sphone_types_free(SPHONE_TYPE_MESSAGE, sphone_types_decode(bytes, &tag));
+	}
+	gint64 end = g_get_monotonic_time();
+	return ((double)(end - start)*1000.0)/iterations;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int iterations = 20000;
+
+	if(argc > 1)
+		iterations = strtoul(argv[1], NULL, 10);
+	if(iterations == 0)
+		iterations = 1;
+
+	sphone_log_open("types-bench", LOG_USER, SPHONE_LOG_STDERR);
+
+	Notification *notification = g_malloc0(sizeof(*notification));
+	notification->title = g_strdup("Missed call");
+	notification->text = g_strdup("Alice called you");
+	const struct {
+		sphone_type_tag_t tag;
+		gpointer data;
+	} records[] = {
+		{SPHONE_TYPE_CONTACT, bench_contact()},
+		{SPHONE_TYPE_CALL, bench_call()},
+		{SPHONE_TYPE_MESSAGE, bench_message()},
+		{SPHONE_TYPE_NOTIFICATION, notification},
+		{SPHONE_TYPE_VARIANT, g_variant_ref_sink(g_variant_new("(xsmv)", (gint64)42, "call_new_pipe", NULL))},
+	};
+
+	/* Every type must decode to what was encoded, in a stream of mixed records */
+	GByteArray *stream = g_byte_array_new();
+	sphone_types_stream_begin(stream);
+	for(size_t i = 0; i < G_N_ELEMENTS(records); ++i) {
+		if(!sphone_types_stream_append(stream, records[i].tag, records[i].data)) {
+			fprintf(stderr, "Type %d failed to encode\n", records[i].tag);
+			return 1;
+		}
+	}
+
+	GBytes *bytes = g_byte_array_free_to_bytes(stream);
+	SphoneTypesStream cursor;
+	if(!sphone_types_stream_init(&cursor, bytes)) {
+		fprintf(stderr, "Encoded stream was rejected\n");
+		return 1;
+	}
+	for(size_t i = 0; i < G_N_ELEMENTS(records); ++i) {
+		sphone_type_tag_t tag;
+		gpointer data = sphone_types_stream_next(&cursor, &tag);
+		if(!data || tag != records[i].tag || !bench_equal(tag, records[i].data, data)) {
+			fprintf(stderr, "Type %d did not survive the round trip\n", records[i].tag);
+			return 1;
+		}
+		sphone_types_free(tag, data);
+	}
+	if(sphone_types_stream_next(&cursor, NULL)) {
+		fprintf(stderr, "Stream has trailing records\n");
+		return 1;
+	}
+	sphone_types_stream_clear(&cursor);
+	g_bytes_unref(bytes);
+
+	MessageProperties *msg = records[2].data;
+	bytes = sphone_types_encode(SPHONE_TYPE_MESSAGE, msg);
+	printf("%16s %16s\n", "encode ns/op", "decode ns/op");
+	printf("%16.1f %16.1f\n", bench_encode(msg, iterations), bench_decode(bytes, iterations));
+	g_bytes_unref(bytes);
+
+	for(size_t i = 0; i < G_N_ELEMENTS(records); ++i)
+		sphone_types_free(records[i].tag, records[i].data);
+	sphone_log_close();
+
+	return 0;
+}
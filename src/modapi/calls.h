@@ -0,0 +1,63 @@
+/*
+ * calls.h
+ * Copyright (C) Carl Philipp Klemm 2021 <carl@uvos.xyz>
+ * 
+ * calls.h is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * calls.h is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "types.h"
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Registry of the live calls of all backends, main loop only
+ *
+ * Backends report calls with sphone_calls_add() and sphone_calls_update(),
+ * the registry keeps one shared CallProperties per call and emits
+ * call_new_pipe and, if any field changed, call_properties_changed_pipe with it.
+ * Disconnected calls are removed after call_properties_changed_pipe ran.
+ *
+ * Calls are identified by backend and backend_data, or by backend and
+ * line_identifier for backends that do not set backend_data.
+ * The returned calls are valid until they are removed,
+ * modules that keep a call take a reference with call_properties_ref().
+ */
+
+bool sphone_calls_add(const CallProperties *call);
+
+bool sphone_calls_update(const CallProperties *call);
+
+const CallProperties *sphone_calls_find(int backend, const char *backend_data);
+
+const CallProperties *sphone_calls_find_line(int backend, const char *line_identifier);
+
+const CallProperties *sphone_calls_find_call(const CallProperties *call);
+
+void sphone_calls_foreach(void (*func)(const CallProperties *call, void *user_data), void *user_data);
+
+unsigned int sphone_calls_count(void);
+
+void sphone_calls_remove_backend(int backend);
+
+void sphone_calls_init(void);
+
+void sphone_calls_exit(void);
+
+#ifdef __cplusplus
+}
+#endif
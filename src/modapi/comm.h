@@ -38,14 +38,72 @@ typedef struct _Scheme {
 	BackendFlag flags;
 } Scheme;
 
+/**
+ * An inclusive range of unicode codepoints
+ */
+typedef struct _CodepointRange {
+	uint32_t first;
+	uint32_t last;
+} CodepointRange;
+
+/**
+ * Operations requested from a backend through the datapipes
+ */
+typedef enum {
+	COMM_OP_DIAL = 0,
+	COMM_OP_ANSWER,
+	COMM_OP_HANGUP,
+	COMM_OP_SEND_MESSAGE,
+	COMM_OP_COUNT
+} CommOperation;
+
+typedef enum {
+	COMM_AVAILABILITY_UNKNOWN = 0,
+	COMM_AVAILABILITY_AVAILABLE,
+	// Available but its last requests failed
+	COMM_AVAILABILITY_DEGRADED,
+	COMM_AVAILABILITY_UNAVAILABLE
+} CommAvailability;
+
+typedef struct _CommLatency {
+	guint64 count;
+	guint64 total_us;
+	guint64 max_us;
+} CommLatency;
+
+typedef struct _CommOperationStats {
+	guint64 requests;
+	guint64 errors;
+	// From the request to the backend acknowledging it, e.g. the reply of ofono
+	CommLatency reply;
+	// From the request to the call reaching the requested state, e.g. the modem reporting the call alerting
+	CommLatency complete;
+	// Start of the oldest request still waiting for its state, 0 if none
+	gint64 pending_since;
+} CommOperationStats;
+
+typedef struct _CommBackendStats {
+	CommOperationStats operations[COMM_OP_COUNT];
+	CommAvailability availability;
+	gint64 availability_since;
+	unsigned int consecutive_errors;
+} CommBackendStats;
+
+// uid is interned
 typedef struct  _CommBackend {
 	char* name;
-	char* uid;
+	const char* uid;
 	Scheme** schemes;
 	BackendFlag flags;
 	sphone_contact_field_t* applicable_fields;
 	int id;
 	bool (*is_valid_ch)(uint32_t codepoint);
+	// Set by sphone_comm_set_valid_ranges(), sorted and merged, replaces is_valid_ch
+	CodepointRange *valid_ranges;
+	size_t n_valid_ranges;
+	// Bitmap of the valid codepoints below 128
+	uint64_t valid_ascii[2];
+	CommBackendStats stats;
 } CommBackend;
 
 int sphone_comm_add_backend(const char* name, const char* uid, const Scheme** schemes, BackendFlag flags,
@@ -66,10 +124,43 @@ bool sphone_comm_set_default_backend(int id);
 int sphone_comm_find_backend_id(const char* name);
 int sphone_comm_find_backend_id_from_uid(const char* uid);
 
+bool sphone_comm_set_valid_ranges(int id, const CodepointRange *ranges, size_t count);
+
 bool sphone_comm_valid_string(int id, const char* str);
 
+GVariant *sphone_comm_backend_to_variant(const CommBackend *backend);
+int sphone_comm_add_backend_from_variant(GVariant *variant, int *id);
+
 char *sphone_comm_create_cleaned_string(int id, const char* str);
 
+/*
+ * Backend health
+ *
+ * Backends call sphone_comm_operation_begin() when a request reaches them and
+ * sphone_comm_operation_reply() once the service they talk to acknowledged it.
+ * The call registry completes dial, answer and hangup requests when a call of
+ * the backend reaches the requested state, so the reply latency covers the
+ * service, e.g. ofono, and the complete latency also covers the modem or network.
+ * Time spent in sphone itself before the request reaches the backend is covered
+ * by the datapipe statistics.
+ * Changes of availability are emitted on comm_backend_changed_pipe.
+ */
+
+gint64 sphone_comm_operation_begin(int id, CommOperation operation);
+
+void sphone_comm_operation_reply(int id, CommOperation operation, gint64 start, bool success);
+
+void sphone_comm_set_availability(int id, CommAvailability availability);
+
+bool sphone_comm_backend_usable(const CommBackend *backend);
+
+const char *sphone_comm_availability_string(CommAvailability availability);
+
+char *sphone_comm_dump_stats(void);
+
+// Called by the call registry when a call was added or changed its state
+void sphone_comm_call_state_changed(const CallProperties *call);
+
 #ifdef __cplusplus
 }
 #endif
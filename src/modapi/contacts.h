@@ -0,0 +1,51 @@
+/*
+ * contacts.h
+ * Copyright (C) Carl Philipp Klemm 2021 <carl@uvos.xyz>
+ *
+ * contacts.h is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * contacts.h is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Registry of contacts, main loop only
+ *
+ * The registry keeps one shared Contact per backend and line identifier key,
+ * see phonenumber.h. The name of a contact is resolved with the filters of
+ * contact_fill_pipe when it is first requested. sphone_contacts_resolve()
+ * resolves the contacts still in use again from an idle source, e.g. once an
+ * address book became available or changed, and everyone holding the contact
+ * sees the new name.
+ */
+
+Contact *sphone_contacts_get(int backend, const char *line_identifier, const char *name);
+
+Contact *sphone_contacts_get_for(const Contact *contact);
+
+void sphone_contacts_resolve(void);
+
+void sphone_contacts_remove_backend(int backend);
+
+void sphone_contacts_init(void);
+
+void sphone_contacts_exit(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -19,34 +19,109 @@
 #define _DATAPIPE_H_
 
 #include <glib.h>
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+struct callback_array;
+struct datapipe_stats;
+struct datapipe_coalescer;
+struct datapipe_keys;
+
+/**
+ * Priorities for filters and triggers
+ *
+ * Callbacks with a higher priority are executed first, any int value may be used.
+ */
+typedef enum {
+	DATAPIPE_PRIORITY_LOWEST = -1000,	/**< Bookkeeping that may be slow, e.g. storage */
+	DATAPIPE_PRIORITY_LOW = -100,		/**< Non time critical consumers, e.g. notifications */
+	DATAPIPE_PRIORITY_DEFAULT = 0,		/**< Priority used by append_* */
+	DATAPIPE_PRIORITY_HIGH = 100,		/**< Latency critical consumers, e.g. ringing */
+	DATAPIPE_PRIORITY_HIGHEST = 1000	/**< Filters that must see data first, e.g. drop filters */
+} datapipe_priority_t;
+
+/**
+ * Execution policy of a trigger
+ *
+ * Deferred triggers are run from an idle source of the main loop at the given
+ * priority class, with a private copy of the data, after execute_datapipe()
+ * returned. They require the datapipe to have a type.
+ */
+typedef enum {
+	DATAPIPE_EXEC_IMMEDIATE = 0,	/**< Run inside execute_datapipe() */
+	DATAPIPE_EXEC_DEFERRED_HIGH,	/**< Run at G_PRIORITY_HIGH_IDLE */
+	DATAPIPE_EXEC_DEFERRED,			/**< Run at G_PRIORITY_DEFAULT_IDLE */
+	DATAPIPE_EXEC_DEFERRED_LOW,		/**< Run at G_PRIORITY_LOW */
+	DATAPIPE_EXEC_THREAD,			/**< Run on a worker thread, see insert_threaded_trigger_to_datapipe */
+} datapipe_exec_t;
+
+/**
+ * Payload type of a datapipe
+ *
+ * copy and free may be NULL for types that are passed by value in the pointer,
+ * e.g. enums encoded with GINT_TO_POINTER
+ * to_variant and from_variant are optional, they are used to record and replay events
+ */
+typedef struct {
+	const char *name;
+	gpointer (*copy)(gconstpointer data);
+	void (*free)(gpointer data);
+	GVariant *(*to_variant)(gconstpointer data);
+	gpointer (*from_variant)(GVariant *variant);
+} datapipe_type_struct;
+
 /**
  * Datapipe structure
  *
  * Only access this struct through the functions
+ *
+ * Filters and triggers are kept in immutable, reference counted arrays.
+ * Adding or removing a callback replaces the array, dispatch iterates
+ * over the array that was current when it started.
  */
 typedef struct {
-	GSList *filters;
-	GSList *output_triggers;
-	const void *last_data;
+	struct callback_array *filters;
+	struct callback_array *output_triggers;
+	gpointer cached_data;
+	bool cache_enabled;
+	bool cache_valid;
+	const char *name;
+	struct datapipe_stats *stats;
+	const datapipe_type_struct *type;
+	unsigned int dispatch_depth;
+	struct datapipe_coalescer *coalescer;
+	struct datapipe_keys *keys;
+	GVariant *(*record)(gconstpointer data);
 } datapipe_struct;
 
 // Datapipe execution
 gconstpointer execute_datapipe(datapipe_struct *const datapipe, gpointer indata);
 void execute_datapipe_output_triggers(const datapipe_struct *const datapipe, gconstpointer indata);
 gconstpointer execute_datapipe_filters(datapipe_struct *const datapipe, gpointer indata);
+void execute_datapipe_async_from_thread(datapipe_struct *const datapipe, gconstpointer indata);
 
-// Cached data only use on numeric types encoded as pointer!
-int datapipe_get_last_data_int(datapipe_struct *const datapipe);
+// Transactions, main loop only
+void datapipe_transaction_begin(void);
+void datapipe_transaction_commit(void);
+
+// Last value cache, main loop only
+void datapipe_set_cache(datapipe_struct *const datapipe, bool enable);
+bool datapipe_has_last_data(const datapipe_struct *const datapipe);
+gconstpointer datapipe_get_last_data(const datapipe_struct *const datapipe);
+gpointer datapipe_dup_last_data(const datapipe_struct *const datapipe);
+// Only use on numeric types encoded as pointer!
+int datapipe_get_last_data_int(const datapipe_struct *const datapipe);
 
 // Filters 
 void append_filter_to_datapipe(datapipe_struct *const datapipe,
 							   gpointer (*filter)(gpointer data, gpointer user_data),
 							   gpointer user_data);
+void insert_filter_to_datapipe(datapipe_struct *const datapipe,
+							   gpointer (*filter)(gpointer data, gpointer user_data),
+							   gpointer user_data, int priority);
 void remove_filter_from_datapipe(datapipe_struct *const datapipe,
 								 gpointer (*filter)(gpointer data, gpointer user_data),
 								gpointer user_data);
@@ -55,9 +130,49 @@ void remove_filter_from_datapipe(datapipe_struct *const datapipe,
 void append_trigger_to_datapipe(datapipe_struct *const datapipe,
 								void (*trigger)(gconstpointer data, gpointer user_data),
 								gpointer user_data);
+void insert_trigger_to_datapipe(datapipe_struct *const datapipe,
+								void (*trigger)(gconstpointer data, gpointer user_data),
+								gpointer user_data, int priority);
+void insert_trigger_to_datapipe_full(datapipe_struct *const datapipe,
+									 void (*trigger)(gconstpointer data, gpointer user_data),
+									 gpointer user_data, int priority, datapipe_exec_t exec);
+void insert_threaded_trigger_to_datapipe(datapipe_struct *const datapipe,
+										 void (*trigger)(gconstpointer data, gpointer user_data),
+										 void (*complete)(gconstpointer data, gpointer user_data),
+										 gpointer user_data, int priority);
 void remove_trigger_from_datapipe(datapipe_struct *const datapipe,
 								  void (*trigger)(gconstpointer data, gpointer user_data),
 								gpointer user_data);
+void flush_trigger_of_datapipe(datapipe_struct *const datapipe,
+							   void (*trigger)(gconstpointer data, gpointer user_data),
+							   gpointer user_data);
+
+// keyed triggers
+void datapipe_set_key(datapipe_struct *const datapipe, const datapipe_type_struct *key_type,
+					  GHashFunc hash, GEqualFunc equal, gconstpointer (*get_key)(gconstpointer data));
+void insert_keyed_trigger_to_datapipe(datapipe_struct *const datapipe, gconstpointer key,
+									  void (*trigger)(gconstpointer data, gpointer user_data),
+									  gpointer user_data, int priority);
+void remove_keyed_trigger_from_datapipe(datapipe_struct *const datapipe, gconstpointer key,
+										void (*trigger)(gconstpointer data, gpointer user_data),
+										gpointer user_data);
+
+void datapipe_set_type(datapipe_struct *const datapipe, const datapipe_type_struct *type);
+void datapipe_set_coalescing(datapipe_struct *const datapipe, guint window_ms,
+							 GHashFunc hash, GEqualFunc equal,
+							 bool (*significant)(gconstpointer last, gconstpointer data),
+							 void (*merge)(gpointer data, gconstpointer held));
+
+// Diagnostics
+void datapipe_set_name(datapipe_struct *const datapipe, const char *name);
+const char *datapipe_get_name(const datapipe_struct *const datapipe);
+void datapipe_set_stats_enabled(datapipe_struct *const datapipe, bool enable);
+void datapipe_stats_dump(const datapipe_struct *const datapipe, GString *out,
+						 char *(*describe)(const void *callback));
+
+// Event recording, main loop only
+void datapipe_set_recorder(void (*record)(const char *name, GVariant *data));
+void datapipe_set_recorded(datapipe_struct *const datapipe, GVariant *(*to_variant)(gconstpointer data));
 
 void setup_datapipe(datapipe_struct *const datapipe);
 void free_datapipe(datapipe_struct *const datapipe);
@@ -0,0 +1,209 @@
+/**
+ * @file datapipe.hpp
+ * Typed C++ interface to sphone datapipes
+ * @author Carl Klemm <carl@uvos.xyz>
+ *
+ * sphone is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * sphone is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with sphone.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <type_traits>
+#include <utility>
+#include "datapipe.h"
+
+namespace sphone
+{
+
+/**
+ * How the payload of a datapipe is passed through its gpointer
+ *
+ * Structs and strings are passed as const pointers,
+ * enums and integers are encoded in the pointer with GINT_TO_POINTER
+ */
+template<typename T, typename = void>
+struct PayloadTraits
+{
+	typedef const T* Arg;
+
+	static Arg from(gconstpointer data)
+	{
+		return static_cast<Arg>(data);
+	}
+
+	static gpointer to(Arg data)
+	{
+		return const_cast<T*>(data);
+	}
+};
+
+template<typename T>
+struct PayloadTraits<T, std::enable_if_t<std::is_enum_v<T> || std::is_integral_v<T>>>
+{
+	typedef T Arg;
+
+	static Arg from(gconstpointer data)
+	{
+		return static_cast<Arg>(GPOINTER_TO_INT(data));
+	}
+
+	static gpointer to(Arg data)
+	{
+		return GINT_TO_POINTER(static_cast<int>(data));
+	}
+};
+
+typedef void (*TriggerFn)(gconstpointer data, gpointer user_data);
+
+/**
+ * A registered trigger, removed from its datapipe when destroyed
+ */
+class Subscription
+{
+	datapipe_struct *pipe = nullptr;
+	TriggerFn trigger = nullptr;
+	gpointer userData = nullptr;
+
+public:
+	Subscription() = default;
+
+	Subscription(datapipe_struct *pipe, TriggerFn trigger, gpointer userData,
+				 int priority, datapipe_exec_t exec = DATAPIPE_EXEC_IMMEDIATE):
+		pipe(pipe), trigger(trigger), userData(userData)
+	{
+		insert_trigger_to_datapipe_full(pipe, trigger, userData, priority, exec);
+	}
+
+	Subscription(const Subscription&) = delete;
+	Subscription& operator=(const Subscription&) = delete;
+
+	Subscription(Subscription&& other) noexcept:
+		pipe(std::exchange(other.pipe, nullptr)), trigger(other.trigger), userData(other.userData)
+	{
+	}
+
+	Subscription& operator=(Subscription&& other) noexcept
+	{
+		if(this != &other) {
+			reset();
+			pipe = std::exchange(other.pipe, nullptr);
+			trigger = other.trigger;
+			userData = other.userData;
+		}
+		return *this;
+	}
+
+	~Subscription()
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		if(pipe)
+			remove_trigger_from_datapipe(pipe, trigger, userData);
+		pipe = nullptr;
+	}
+
+	explicit operator bool() const
+	{
+		return pipe != nullptr;
+	}
+};
+
+/**
+ * A trigger that owns a callable, removed from its datapipe when destroyed
+ *
+ * The callable is stored inline and passed to the datapipe as user data,
+ * so objects of this class can not be moved once constructed.
+ */
+template<typename T, typename F>
+class ScopedTrigger
+{
+	F callable;
+	Subscription subscription;
+
+	static void trampoline(gconstpointer data, gpointer user_data)
+	{
+		static_cast<ScopedTrigger*>(user_data)->callable(PayloadTraits<T>::from(data));
+	}
+
+public:
+	ScopedTrigger(datapipe_struct *pipe, F callable, int priority, datapipe_exec_t exec):
+		callable(std::move(callable)), subscription(pipe, trampoline, this, priority, exec)
+	{
+	}
+
+	ScopedTrigger(const ScopedTrigger&) = delete;
+	ScopedTrigger& operator=(const ScopedTrigger&) = delete;
+};
+
+/**
+ * Typed handle of a datapipe
+ *
+ * The handle is a single pointer, triggers are plain function pointers
+ * instantiated per member function or callable, nothing is allocated.
+ */
+template<typename T>
+class Datapipe
+{
+	datapipe_struct *pipe;
+
+	template<auto Method, typename Object>
+	static void memberTrampoline(gconstpointer data, gpointer user_data)
+	{
+		(static_cast<Object*>(user_data)->*Method)(PayloadTraits<T>::from(data));
+	}
+
+public:
+	typedef typename PayloadTraits<T>::Arg Arg;
+
+	constexpr explicit Datapipe(datapipe_struct &pipe): pipe(&pipe)
+	{
+	}
+
+	datapipe_struct *get() const
+	{
+		return pipe;
+	}
+
+	Arg execute(Arg data) const
+	{
+		return PayloadTraits<T>::from(execute_datapipe(pipe, PayloadTraits<T>::to(data)));
+	}
+
+	/**
+	 * Subscribe a member function of object, e.g. subscribe<&Manager::callChanged>(this)
+	 */
+	template<auto Method, typename Object>
+	[[nodiscard]] Subscription subscribe(Object *object, int priority = DATAPIPE_PRIORITY_DEFAULT,
+										 datapipe_exec_t exec = DATAPIPE_EXEC_IMMEDIATE) const
+	{
+		static_assert(std::is_invocable_v<decltype(Method), Object*, Arg>,
+					  "trigger does not accept the payload type of this datapipe");
+		return Subscription(pipe, &memberTrampoline<Method, Object>, object, priority, exec);
+	}
+
+	/**
+	 * Subscribe a callable, e.g. a lambda, which is kept in the returned object
+	 */
+	template<typename F>
+	[[nodiscard]] ScopedTrigger<T, std::decay_t<F>> subscribe(F&& callable, int priority = DATAPIPE_PRIORITY_DEFAULT,
+															  datapipe_exec_t exec = DATAPIPE_EXEC_IMMEDIATE) const
+	{
+		static_assert(std::is_invocable_v<std::decay_t<F>&, Arg>,
+					  "trigger does not accept the payload type of this datapipe");
+		return ScopedTrigger<T, std::decay_t<F>>(pipe, std::forward<F>(callable), priority, exec);
+	}
+};
+
+}
@@ -35,10 +35,10 @@ extern datapipe_struct audio_stop_pipe;
 //input: bool
 extern datapipe_struct audio_playing_pipe;
 
-//input: sphone_audio_route_t
+//input: sphone_audio_route_t, cached
 extern datapipe_struct audio_route_pipe;
 
-//input: sphone_call_mode_t
+//input: sphone_call_mode_t, cached
 extern datapipe_struct call_mode_pipe;
 
 //input: CallProperties
@@ -80,10 +80,19 @@ extern datapipe_struct notification_raise_pipe;
 //input: CommBackend
 extern datapipe_struct comm_backend_added_pipe;
 extern datapipe_struct comm_backend_removed_pipe;
+//input: CommBackend, its availability changed
+extern datapipe_struct comm_backend_changed_pipe;
+
+//input: StoreChange, a call or message was written to the store, keyed by the Contact of the peer
+extern datapipe_struct store_changed_pipe;
 
 void datapipes_init(void);
 void datapipes_exit(void);
 
+char *datapipes_dump_stats(void);
+datapipe_struct *datapipes_find(const char *name);
+GPtrArray *datapipes_record_load(const char *path);
+
 void *drop(void *data, void *user_data);
 
 #ifdef __cplusplus
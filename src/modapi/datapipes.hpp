@@ -0,0 +1,58 @@
+/*
+ * datapipes.hpp
+ * Copyright (C) Carl Philipp Klemm 2021 <carl@uvos.xyz>
+ *
+ * datapipes.hpp is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * datapipes.hpp is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "datapipe.hpp"
+#include "datapipes.h"
+#include "types.h"
+#include "comm.h"
+#include "storage.h"
+
+// Typed handles of the datapipes in datapipes.h, see there for the payloads
+namespace sphone::pipes
+{
+
+inline const Datapipe<char> audioPlayOnce{audio_play_once_pipe};
+inline const Datapipe<char> audioPlayLooping{audio_play_looping_pipe};
+inline const Datapipe<int> audioStop{audio_stop_pipe};
+inline const Datapipe<sphone_audio_route_t> audioRoute{audio_route_pipe};
+
+inline const Datapipe<sphone_call_mode_t> callMode{call_mode_pipe};
+inline const Datapipe<CallProperties> callNew{call_new_pipe};
+inline const Datapipe<CallProperties> callPropertiesChanged{call_properties_changed_pipe};
+inline const Datapipe<CallProperties> callHangup{call_hangup_pipe};
+inline const Datapipe<CallProperties> callAccept{call_accept_pipe};
+inline const Datapipe<CallProperties> callDial{call_dial_pipe};
+inline const Datapipe<CallProperties> callHold{call_hold_pipe};
+
+inline const Datapipe<char> guiError{gui_error_pipe};
+inline const Datapipe<sphone_vibrate_type_t> vibrate{vibrate_pipe};
+
+inline const Datapipe<MessageProperties> messageReceived{message_received_pipe};
+inline const Datapipe<MessageProperties> messageSend{message_send_pipe};
+
+inline const Datapipe<Contact> contactFill{contact_fill_pipe};
+inline const Datapipe<Notification> notificationRaise{notification_raise_pipe};
+
+inline const Datapipe<CommBackend> commBackendAdded{comm_backend_added_pipe};
+inline const Datapipe<CommBackend> commBackendRemoved{comm_backend_removed_pipe};
+inline const Datapipe<CommBackend> commBackendChanged{comm_backend_changed_pipe};
+
+inline const Datapipe<StoreChange> storeChanged{store_changed_pipe};
+
+}
@@ -0,0 +1,48 @@
+/*
+ * phonenumber.h
+ * Copyright (C) Carl Philipp Klemm 2021 <carl@uvos.xyz>
+ *
+ * phonenumber.h is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * phonenumber.h is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Canonical keys of line identifiers
+ *
+ * Line identifiers that are phone numbers are reduced to their digits and,
+ * using the rules in the [PhoneNumbers] group of the configuration,
+ * rewritten to E.164 form, so "+49 151 234", "0049151234" and "0151 234"
+ * share the key "+49151234" if CountryCode=49 is set or the locale is e.g. de_DE.
+ * Any other line identifier, e.g. a sip uri or an email address, is its own key.
+ *
+ * Keys are interned and computed once per line identifier,
+ * they are compared by pointer.
+ */
+
+const char *sphone_phone_number_key(const char *line_identifier);
+
+const char *sphone_phone_number_e164(const char *line_identifier);
+
+void sphone_phone_number_init(void);
+
+void sphone_phone_number_exit(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -61,6 +61,8 @@ bool sphone_module_unload(const char *name);
 
 void sphone_module_failed(module_info_struct *mod, sphone_module_error_t err);
 
+const char *sphone_module_get_name_for_address(const void *address);
+
 typedef const char* sphone_module_init_fn(void** data);
 typedef void sphone_module_exit_fn(void* data);
 
@@ -19,6 +19,7 @@
 #pragma once
 
 #include <glib.h>
+#include <stdbool.h>
 
 #include "types.h"
 
@@ -26,6 +27,147 @@
 extern "C" {
 #endif
 
+typedef enum {
+	STORE_EVENT_CALL = 0,
+	STORE_EVENT_MESSAGE,
+} store_event_t;
+
+typedef enum {
+	STORE_SORT_NEWEST_FIRST = 0,
+	STORE_SORT_OLDEST_FIRST,
+} store_sort_t;
+
+typedef enum {
+	STORE_DIRECTION_ANY = 0,
+	STORE_DIRECTION_INBOUND,
+	STORE_DIRECTION_OUTBOUND,
+} store_direction_t;
+
+typedef enum {
+	STORE_ANSWERED_ANY = 0,
+	STORE_ANSWERED_ONLY,
+	STORE_MISSED_ONLY,
+} store_answered_t;
+
+/**
+ * Describes which calls or messages a cursor returns, the backend applies
+ * the filters when reading its database. Initialize with store_query_init()
+ * and set only the filters needed.
+ */
+typedef struct {
+	store_event_t type;
+	/** Only rows with this contact, or any contact if NULL */
+	const Contact *contact;
+	/** Only rows of this comm backend, or any backend if -1 */
+	int backend;
+	store_direction_t direction;
+	/** Calls only, ignored for messages */
+	store_answered_t answered;
+	/** Only rows that started at or after since and before until, 0 for no limit */
+	time_t since;
+	time_t until;
+	/** Messages only, rows whose text contains this string ignoring case, NULL for any */
+	const char *text;
+} StoreQuery;
+
+void store_query_init(StoreQuery *query, store_event_t type);
+
+/**
+ * A row written to the store, emitted on store_changed_pipe
+ */
+typedef struct {
+	store_event_t type;
+	/** Position of the row, see StoreCursorBackend */
+	gint64 position;
+	/** Comm backend of the row, -1 if its backend is not registered */
+	int backend;
+	/** Interned line identifier and phone number key of the peer */
+	const char *line_identifier;
+	const char *line_key;
+} StoreChange;
+
+/**
+ * One conversation, the messages exchanged with one contact
+ */
+typedef struct {
+	Contact *contact;
+	int backend;
+	time_t last_time;
+	/** The start of the text of the last message */
+	char *last_text;
+	bool last_outbound;
+	/** Number of messages in the conversation */
+	unsigned int count;
+} StoreConversation;
+
+/**
+ * A cursor walks the stored calls or messages one page at a time, rows
+ * are only fetched from the backend when a page is requested.
+ */
+typedef struct _StoreCursor StoreCursor;
+
+/**
+ * Interface implemented by storage backends that can stream their rows.
+ *
+ * Every row has a position, a number unique to the row that increases
+ * with the order in which the rows were stored.
+ */
+typedef struct {
+	/**
+	 * Open a stream of the calls or messages matching query
+	 * Only rows after position after in the sort order are returned, -1 starts at the beginning
+	 * Returns a backend defined stream or NULL on error
+	 */
+	void *(*open)(const StoreQuery *query, store_sort_t sort, gint64 after);
+	/**
+	 * Returns the next CallProperties or MessageProperties of the stream with
+	 * its position in position, or NULL at the end of the stream
+	 */
+	void *(*next)(void *stream, gint64 *position);
+	/**
+	 * Optional, called after every page so the backend can drop any database
+	 * resources it holds until next is called again
+	 */
+	void (*suspend)(void *stream);
+	void (*close)(void *stream);
+} StoreCursorBackend;
+
+/**
+ * Open a cursor over the calls or messages with contact, or all of them if contact is NULL
+ * resume_token, if not NULL, is a token from store_cursor_get_resume_token() and
+ * the cursor continues after the last row returned to the cursor that created it
+ * Returns NULL if there is no backend or resume_token is invalid
+ */
+StoreCursor *store_cursor_new(store_event_t type, const Contact *contact, store_sort_t sort, const char *resume_token);
+
+/**
+ * Open a cursor over the calls or messages matching query, see store_cursor_new()
+ * A resume token is only meaningful with the same query it was created with
+ */
+StoreCursor *store_cursor_new_for_query(const StoreQuery *query, store_sort_t sort, const char *resume_token);
+
+/**
+ * Returns the next up to page_size rows of the cursor, NULL if the cursor is at its end
+ * The list must be freed with store_free_call_list() or store_free_message_list()
+ */
+GList *store_cursor_next_page(StoreCursor *cursor, unsigned int page_size);
+
+bool store_cursor_at_end(const StoreCursor *cursor);
+
+/**
+ * Returns a newly allocated token that can be passed to store_cursor_new()
+ * to continue after the last row this cursor returned
+ */
+char *store_cursor_get_resume_token(const StoreCursor *cursor);
+
+/**
+ * Returns the position of the last row the cursor returned, -1 if it returned none
+ * and was not resumed, it can be passed to store_get_calls_since() or store_get_messages_since()
+ */
+gint64 store_cursor_get_position(const StoreCursor *cursor);
+
+void store_cursor_free(StoreCursor *cursor);
+
 GList *store_get_all_calls(unsigned int limit);
 GList *store_get_messages(unsigned int limit);
 
@@ -33,13 +175,41 @@ GList *store_get_messages_for_contact(Contact *contact, unsigned int limit);
 GList *store_get_calls_for_contact(Contact *contact, unsigned int limit);
 GList *store_get_interacted_msg_contacts(void);
 
+/**
+ * Returns a list of StoreConversation, one per contact messages were exchanged with,
+ * the most recently active first
+ * Must be freed with store_free_conversation_list()
+ */
+GList *store_get_conversations(void);
+
+/**
+ * Returns the calls or messages with contact, or all of them if contact is NULL,
+ * that were stored after position, oldest first
+ * If last_position is not NULL it is set to the position of the newest row returned,
+ * or to position if there are none, so it can be passed to the next call
+ */
+GList *store_get_calls_since(Contact *contact, gint64 position, gint64 *last_position);
+GList *store_get_messages_since(Contact *contact, gint64 position, gint64 *last_position);
+
 void store_free_call_list(GList *list);
 void store_free_message_list(GList *list);
 void store_free_contacts_list(GList *list);
+void store_free_conversation_list(GList *list);
 
 int store_register_backend(GList *(*get_messages_for_contact)(Contact *contact, unsigned int limit),
 						   GList *(*get_calls_for_contact)(Contact *contact, unsigned int limit));
 
+int store_register_cursor_backend(const StoreCursorBackend *backend);
+
+/**
+ * get_conversations returns StoreConversation allocated with g_new0, the text with g_malloc
+ */
+int store_register_conversation_backend(GList *(*get_conversations)(void));
+
+/**
+ * Cursors that are still open are closed and read as at their end afterwards,
+ * they must still be freed with store_cursor_free()
+ */
 void store_unregister_backend(int id);
 
 #ifdef __cplusplus
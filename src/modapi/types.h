@@ -20,6 +20,7 @@
 
 #include <time.h>
 #include <stdbool.h>
+#include <glib.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -101,24 +102,88 @@ typedef enum {
 
 const char *sphone_get_state_string(sphone_call_state_t state);
 
+/**
+ * Intern a string
+ *
+ * Equal strings share one canonical copy that lives as long as sphone.
+ * Line identifiers and backend uids are always interned, so they are
+ * compared by pointer and copied without allocating.
+ *
+ * @return The canonical copy of str or NULL if str is NULL
+ */
+const char *sphone_intern(const char *str);
+
+/**
+ * Get the canonical copy of a string without interning it
+ *
+ * @return The canonical copy of str or NULL if str was never interned
+ */
+const char *sphone_intern_lookup(const char *str);
+
+/**
+ * A contact, reference counted, line_identifier is interned
+ *
+ * line_key caches sphone_phone_number_key() of line_identifier, see phonenumber.h,
+ * it may be NULL and is then looked up when needed. Contacts are equal and
+ * hash alike if their backend and key match.
+ *
+ * Contacts with shared set are owned by the contact registry, see contacts.h,
+ * they must not be modified.
+ */
 typedef struct _Contact {
 	char *name;
-	char *line_identifier;
+	const char *line_identifier;
+	const char *line_key;
 	sphone_contact_field_t line_identifier_field;
 	int backend;
+	bool shared;
+	gatomicrefcount ref_count;
 } Contact;
 
-void contact_free(Contact *contact);
+Contact *contact_new(void);
+
+Contact *contact_ref(const Contact *contact);
+
+void contact_unref(Contact *contact);
 
 Contact *contact_copy(const Contact *contact);
 
 bool contact_cmp(const Contact *a, const Contact *b);
 
+unsigned int contact_hash(const Contact *contact);
+
+GVariant *contact_to_variant(const Contact *contact);
+
+Contact *contact_from_variant(GVariant *variant);
+
 void contact_print(const Contact *contact, const char *module_name);
 
+/**
+ * Fields of a call changed by the last update of the call registry
+ */
+typedef enum {
+	SPHONE_CALL_CHANGED_STATE = 1,
+	SPHONE_CALL_CHANGED_CONTACT = 1<<1,
+	SPHONE_CALL_CHANGED_LINE_IDENTIFIER = 1<<2,
+	SPHONE_CALL_CHANGED_TIME = 1<<3,
+	SPHONE_CALL_CHANGED_ANSWERED = 1<<4,
+	SPHONE_CALL_CHANGED_NEEDS_ROUTE = 1<<5,
+	SPHONE_CALL_CHANGED_FLAGS = 1<<6,
+} sphone_call_change_t;
+
+/**
+ * A call, reference counted
+ *
+ * Live calls are owned by the call registry, see calls.h, and shared by all modules,
+ * only the registry modifies them. changes holds the sphone_call_change_t
+ * flags of the last update, triggers on call_properties_changed_pipe use them
+ * to skip updates they do not act on. line_identifier is interned, line_key is
+ * its cached key like in Contact.
+ */
 typedef struct _CallProperties{
 	Contact *contact;
-	char *line_identifier;
+	const char *line_identifier;
+	const char *line_key;
 	sphone_call_state_t state;
 	int backend;
 	char *backend_data;
@@ -128,40 +193,135 @@ typedef struct _CallProperties{
 	bool answered;
 	bool needs_route;
 	bool outbound;
+	unsigned int changes;
+	gatomicrefcount ref_count;
 } CallProperties;
 
 void call_properties_print(const CallProperties *call, const char *module_name);
 
-void call_properties_free(CallProperties *properties);
+CallProperties *call_properties_new(void);
+
+CallProperties *call_properties_ref(const CallProperties *properties);
+
+void call_properties_unref(CallProperties *properties);
 
 bool call_properties_comp(const CallProperties *a, const CallProperties *b);
 
+unsigned int call_properties_hash(const CallProperties *call);
+
 CallProperties *call_properties_copy(const CallProperties *properties);
 
+GVariant *call_properties_to_variant(const CallProperties *properties);
+
+CallProperties *call_properties_from_variant(GVariant *variant);
+
+/**
+ * A message, shared between its consumers by reference counting
+ *
+ * Messages are created with message_properties_new(), text is a GRefString,
+ * line_identifier is interned and line_key is its cached key like in Contact.
+ * Once passed to a datapipe a message is shared and must not be modified,
+ * except by the filters of that datapipe. Consumers that keep a message
+ * take a reference instead of copying it.
+ */
 typedef struct _MessageProperties{
 	Contact *contact;
-	char *line_identifier;
+	const char *line_identifier;
+	const char *line_key;
 	char *technology;
 	char *text;
 	int backend;
 	char *backend_data;
 	time_t time;
 	bool outbound;
+	gatomicrefcount ref_count;
 } MessageProperties;
 
+MessageProperties *message_properties_new(void);
+
+MessageProperties *message_properties_ref(const MessageProperties *properties);
+
+void message_properties_unref(MessageProperties *properties);
+
 MessageProperties *message_properties_copy(const MessageProperties *properties);
 
 void message_properties_print(const MessageProperties *call, const char *module_name);
 
-void message_properties_free(MessageProperties *properties);
+GVariant *message_properties_to_variant(const MessageProperties *properties);
+
+MessageProperties *message_properties_from_variant(GVariant *variant);
 
 typedef struct _Notification{
 	char *title;
 	char *text;
 } Notification;
 
+Notification *notification_copy(const Notification *notification);
+
 void notification_free(Notification *notification);
 
+GVariant *notification_to_variant(const Notification *notification);
+
+Notification *notification_from_variant(GVariant *variant);
+
+/*
+ * Binary encoding of Contact, CallProperties, MessageProperties and Notification
+ *
+ * A stream starts with an 8 byte header: the magic "SPHT", the little endian
+ * guint16 SPHONE_TYPES_ENCODING_VERSION and two reserved bytes. Each record
+ * follows as an 8 byte record header, a little endian guint32 length, a
+ * sphone_type_tag_t byte and three reserved bytes, then length bytes of the
+ * little endian serialized GVariant the to_variant function of the type
+ * returns, padded with zeros to a multiple of 8 bytes.
+ * Records and their GVariants stay 8 byte aligned, so a record can be read
+ * in place, see sphone_types_stream_next_view().
+ *
+ * SPHONE_TYPE_VARIANT records carry any other GVariant boxed as "v", their
+ * data is the unboxed GVariant, this is used for recorded datapipe events and
+ * module caches.
+ *
+ * The GVariant types of an encoding version never change, a change to the
+ * to_variant functions bumps SPHONE_TYPES_ENCODING_VERSION. Streams of other
+ * versions are rejected.
+ */
+#define SPHONE_TYPES_ENCODING_VERSION 2
+
+typedef enum {
+	SPHONE_TYPE_NONE = 0,
+	SPHONE_TYPE_CONTACT,
+	SPHONE_TYPE_CALL,
+	SPHONE_TYPE_MESSAGE,
+	SPHONE_TYPE_NOTIFICATION,
+	SPHONE_TYPE_VARIANT,
+	SPHONE_TYPE_COUNT
+} sphone_type_tag_t;
+
+/**
+ * A cursor over the records of an encoded stream
+ */
+typedef struct _SphoneTypesStream {
+	GBytes *bytes;
+	gsize offset;
+} SphoneTypesStream;
+
+void sphone_types_stream_begin(GByteArray *stream);
+
+bool sphone_types_stream_append(GByteArray *stream, sphone_type_tag_t tag, gconstpointer data);
+
+bool sphone_types_stream_init(SphoneTypesStream *stream, GBytes *bytes);
+
+GVariant *sphone_types_stream_next_view(SphoneTypesStream *stream, sphone_type_tag_t *tag);
+
+gpointer sphone_types_stream_next(SphoneTypesStream *stream, sphone_type_tag_t *tag);
+
+void sphone_types_stream_clear(SphoneTypesStream *stream);
+
+GBytes *sphone_types_encode(sphone_type_tag_t tag, gconstpointer data);
+
+gpointer sphone_types_decode(GBytes *bytes, sphone_type_tag_t *tag);
+
+void sphone_types_free(sphone_type_tag_t tag, gpointer data);
+
 struct str_list {
   char **data;
   int count;
@@ -26,6 +26,8 @@
 #include "sphone-modules.h"
 #include "sphone-log.h"
 #include "comm.h"
+#include "calls.h"
+#include "phonenumber.h"
 #include "datapipe.h"
 #include "datapipes.h"
 #include "types.h"
@@ -74,7 +76,6 @@ struct ofono_if_priv_s {
 	int backend_id;
 	int callback_ids[HANDLE_ID_COUNT];
 	GSList *call_prop_sig_ids;
-	GSList *calls;
 };
 
 struct call_watcher {
@@ -197,6 +198,7 @@ static void ofono_service_appeard(GDBusConnection *connection, const gchar *name
 		
 	if (modems->count <= 0) {
 		sphone_module_log(LL_DEBUG, "There is no modem.");
+		sphone_comm_set_availability(private->backend_id, COMM_AVAILABILITY_UNAVAILABLE);
 		g_free(modems);
 		return;
 	}
@@ -227,6 +229,8 @@ static void ofono_service_appeard(GDBusConnection *connection, const gchar *name
 		new_sms_cb,
 		private,
 		NULL);
+
+	sphone_comm_set_availability(private->backend_id, COMM_AVAILABILITY_AVAILABLE);
 }
 
 static void ofono_service_vanished(GDBusConnection *connection, const gchar *name, 
@@ -243,6 +247,7 @@ static void ofono_service_vanished(GDBusConnection *connection, const gchar *nam
 	g_dbus_connection_signal_unsubscribe(private->s_bus_conn, private->callback_ids[NEW_SMS_HANDLE_ID]);
 	g_free(private->modem);
 	private->modem = NULL;
+	sphone_comm_set_availability(private->backend_id, COMM_AVAILABILITY_UNAVAILABLE);
 }
 
 static sphone_call_state_t ofono_string_to_call_state(const gchar *state)
@@ -272,8 +277,10 @@ static void ofono_voice_call_decode_properties(CallProperties *call, GVariantIte
 	
 	call->backend_data = g_strdup(path);
 	while (g_variant_iter_loop(iter_val, "{sv}", &key, &val)) {
-		if (g_strcmp0(key, "LineIdentification") == 0)
-			call->line_identifier = g_variant_dup_string(val, NULL);
+		if (g_strcmp0(key, "LineIdentification") == 0) {
+			call->line_identifier = sphone_intern(g_variant_get_string(val, NULL));
+			call->line_key = sphone_phone_number_key(call->line_identifier);
+		}
 		else if (g_strcmp0(key, "State") == 0)
 			call->state = ofono_string_to_call_state(g_variant_get_string(val, NULL));
 		else if (g_strcmp0(key, "Emergency") == 0)
@@ -305,16 +312,12 @@ static void ofono_voice_call_properties_remove_handler(struct ofono_if_priv_s *p
 	}
 }
 
-static CallProperties *ofono_find_call(struct ofono_if_priv_s *priv, const gchar *object_path)
+static const CallProperties *ofono_find_call(struct ofono_if_priv_s *priv, const gchar *object_path)
 {
-	GSList *element;
-	for(element = priv->calls; element; element = element->next) {
-		CallProperties *call = element->data;
-		if(g_strcmp0(call->backend_data, object_path) == 0)
-			return call;
-	}
-	sphone_module_log(LL_WARN, "%s unable to find call %s", __func__, object_path);
-	return NULL;
+	const CallProperties *call = sphone_calls_find(priv->backend_id, object_path);
+	if(!call)
+		sphone_module_log(LL_WARN, "%s unable to find call %s", __func__, object_path);
+	return call;
 }
 
 static void call_properties_cb(GDBusConnection *connection,
@@ -333,7 +336,7 @@ static void call_properties_cb(GDBusConnection *connection,
 	struct ofono_if_priv_s *priv = data;
 	
 	sphone_module_log(LL_DEBUG, "%s: %s", __func__, object_path);
-	CallProperties *call = ofono_find_call(priv, object_path);
+	const CallProperties *call = ofono_find_call(priv, object_path);
 
 	if(call) {
 		gchar *key;
@@ -342,19 +345,17 @@ static void call_properties_cb(GDBusConnection *connection,
 		g_variant_get(parameters, "(sv)", &key, &value);
 		
 		if(g_strcmp0(key, "State") == 0) {
-			call->state = ofono_string_to_call_state(g_variant_get_string(value, NULL));
+			CallProperties update = *call;
+			update.state = ofono_string_to_call_state(g_variant_get_string(value, NULL));
 			
-			if(call->state == SPHONE_CALL_ACTIVE)
-				call->start_time = time(NULL);
-			else if(call->state == SPHONE_CALL_DISCONNECTED)
-				call->end_time = time(NULL);
-			execute_datapipe(&call_properties_changed_pipe, call);
-
-			if(call->state == SPHONE_CALL_DISCONNECTED) {
-				priv->calls = g_slist_remove(priv->calls, call);
+			if(update.state == SPHONE_CALL_ACTIVE)
+				update.start_time = time(NULL);
+			else if(update.state == SPHONE_CALL_DISCONNECTED)
+				update.end_time = time(NULL);
+			sphone_calls_update(&update);
+
+			if(update.state == SPHONE_CALL_DISCONNECTED)
 				ofono_voice_call_properties_remove_handler(priv, object_path);
-				call_properties_free(call);
-			} 
 		}
 	}
 }
@@ -401,7 +402,7 @@ static void call_added_cb(GDBusConnection *connection,
 	
 	struct ofono_if_priv_s *priv = data;
 	
-	CallProperties *call = g_malloc0(sizeof(*call));
+	CallProperties *call = call_properties_new();
 	call->backend = priv->backend_id;
 	call->needs_route = true;
 	call->start_time = time(NULL);
@@ -418,8 +419,8 @@ static void call_added_cb(GDBusConnection *connection,
 
 	g_variant_iter_free(info_iter);
 	g_free(path);
-	execute_datapipe(&call_new_pipe, call);
-	priv->calls = g_slist_prepend(priv->calls, call);
+	sphone_calls_add(call);
+	call_properties_unref(call);
 }
 
 static void call_hold_trigger(gconstpointer data, gpointer user_data)
@@ -437,7 +438,7 @@ static void call_accept_trigger(gconstpointer data, gpointer user_data)
 	struct ofono_if_priv_s *priv = (struct ofono_if_priv_s*)user_data;
 
 	if(icall->backend == priv->backend_id && ofono_init_valid(priv)) {
-		CallProperties *call = ofono_find_call(priv, icall->backend_data);
+		const CallProperties *call = ofono_find_call(priv, icall->backend_data);
 
 		if(!call) 
 			return;
@@ -445,13 +446,20 @@ static void call_accept_trigger(gconstpointer data, gpointer user_data)
 		GVariant *result;
 		GError *gerror = NULL;
 		
+		gint64 start = sphone_comm_operation_begin(priv->backend_id, COMM_OP_ANSWER);
 		result = g_dbus_connection_call_sync(priv->s_bus_conn, OFONO_SERVICE, call->backend_data,
 			OFONO_VOICECALL_IFACE, "Answer", NULL, NULL,
 			G_DBUS_CALL_FLAGS_NONE, -1, NULL, &gerror);
+		sphone_comm_operation_reply(priv->backend_id, COMM_OP_ANSWER, start, !gerror);
 
-		call->answered = true;
+		if(!gerror) {
+			CallProperties update = *call;
+			update.answered = true;
+			sphone_calls_update(&update);
+		}
 
-		g_variant_unref(result);
+		if(result)
+			g_variant_unref(result);
 
 		if(gerror) {
 			error_dbus(gerror);
@@ -474,9 +482,11 @@ static void call_hangup_trigger(gconstpointer data, gpointer user_data)
 		GVariant *result;
 		GError *gerror = NULL;
 		
+		gint64 start = sphone_comm_operation_begin(priv->backend_id, COMM_OP_HANGUP);
 		result = g_dbus_connection_call_sync(priv->s_bus_conn, OFONO_SERVICE, call->backend_data,
 			OFONO_VOICECALL_IFACE, "Hangup", NULL, NULL,
 			G_DBUS_CALL_FLAGS_NONE, -1, NULL, &gerror);
+		sphone_comm_operation_reply(priv->backend_id, COMM_OP_HANGUP, start, !gerror);
 
 		if(gerror) {
 			error_dbus(gerror);
@@ -511,22 +521,25 @@ static void new_sms_cb(GDBusConnection *connection,
 	GVariantIter *iter;
 	GVariant *var;
 	char *key;
+	const char *text;
 	
-	MessageProperties *message = g_malloc0(sizeof(*message));
+	MessageProperties *message = message_properties_new();
 	message->backend = priv->backend_id;
 
 	struct tm tm = {0};
 
-	g_variant_get(parameters, "(sa{sv})", &message->text, &iter);
+	g_variant_get(parameters, "(&sa{sv})", &text, &iter);
+	message->text = g_ref_string_new(text);
 	
 	while (g_variant_iter_next(iter, "{sv}", &key, &var)) {
 		if (g_strcmp0(key, "Sender") == 0) {
-			message->line_identifier = g_strdup(g_variant_get_string(var, NULL));
+			message->line_identifier = sphone_intern(g_variant_get_string(var, NULL));
 			if (!message->line_identifier) {
 				g_variant_unref(var);
 				g_free(key);
 				goto error;
 			}
+			message->line_key = sphone_phone_number_key(message->line_identifier);
 		}
 		else if (g_strcmp0(key, "LocalSentTime") == 0) {
 			const char *time = g_variant_get_string(var, NULL);
@@ -549,7 +562,7 @@ static void new_sms_cb(GDBusConnection *connection,
 		execute_datapipe(&message_received_pipe, message);
 
 	error:
-	message_properties_free(message);
+	message_properties_unref(message);
 	g_variant_iter_free(iter);
 }
 
@@ -566,9 +579,11 @@ static void call_dial_trigger(gconstpointer data, gpointer user_data)
 		bool hidden_line_id = sphone_conf_get_bool("Comm", "HiddenLineId", false, NULL);
 
 		val = g_variant_new("(ss)", call->line_identifier, hidden_line_id ? "enabled" : "disabled");
+		gint64 start = sphone_comm_operation_begin(priv->backend_id, COMM_OP_DIAL);
 		result = g_dbus_connection_call_sync(priv->s_bus_conn, OFONO_SERVICE, priv->modem,
 			OFONO_VOICECALL_MANAGER_IFACE, "Dial", val, NULL,
 			G_DBUS_CALL_FLAGS_NONE, -1, NULL, &gerror);
+		sphone_comm_operation_reply(priv->backend_id, COMM_OP_DIAL, start, !gerror);
 
 		if(gerror) {
 			error_dbus(gerror);
@@ -584,13 +599,10 @@ static void call_dial_trigger(gconstpointer data, gpointer user_data)
 	}
 }
 
-static bool is_numeric(uint32_t codepoint)
-{
-	if((codepoint >= 0x30 && codepoint <= 0x39) || codepoint == 0x2b)
-		return true;
-	else
-		return false;
-}
+static const CodepointRange numeric_ranges[] = {
+	{'0', '9'},
+	{'+', '+'},
+};
 
 static void message_send_trigger(gconstpointer data, gpointer user_data)
 {
@@ -603,9 +615,11 @@ static void message_send_trigger(gconstpointer data, gpointer user_data)
 		GVariant *result;
 		GError *gerror = NULL;
 		val = g_variant_new("(ss)", message->line_identifier, message->text);
+		gint64 start = sphone_comm_operation_begin(priv->backend_id, COMM_OP_SEND_MESSAGE);
 		result = g_dbus_connection_call_sync(priv->s_bus_conn, OFONO_SERVICE, priv->modem,
 			OFONO_MESSAGE_MANAGER_IFACE, "SendMessage", val, NULL,
 			G_DBUS_CALL_FLAGS_NONE, -1, NULL, &gerror);
+		sphone_comm_operation_reply(priv->backend_id, COMM_OP_SEND_MESSAGE, start, !gerror);
 
 		if(gerror) {
 			error_dbus(gerror);
@@ -642,7 +656,8 @@ const gchar *sphone_module_init(void** data)
 		SPHONE_FIELD_LISTEND
 	};
 	
-	priv->backend_id = sphone_comm_add_backend("cellular", "sphone/ofono", schemes, BACKEND_FLAG_MESSAGE | BACKEND_FLAG_CALL | BACKEND_FLAG_CELLULAR, fields, &is_numeric);
+	priv->backend_id = sphone_comm_add_backend("cellular", "sphone/ofono", schemes, BACKEND_FLAG_MESSAGE | BACKEND_FLAG_CALL | BACKEND_FLAG_CELLULAR, fields, NULL);
+	sphone_comm_set_valid_ranges(priv->backend_id, numeric_ranges, G_N_ELEMENTS(numeric_ranges));
 
 	priv->ofono_service_watcher =
 						g_bus_watch_name_on_connection(priv->s_bus_conn, OFONO_SERVICE, 
@@ -19,6 +19,7 @@
 #include "sphone-modules.h"
 #include "sphone-log.h"
 #include "comm.h"
+#include "calls.h"
 #include "types.h"
 #include "datapipes.h"
 #include "datapipe.h"
@@ -29,8 +30,6 @@
 /** Functionality provided by this module */
 static const gchar *const provides[] = { MODULE_NAME, NULL };
 
-static GSList *calls;
-
 static int id;
 
 /** Module information */
@@ -54,62 +53,65 @@ static gboolean call_remote_accept(void *data)
 	CallProperties *call = data;
 	if(call->state == SPHONE_CALL_INVALID) {
 		call->state = SPHONE_CALL_DIALING;
-		execute_datapipe(&call_new_pipe, call);
+		sphone_calls_add(call);
 		sphone_module_log(LL_DEBUG, "set state diling on %s", call->line_identifier);
 		return true;
-	} else if(call->state == SPHONE_CALL_DIALING) {
-		call->state = SPHONE_CALL_ALERTING;
-		execute_datapipe(&call_properties_changed_pipe, call);
-		sphone_module_log(LL_DEBUG, "set state alerting on %s", call->line_identifier);
-		return true;
-	}  else if(call->state == SPHONE_CALL_ALERTING) {
-		call->state = SPHONE_CALL_ACTIVE;
-		call->answered = true;
-		call->start_time = time(NULL);
-		execute_datapipe(&call_properties_changed_pipe, call);
-		sphone_module_log(LL_DEBUG, "set state active on %s", call->line_identifier);
-		return false;
 	}
+
+	const CallProperties *live = sphone_calls_find_line(id, call->line_identifier);
+	if(live) {
+		CallProperties update = *live;
+		if(live->state == SPHONE_CALL_DIALING) {
+			update.state = SPHONE_CALL_ALERTING;
+			sphone_calls_update(&update);
+			sphone_module_log(LL_DEBUG, "set state alerting on %s", call->line_identifier);
+			return true;
+		} else if(live->state == SPHONE_CALL_ALERTING) {
+			update.state = SPHONE_CALL_ACTIVE;
+			update.answered = true;
+			update.start_time = time(NULL);
+			sphone_calls_update(&update);
+			sphone_module_log(LL_DEBUG, "set state active on %s", call->line_identifier);
+		}
+	}
+	call_properties_unref(call);
 	return false;
 }
 
 static gboolean mock_incomeing_call(void *data)
 {
-	CallProperties *call = g_malloc0(sizeof(*call));
+	CallProperties *call = call_properties_new();
 	
 	call->line_identifier = data;
 	call->backend = id;
 	call->needs_route = true;
 	call->state = SPHONE_CALL_INCOMING;
 	call->start_time = time(NULL);
-	calls = g_slist_prepend(calls ,call);
-	execute_datapipe(&call_new_pipe, call);
+	sphone_calls_add(call);
+	call_properties_unref(call);
 	return false;
 }
 
-static CallProperties *find_call(const CallProperties *icall)
+static const CallProperties *find_call(const CallProperties *icall)
 {
-	GSList *element;
-	for(element = calls; element; element = element->next) {
-		CallProperties *call = element->data;
-		if(call_properties_comp(icall, call))
-			return call;
-	}
-	sphone_module_log(LL_WARN, "unable to find call %s", icall->line_identifier);
-	return NULL;
+	const CallProperties *call = sphone_calls_find_call(icall);
+	if(!call)
+		sphone_module_log(LL_WARN, "unable to find call %s", icall->line_identifier);
+	return call;
 }
 
 static void call_dial_trigger(const void *data, void *user_data)
 {
 	(void)user_data;
-	CallProperties *call = call_properties_copy(data);
+	const CallProperties *icall = data;
 	
-	if(call->backend == id) {
+	if(icall->backend == id) {
+		sphone_comm_operation_reply(id, COMM_OP_DIAL, sphone_comm_operation_begin(id, COMM_OP_DIAL), true);
+		CallProperties *call = call_properties_copy(icall);
 		call->state = SPHONE_CALL_INVALID;
-		g_timeout_add_seconds(3, call_remote_accept, call);
 		call->needs_route = true;
 		call->outbound = true;
-		calls = g_slist_prepend(calls ,call);
+		g_timeout_add_seconds(3, call_remote_accept, call);
 	}
 }
 
@@ -119,12 +121,15 @@ static void call_accept_trigger(const void *data, void *user_data)
 	const CallProperties *icall = data;
 	
 	if(icall->backend == id && icall->state == SPHONE_CALL_INCOMING) {
-		CallProperties *call = find_call(icall);
+		gint64 start = sphone_comm_operation_begin(id, COMM_OP_ANSWER);
+		const CallProperties *call = find_call(icall);
+		sphone_comm_operation_reply(id, COMM_OP_ANSWER, start, call);
 		if(call) {
-			call->answered = true;
-			call->state = SPHONE_CALL_ACTIVE;
-			call->start_time = time(NULL);
-			execute_datapipe(&call_properties_changed_pipe, call);
+			CallProperties update = *call;
+			update.answered = true;
+			update.state = SPHONE_CALL_ACTIVE;
+			update.start_time = time(NULL);
+			sphone_calls_update(&update);
 		}
 	}
 }
@@ -143,19 +148,22 @@ static void call_hangup_trigger(const void *data, void *user_data)
 	const CallProperties *icall = data;
 	
 	if(icall->backend == id) {
-		CallProperties *call = find_call(icall);
+		gint64 start = sphone_comm_operation_begin(id, COMM_OP_HANGUP);
+		const CallProperties *call = find_call(icall);
+		sphone_comm_operation_reply(id, COMM_OP_HANGUP, start, call);
 		if(call) {
-			call->state = SPHONE_CALL_DISCONNECTED;
-			call->end_time = time(NULL);
-			execute_datapipe(&call_properties_changed_pipe, call);
+			bool answered = call->answered;
+			const char *line_id = call->line_identifier;
+
+			CallProperties update = *call;
+			update.state = SPHONE_CALL_DISCONNECTED;
+			update.end_time = time(NULL);
+			sphone_calls_update(&update);
 			
-			if(call->answered) {
-				char *line_id = g_strdup(call->line_identifier);
+			if(answered) {
 				sphone_module_log(LL_DEBUG, "%s will call back in 10s", line_id);
-				g_timeout_add_seconds(10, mock_incomeing_call, line_id);
+				g_timeout_add_seconds(10, mock_incomeing_call, (void*)line_id);
 			}
-			calls = g_slist_remove(calls, call);
-			call_properties_free(call);
 		}
 	}
 }
@@ -168,7 +176,7 @@ static gboolean mock_incomeing_message(void *data)
 	msg->outbound = false;
 	sphone_module_log(LL_DEBUG, "Mock received message %s with text \"%s\"", msg->line_identifier, msg->text);
 	execute_datapipe(&message_received_pipe, msg);
-	message_properties_free(msg);
+	message_properties_unref(msg);
 	return false;
 }
 
@@ -179,19 +187,16 @@ static void message_send_trigger(const void *data, void *user_data)
 	const MessageProperties *msg = data;
 	
 	if(msg->backend == id) {
+		sphone_comm_operation_reply(id, COMM_OP_SEND_MESSAGE, sphone_comm_operation_begin(id, COMM_OP_SEND_MESSAGE), true);
 		sphone_module_log(LL_DEBUG, "Mock sending message to %s with text \"%s\"", msg->line_identifier, msg->text);
 		g_timeout_add_seconds(2, mock_incomeing_message, message_properties_copy(msg));
 	}
 	
 }
 
-static bool is_not_special(uint32_t codepoint)
-{
-	if(codepoint >= 0x40)
-		return true;
-	else
-		return false;
-}
+static const CodepointRange not_special_ranges[] = {
+	{0x40, 0x10FFFF},
+};
 
 SPHONE_MODULE_EXPORT const gchar *sphone_module_init(void** data);
 const gchar *sphone_module_init(void** data)
@@ -206,7 +211,9 @@ const gchar *sphone_module_init(void** data)
 		NULL
 	};
 	
-	id = sphone_comm_add_backend(MODULE_NAME, "sphone/comtest", commtest_schemes, BACKEND_FLAG_MESSAGE | BACKEND_FLAG_CALL | BACKEND_FLAG_DTMF, NULL, &is_not_special);
+	id = sphone_comm_add_backend(MODULE_NAME, "sphone/comtest", commtest_schemes, BACKEND_FLAG_MESSAGE | BACKEND_FLAG_CALL | BACKEND_FLAG_DTMF, NULL, NULL);
+	sphone_comm_set_valid_ranges(id, not_special_ranges, G_N_ELEMENTS(not_special_ranges));
+	sphone_comm_set_availability(id, COMM_AVAILABILITY_AVAILABLE);
 
 	append_trigger_to_datapipe(&call_dial_pipe, call_dial_trigger, NULL);
 	append_trigger_to_datapipe(&call_accept_pipe, call_accept_trigger, NULL);
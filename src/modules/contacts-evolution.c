@@ -24,6 +24,8 @@
 #include "datapipes.h"
 #include "types.h"
 #include "comm.h"
+#include "phonenumber.h"
+#include "contacts.h"
 
 /** Module name */
 #define MODULE_NAME		"contacts-evolution"
@@ -43,6 +45,7 @@ SPHONE_MODULE_EXPORT module_info_struct module_info = {
 
 struct evolution_priv {
 	EBookClient *ebook;
+	EBookClientView *view;
 };
 
 
@@ -80,11 +83,9 @@ static EBookQuery *build_query(const char *line_id, int backend_id)
 
 	EBookQuery *query = NULL;
 	if(fields_contain(fields, SPHONE_FIELD_PHONE) || fields_contain(fields, SPHONE_FIELD_SIP)) {
-		EPhoneNumber *enumber = e_phone_number_from_string(line_id, NULL, NULL);
-
-		if(enumber) {
-			gchar *number = e_phone_number_to_string(enumber, E_PHONE_NUMBER_FORMAT_E164);
+		const char *number = sphone_phone_number_e164(line_id);
 
+		if(number) {
 			EBookQuery *phonequery = e_book_query_orv(
 				e_book_query_field_test(E_CONTACT_PHONE_ASSISTANT, E_BOOK_QUERY_EQUALS_SHORT_PHONE_NUMBER, number),
 				e_book_query_field_test(E_CONTACT_PHONE_BUSINESS, E_BOOK_QUERY_EQUALS_SHORT_PHONE_NUMBER, number),
@@ -108,9 +109,6 @@ static EBookQuery *build_query(const char *line_id, int backend_id)
 				NULL);
 
 			query = join_query(query, phonequery);
-
-			g_free(number);
-			g_free(enumber);
 		}
 	}
 
@@ -155,9 +153,9 @@ static GSList *find_e_contacts(EBookClient *ebook, const char *line_id, int back
 	return NULL;
 }
 
-static bool fill_contact(EBookClient *ebook, const char *line_id, Contact *contact, int id)
+static bool fill_contact(EBookClient *ebook, Contact *contact)
 {
-	GSList *contacts = find_e_contacts(ebook, line_id, id);
+	GSList *contacts = find_e_contacts(ebook, contact->line_identifier, contact->backend);
 
 	if(!contacts)
 		return false;
@@ -166,24 +164,17 @@ static bool fill_contact(EBookClient *ebook, const char *line_id, Contact *conta
 	contact->name = g_strdup(e_contact_get_const(econtact, E_CONTACT_FULL_NAME));
 	e_client_util_free_object_slist(contacts);
 
-	contact->line_identifier = g_strdup(line_id);
-	contact->backend = id;
-
 	return (bool)contact->name;
 }
 
 static gpointer call_filter(gpointer data, gpointer user_data)
 {
 	CallProperties *call = data;
-	struct evolution_priv *priv = user_data;
-	if(priv->ebook && !call->contact) {
-		call->contact = g_malloc0(sizeof(*call->contact));
-		if(!fill_contact(priv->ebook, call->line_identifier, call->contact, call->backend)) {
-			g_free(call->contact);
-			call->contact = NULL;
-		} else {
+	(void)user_data;
+	if(!call->contact) {
+		call->contact = sphone_contacts_get(call->backend, call->line_identifier, NULL);
+		if(call->contact && call->contact->name)
 			sphone_module_log(LL_DEBUG, "got contact: %s", call->contact->name);
-		}
 	}
 	return call;
 }
@@ -191,15 +182,11 @@ static gpointer call_filter(gpointer data, gpointer user_data)
 static gpointer message_filter(gpointer data, gpointer user_data)
 {
 	MessageProperties *msg = data;
-	struct evolution_priv *priv = user_data;
-	if(priv->ebook && !msg->contact) {
-		msg->contact = g_malloc0(sizeof(*msg->contact));
-		if(!fill_contact(priv->ebook, msg->line_identifier, msg->contact, msg->backend)) {
-			g_free(msg->contact);
-			msg->contact = NULL;
-		} else {
+	(void)user_data;
+	if(!msg->contact) {
+		msg->contact = sphone_contacts_get(msg->backend, msg->line_identifier, NULL);
+		if(msg->contact && msg->contact->name)
 			sphone_module_log(LL_DEBUG, "got contact: %s", msg->contact->name);
-		}
 	}
 	return msg;
 }
@@ -208,15 +195,44 @@ static gpointer contact_filter(gpointer data, gpointer user_data)
 {
 	Contact *contact = data;
 	struct evolution_priv *priv = user_data;
-	if(priv->ebook && !contact->name) {
-		gchar *line_id = contact->line_identifier;
-		fill_contact(priv->ebook, line_id, contact, contact->backend);
-		if(line_id != contact->line_identifier)
-			g_free(line_id);
-	}
+	if(priv->ebook && !contact->name && contact->line_identifier)
+		fill_contact(priv->ebook, contact);
 	return contact;
 }
 
+static void book_changed_callback(EBookClientView *view, const GSList *objects, gpointer user_data)
+{
+	(void)view;
+	(void)objects;
+	(void)user_data;
+	// Names of contacts in use may have been added, edited or removed
+	sphone_contacts_resolve();
+}
+
+static void view_ready_callback(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	struct evolution_priv *priv = user_data;
+	GError *error = NULL;
+
+	if(!e_book_client_get_view_finish(E_BOOK_CLIENT(source_object), res, &priv->view, &error)) {
+		sphone_module_log(LL_WARN, "e_book_client_get_view_finish failed, address book changes are not seen: %s",
+						  error ? error->message : "");
+		g_clear_error(&error);
+		return;
+	}
+
+	g_signal_connect(priv->view, "objects-added", G_CALLBACK(book_changed_callback), priv);
+	g_signal_connect(priv->view, "objects-modified", G_CALLBACK(book_changed_callback), priv);
+	g_signal_connect(priv->view, "objects-removed", G_CALLBACK(book_changed_callback), priv);
+	// The contacts already in the book were resolved when the book became ready
+	e_book_client_view_set_flags(priv->view, E_BOOK_CLIENT_VIEW_FLAGS_NONE, NULL);
+	e_book_client_view_start(priv->view, &error);
+	if(error) {
+		sphone_module_log(LL_WARN, "e_book_client_view_start failed: %s", error->message);
+		g_error_free(error);
+	}
+}
+
 static void book_ready_callback(GObject *source_object, GAsyncResult *res, gpointer user_data)
 {
 	(void)source_object;
@@ -231,6 +247,14 @@ static void book_ready_callback(GObject *source_object, GAsyncResult *res, gpoin
 		g_error_free(error);
 	} else {
 		sphone_module_log(LL_INFO, "Sucessfully connected to evolution");
+		// Contacts requested before the book was ready could not be resolved
+		sphone_contacts_resolve();
+
+		EBookQuery *query = e_book_query_any_field_contains("");
+		gchar *query_string = e_book_query_to_string(query);
+		e_book_query_unref(query);
+		e_book_client_get_view(priv->ebook, query_string, NULL, view_ready_callback, priv);
+		g_free(query_string);
 	}
 }
 
@@ -270,4 +294,11 @@ void sphone_module_exit(void* data)
 	remove_filter_from_datapipe(&call_properties_changed_pipe, call_filter, data);
 	remove_filter_from_datapipe(&message_received_pipe, message_filter, data);
 	remove_filter_from_datapipe(&contact_fill_pipe, contact_filter, data);
+
+	struct evolution_priv *priv = data;
+	if(priv->view) {
+		g_signal_handlers_disconnect_by_data(priv->view, priv);
+		e_book_client_view_stop(priv->view, NULL);
+		g_clear_object(&priv->view);
+	}
 }
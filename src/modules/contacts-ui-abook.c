@@ -28,6 +28,7 @@
 #include "types.h"
 #include "gui.h"
 #include "comm.h"
+#include "phonenumber.h"
 #include "sphone-log.h"
 
 /** Module name */
@@ -69,10 +70,9 @@ static GList *find_abook_contacts(const char *line_id, int id)
 		sphone_module_log(LL_DEBUG, "Abook is ready");
 	}
 
-	EPhoneNumber *enumber = e_phone_number_from_string(line_id, NULL, NULL);
+	const char *number = sphone_phone_number_e164(line_id);
 
-	if(enumber) {
-		gchar *number = e_phone_number_to_string(enumber, E_PHONE_NUMBER_FORMAT_E164);
+	if(number) {
 		EBookQuery *query = e_book_query_orv(
 			e_book_query_field_test(E_CONTACT_PHONE_ASSISTANT, E_BOOK_QUERY_EQUALS_SHORT_PHONE_NUMBER, number),
 			e_book_query_field_test(E_CONTACT_PHONE_BUSINESS, E_BOOK_QUERY_EQUALS_SHORT_PHONE_NUMBER, number),
@@ -135,7 +135,7 @@ static void contact_dialog_reponse_cb(GtkDialog *dialog, int response_id, void *
 			contact.name = (char*)osso_abook_contact_get_display_name(acontact);
 			//callContact.photo = osso_abook_contact_get_photo(acontact);
 			//g_object_ref(G_OBJECT(callContact.photo));
-			contact.line_identifier = e_vcard_attribute_get_value(attribute);
+			contact.line_identifier = sphone_intern(e_vcard_attribute_get_value(attribute));
 
 			if(abook_priv.callback)
 				abook_priv.callback(&contact, abook_priv.user_data);
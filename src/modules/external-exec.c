@@ -67,6 +67,8 @@ static void call_properties_changed_trigger(gconstpointer data, gpointer user_da
 	struct exec_priv *priv = user_data;
 	const CallProperties *call = data;
 	char *command = NULL;
+	if(!(call->changes & SPHONE_CALL_CHANGED_STATE))
+		return;
 	if(call->state == SPHONE_CALL_DIALING)
 		command = priv->outgoing_call_cmd;
 	else if(call->state == SPHONE_CALL_ACTIVE)
@@ -112,11 +114,11 @@ const gchar *sphone_module_init(void** data)
 	priv->message_sent_cmd = sphone_conf_get_string("ExternalExec", "MessageSent", NULL, NULL);
 	priv->message_received_cmd = sphone_conf_get_string("ExternalExec", "MessageReceived", NULL, NULL);
 
-	append_trigger_to_datapipe(&call_new_pipe, new_call_trigger, priv);
-	append_trigger_to_datapipe(&call_properties_changed_pipe, call_properties_changed_trigger, priv);
+	insert_trigger_to_datapipe_full(&call_new_pipe, new_call_trigger, priv, DATAPIPE_PRIORITY_LOW, DATAPIPE_EXEC_DEFERRED);
+	insert_trigger_to_datapipe_full(&call_properties_changed_pipe, call_properties_changed_trigger, priv, DATAPIPE_PRIORITY_LOW, DATAPIPE_EXEC_DEFERRED);
 	
-	append_trigger_to_datapipe(&message_received_pipe, message_received_trigger, priv);
-	append_trigger_to_datapipe(&message_send_pipe, message_send_trigger, priv);
+	insert_trigger_to_datapipe_full(&message_received_pipe, message_received_trigger, priv, DATAPIPE_PRIORITY_LOW, DATAPIPE_EXEC_DEFERRED);
+	insert_trigger_to_datapipe_full(&message_send_pipe, message_send_trigger, priv, DATAPIPE_PRIORITY_LOW, DATAPIPE_EXEC_DEFERRED);
 
 	return NULL;
 }
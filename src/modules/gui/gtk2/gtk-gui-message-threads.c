@@ -30,8 +30,33 @@
 #include "gui.h"
 #include "comm.h"
 #include "storage.h"
+#include "contacts.h"
+#include "datapipes.h"
 #include "gtk-gui-utils.h"
 
+static void gtk_gui_msg_threads_store_changed(const void *data, void *user_data)
+{
+	const StoreChange *change = data;
+	GtkTreeView *contacts_view = user_data;
+
+	if(change->type != STORE_EVENT_MESSAGE || change->backend < 0 || !change->line_identifier)
+		return;
+
+	GtkTreeModel *model = gtk_tree_view_get_model(contacts_view);
+	if(!model)
+		return;
+
+	Contact *contact = sphone_contacts_get(change->backend, change->line_identifier, NULL);
+	gtk_gui_model_raise_contact(model, contact);
+	contact_unref(contact);
+}
+
+static void gtk_gui_msg_threads_destroy(GtkWidget *window, gpointer contacts_view)
+{
+	(void)window;
+	remove_trigger_from_datapipe(&store_changed_pipe, gtk_gui_msg_threads_store_changed, contacts_view);
+}
+
 static void gtk_gui_msg_threads_list_double_click_callback(GtkTreeView *view, GtkTreePath* path, GtkTreeViewColumn* column, gpointer func_data)
 {
 	(void)func_data;
@@ -52,7 +77,7 @@ static void gtk_gui_msg_threads_list_double_click_callback(GtkTreeView *view, Gt
 		
 		contact.backend = g_value_get_int(&backend_value);
 		sphone_log(LL_DEBUG, "BACKEND: %i", contact.backend);
-		contact.line_identifier = (char*)g_value_get_string(&line_id_value);
+		contact.line_identifier = sphone_intern(g_value_get_string(&line_id_value));
 		const gchar *name = g_value_get_string(&name_value);
 		if(g_strcmp0(name, "<unknown>") != 0)
 			contact.name = g_strdup(name);
@@ -138,6 +163,9 @@ bool gtk_gui_msg_threads(void)
 	gtk_tree_view_set_model(GTK_TREE_VIEW(contacts_view), GTK_TREE_MODEL(contacts));
 	g_object_unref(G_OBJECT(contacts));
 
+	insert_trigger_to_datapipe(&store_changed_pipe, gtk_gui_msg_threads_store_changed, contacts_view, DATAPIPE_PRIORITY_DEFAULT);
+	g_signal_connect(G_OBJECT(window), "destroy", G_CALLBACK(gtk_gui_msg_threads_destroy), contacts_view);
+
 	gtk_widget_show_all(window);
 
 	return true;
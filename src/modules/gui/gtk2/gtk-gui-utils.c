@@ -26,6 +26,20 @@ static GtkListStore *gtk_gui_new_model(void)
 							  G_TYPE_STRING, G_TYPE_STRING, G_TYPE_INT, G_TYPE_STRING);
 }
 
+static void gtk_gui_set_call_row(GtkListStore *store, GtkTreeIter *iter, const CallProperties *call)
+{
+	char *timestr = gtk_gui_date_to_new_string(call->start_time);
+	CommBackend *backend = sphone_comm_get_backend(call->backend);
+	gtk_list_store_set(store, iter,
+	              GTK_UI_MOD_NAME, call->contact && call->contact->name ? call->contact->name : "<unknown>",
+	              GTK_UI_MOD_LINE_ID, call->line_identifier,
+	              GTK_UI_MOD_TIME, timestr,
+	              GTK_UI_MOD_TEXT, NULL,
+	              GTK_UI_MOD_BACKEND, call->backend,
+	              GTK_UI_MOD_BACKEND_STR, backend ? backend->name : "unknown", -1);
+	g_free(timestr);
+}
+
 GtkTreeModel *gtk_gui_new_model_from_calls(GList *calls)
 {
 	GtkListStore *store = gtk_gui_new_model();
@@ -33,22 +47,24 @@ GtkTreeModel *gtk_gui_new_model_from_calls(GList *calls)
 	GtkTreeIter iter;
 
 	for(GList *element = calls; element; element = element->next) {
-		CallProperties *call = element->data;
 		gtk_list_store_append(store, &iter);
-		char *timestr = gtk_gui_date_to_new_string(call->start_time);
-		CommBackend *backend = sphone_comm_get_backend(call->backend);
-		gtk_list_store_set(store, &iter,
-		              GTK_UI_MOD_NAME, call->contact && call->contact->name ? call->contact->name : "<unknown>",
-		              GTK_UI_MOD_LINE_ID, call->line_identifier,
-		              GTK_UI_MOD_TIME, timestr,
-		              GTK_UI_MOD_TEXT, NULL,
-		              GTK_UI_MOD_BACKEND, call->backend,
-		              GTK_UI_MOD_BACKEND_STR, backend ? backend->name : "unknown", -1);
-		g_free(timestr);
+		gtk_gui_set_call_row(store, &iter, element->data);
 	}
 	return GTK_TREE_MODEL(store);
 }
 
+void gtk_gui_model_prepend_calls(GtkTreeModel *model, GList *calls)
+{
+	GtkListStore *store = GTK_LIST_STORE(model);
+
+	GtkTreeIter iter;
+
+	for(GList *element = calls; element; element = element->next) {
+		gtk_list_store_prepend(store, &iter);
+		gtk_gui_set_call_row(store, &iter, element->data);
+	}
+}
+
 GtkTreeModel *gtk_gui_new_model_from_messages(GList *messages)
 {
 	GtkListStore *store = gtk_gui_new_model();
@@ -72,6 +88,18 @@ GtkTreeModel *gtk_gui_new_model_from_messages(GList *messages)
 	return GTK_TREE_MODEL(store);
 }
 
+static void gtk_gui_set_contact_row(GtkListStore *store, GtkTreeIter *iter, const Contact *contact)
+{
+	CommBackend *backend = sphone_comm_get_backend(contact->backend);
+	gtk_list_store_set(store, iter,
+	              GTK_UI_MOD_NAME, contact->name ?: "<unknown>" ,
+	              GTK_UI_MOD_LINE_ID, contact->line_identifier,
+	              GTK_UI_MOD_TIME, NULL,
+	              GTK_UI_MOD_TEXT, NULL,
+	              GTK_UI_MOD_BACKEND, contact->backend,
+	              GTK_UI_MOD_BACKEND_STR, backend ? backend->name : "unknown", -1);
+}
+
 GtkTreeModel *gtk_gui_new_model_from_contacts(GList *contacts)
 {
 	GtkListStore *store = gtk_gui_new_model();
@@ -82,18 +110,35 @@ GtkTreeModel *gtk_gui_new_model_from_contacts(GList *contacts)
 		Contact *contact = element->data;
 		contact_print(contact, __func__);
 		gtk_list_store_append(store, &iter);
-		CommBackend *backend = sphone_comm_get_backend(contact->backend);
-		gtk_list_store_set(store, &iter,
-		              GTK_UI_MOD_NAME, contact->name ?: "<unknown>" ,
-		              GTK_UI_MOD_LINE_ID, contact->line_identifier,
-		              GTK_UI_MOD_TIME, NULL,
-		              GTK_UI_MOD_TEXT, NULL,
-		              GTK_UI_MOD_BACKEND, contact->backend,
-		              GTK_UI_MOD_BACKEND_STR, backend ? backend->name : "unknown", -1);
+		gtk_gui_set_contact_row(store, &iter, contact);
 	}
 	return GTK_TREE_MODEL(store);
 }
 
+void gtk_gui_model_raise_contact(GtkTreeModel *model, const Contact *contact)
+{
+	GtkListStore *store = GTK_LIST_STORE(model);
+	GtkTreeIter iter;
+
+	gboolean valid = gtk_tree_model_get_iter_first(model, &iter);
+	while(valid) {
+		Contact row = {0};
+		gchar *line_id;
+		gtk_tree_model_get(model, &iter, GTK_UI_MOD_LINE_ID, &line_id, GTK_UI_MOD_BACKEND, &row.backend, -1);
+		row.line_identifier = line_id;
+		bool match = contact_cmp(&row, contact);
+		g_free(line_id);
+		if(match) {
+			gtk_list_store_remove(store, &iter);
+			break;
+		}
+		valid = gtk_tree_model_iter_next(model, &iter);
+	}
+
+	gtk_list_store_prepend(store, &iter);
+	gtk_gui_set_contact_row(store, &iter, contact);
+}
+
 char *gtk_gui_date_to_new_string(time_t time)
 {
 	char *str = g_malloc(256);
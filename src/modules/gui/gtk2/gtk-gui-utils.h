@@ -18,6 +18,7 @@
 
 #pragma once
 #include <gtk/gtk.h>
+#include "types.h"
 
 enum {
   GTK_UI_MOD_NAME = 0,
@@ -30,7 +31,11 @@ enum {
 };
 
 GtkTreeModel *gtk_gui_new_model_from_calls(GList *calls);
+/* Prepends calls to a model from gtk_gui_new_model_from_calls(), so the last in the list ends up first */
+void gtk_gui_model_prepend_calls(GtkTreeModel *model, GList *calls);
 GtkTreeModel *gtk_gui_new_model_from_contacts(GList *contacts);
+/* Moves the row of contact in a model from gtk_gui_new_model_from_contacts() to the top, adding it if missing */
+void gtk_gui_model_raise_contact(GtkTreeModel *model, const Contact *contact);
 GtkTreeModel *gtk_gui_new_model_from_messages(GList *messages);
 char *gtk_gui_date_to_new_string(time_t time);
 char *gtk_gui_time_to_new_string(time_t time);
@@ -31,6 +31,7 @@
 #include "sphone-modules.h"
 #include "gui.h"
 #include "comm.h"
+#include "calls.h"
 #include "sphone-conf.h"
 
 /** Module name */
@@ -148,6 +149,10 @@ static void gui_calls_call_status_callback(gconstpointer data, void *object)
 	GtkTreeIter iter;
 	(void)object;
 
+	// the window only shows the state of calls
+	if(!(call->changes & SPHONE_CALL_CHANGED_STATE))
+		return;
+
 	sphone_module_log(LL_DEBUG, "%s: Update call %s %s", __func__, call->line_identifier, sphone_get_state_string(call->state));
 
 	if(call->state == SPHONE_CALL_DISCONNECTED) {
@@ -283,7 +288,7 @@ static void gui_calls_utils_delete_call(const CallProperties *call)
 	CallProperties *icall = gui_calls_find_call(call, &iter);
 	if(icall){
 		gtk_list_store_remove(g_calls_manager.dials_store, &iter);
-		call_properties_free(icall);
+		call_properties_unref(icall);
 	}
 
 	// Hide the window if no active calls
@@ -315,7 +320,6 @@ static void gui_calls_utils_update_call(const CallProperties *call)
 	CallProperties *icall = gui_calls_find_call(call, &iter);
 	if(icall) {
 		sphone_module_log(LL_DEBUG, "%s: found call %p", __func__, icall);
-		icall->state = call->state;
 		gtk_list_store_set(g_calls_manager.dials_store, &iter, GUI_CALLS_COLUMN_STATUS, sphone_get_state_string(icall->state), -1);
 		GtkTreePath *path = gtk_tree_model_get_path(GTK_TREE_MODEL(g_calls_manager.dials_store), &iter);
 		gtk_tree_view_set_cursor(GTK_TREE_VIEW(g_calls_manager.dials_view), path, NULL, FALSE);
@@ -330,6 +334,12 @@ static void gui_calls_utils_add_call(const CallProperties *call)
 	gchar *desc;
 	GdkPixbuf *photo = NULL;
 
+	// The store shares the call of the registry, it is kept up to date there
+	const CallProperties *live = sphone_calls_find_call(call);
+	if(!live) {
+		sphone_module_log(LL_WARN, "%s: call %s is not registered", __func__, call->line_identifier);
+		return;
+	}
 
 	gtk_widget_set_sensitive(g_calls_manager.hangup_button, TRUE);
 	gtk_button_set_label(GTK_BUTTON(g_calls_manager.hangup_button), "\nHangup\n");
@@ -349,7 +359,7 @@ static void gui_calls_utils_add_call(const CallProperties *call)
 		desc = g_strdup_printf("<Unknown>\n%s\n", call->line_identifier);
 	}
 
-	CallProperties *new_call = call_properties_copy(call);
+	CallProperties *new_call = call_properties_ref(live);
 	sphone_module_log(LL_DEBUG, "%s: register new call %p", __func__, new_call);
 
 	gtk_list_store_append(g_calls_manager.dials_store, &iter);
@@ -379,7 +389,6 @@ static void gui_calls_answer_callback(void)
 	gtk_tree_path_free(path);
 	gtk_tree_model_get_value(GTK_TREE_MODEL(g_calls_manager.dials_store),&iter, GUI_CALLS_COLUMN_CALL, &value);
 	CallProperties *call = (CallProperties*)g_value_get_pointer(&value);
-	call->answered = TRUE;
 
 	execute_datapipe(&call_accept_pipe, call);
 	
@@ -552,8 +561,8 @@ const gchar *sphone_module_init(void** data)
 	g_signal_connect(G_OBJECT(g_calls_manager.main_window),"delete-event", G_CALLBACK(return_true), NULL);
 
 	append_trigger_to_datapipe(&audio_route_pipe, gui_calls_audio_route_trigger, NULL);
-	append_trigger_to_datapipe(&call_new_pipe, gui_calls_new_call_callback, NULL);
-	append_trigger_to_datapipe(&call_properties_changed_pipe, gui_calls_call_status_callback, NULL);
+	insert_trigger_to_datapipe(&call_new_pipe, gui_calls_new_call_callback, NULL, DATAPIPE_PRIORITY_HIGH);
+	insert_trigger_to_datapipe(&call_properties_changed_pipe, gui_calls_call_status_callback, NULL, DATAPIPE_PRIORITY_HIGH);
 	return NULL;
 }
 
@@ -75,12 +75,16 @@ static bool gtk_gui_dialer_show(const CallProperties* call);
 
 static int gui_dialer_add_backends_to_selector(HildonTouchSelector *selector)
 {
+	int count = 0;
 	GSList *list = sphone_comm_get_backends();
 	for(GSList *element = list; element; element = element->next) {
 		CommBackend *backend = element->data;
-		hildon_touch_selector_append_text(selector, backend->name);
+		if(sphone_comm_backend_usable(backend)) {
+			hildon_touch_selector_append_text(selector, backend->name);
+			++count;
+		}
 	}
-	return g_slist_length(list);
+	return count;
 }
 
 static GtkWidget *gui_dialer_create_selector(void)
@@ -99,10 +103,11 @@ static void gui_dialer_backend_added(gconstpointer data, gpointer user_data)
 {
 	(void)user_data;
 	CommBackend *backend = (CommBackend*)data;
-	hildon_touch_selector_append_text(HILDON_TOUCH_SELECTOR(g_gui_calls.selector), backend->name);
+	if(sphone_comm_backend_usable(backend))
+		hildon_touch_selector_append_text(HILDON_TOUCH_SELECTOR(g_gui_calls.selector), backend->name);
 }
 
-static void gui_dialer_backend_removed(gconstpointer data, gpointer user_data)
+static void gui_dialer_backends_changed(gconstpointer data, gpointer user_data)
 {
 	(void)user_data;
 	(void)data;
@@ -118,7 +123,8 @@ static void gui_dialer_add_backends_to_combo(GtkComboBoxText *combo)
 	GSList *list = sphone_comm_get_backends();
 	for(GSList *element = list; element; element = element->next) {
 		CommBackend *backend = element->data;
-		gtk_combo_box_text_append_text(combo, backend->name);
+		if(sphone_comm_backend_usable(backend))
+			gtk_combo_box_text_append_text(combo, backend->name);
 	}
 }
 
@@ -138,10 +144,11 @@ static void gui_dialer_backend_added(gconstpointer data, gpointer user_data)
 	(void)user_data;
 	CommBackend *backend = (CommBackend*)data;
 
-	gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(g_gui_calls.backend_combo), backend->name);
+	if(sphone_comm_backend_usable(backend))
+		gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(g_gui_calls.backend_combo), backend->name);
 }
 
-static void gui_dialer_backend_removed(gconstpointer data, gpointer user_data)
+static void gui_dialer_backends_changed(gconstpointer data, gpointer user_data)
 {
 	(void)user_data;
 	(void)data;
@@ -175,12 +182,12 @@ static void gui_call_callback(GtkButton button)
 	const gchar *dial = gtk_entry_get_text(GTK_ENTRY(g_gui_calls.display));
 
 	if(strlen(dial) > 0) {
-		CallProperties *call = g_malloc0(sizeof(*call));
-		call->line_identifier = g_strdup(dial);
+		CallProperties *call = call_properties_new();
+		call->line_identifier = sphone_intern(dial);
 		call->backend = gui_dialer_current_backend_id();
 		call->state = SPHONE_CALL_DIALING;
 		execute_datapipe(&call_dial_pipe, call);
-		call_properties_free(call);
+		call_properties_unref(call);
 
 		gtk_entry_set_text(GTK_ENTRY(g_gui_calls.display), "");
 	}
@@ -394,7 +401,8 @@ const gchar *sphone_module_init(void** data)
 	g_signal_connect(G_OBJECT(display), "insert_text", G_CALLBACK(gui_dialer_validate_callback), NULL);
 
 	append_trigger_to_datapipe(&comm_backend_added_pipe, &gui_dialer_backend_added, NULL);
-	append_trigger_to_datapipe(&comm_backend_removed_pipe, &gui_dialer_backend_removed, NULL);
+	append_trigger_to_datapipe(&comm_backend_removed_pipe, &gui_dialer_backends_changed, NULL);
+	append_trigger_to_datapipe(&comm_backend_changed_pipe, &gui_dialer_backends_changed, NULL);
 	
 	struct GuiFunctions func = {};
 	func.dialer_show = gtk_gui_dialer_show;
@@ -408,7 +416,8 @@ void sphone_module_exit(void* data)
 {
 	(void)data;
 	remove_trigger_from_datapipe(&comm_backend_added_pipe, &gui_dialer_backend_added, NULL);
-	remove_trigger_from_datapipe(&comm_backend_removed_pipe, &gui_dialer_backend_removed, NULL);
+	remove_trigger_from_datapipe(&comm_backend_removed_pipe, &gui_dialer_backends_changed, NULL);
+	remove_trigger_from_datapipe(&comm_backend_changed_pipe, &gui_dialer_backends_changed, NULL);
 	g_object_unref(g_gui_calls.keypad);
 	gui_remove(g_gui_calls.gui_id);
 }
@@ -33,6 +33,7 @@
 #include "gtk-gui-utils.h"
 #include "storage.h"
 #include "gui.h"
+#include "datapipes.h"
 
 #include "sphone-modules.h"
 
@@ -57,6 +58,11 @@ struct{
 	GtkWidget *dials_view;
 } g_history_calls;
 
+#define HISTORY_CALLS_LIMIT 100
+
+/* Position of the newest call shown, -1 if the history was loaded empty */
+static gint64 history_position = -1;
+
 static gboolean gui_history_make_null(GtkWidget *w, GdkEvent *event, GtkWidget **window)
 {
 	(void)w;
@@ -65,6 +71,43 @@ static gboolean gui_history_make_null(GtkWidget *w, GdkEvent *event, GtkWidget *
 	return FALSE;
 }
 
+static void gui_history_store_changed(const void *data, void *user_data)
+{
+	(void)user_data;
+	const StoreChange *change = data;
+
+	if(change->type != STORE_EVENT_CALL || !g_history_calls.window)
+		return;
+
+	GtkTreeModel *model = gtk_tree_view_get_model(GTK_TREE_VIEW(g_history_calls.dials_view));
+	if(!model)
+		return;
+
+	GList *calls_list = store_get_calls_since(NULL, history_position, &history_position);
+	gtk_gui_model_prepend_calls(model, calls_list);
+	store_free_call_list(calls_list);
+}
+
+static GtkTreeModel *gui_history_load(void)
+{
+	GList *calls_list;
+	StoreCursor *cursor = store_cursor_new(STORE_EVENT_CALL, NULL, STORE_SORT_NEWEST_FIRST, NULL);
+
+	if(cursor) {
+		calls_list = store_cursor_next_page(cursor, 1);
+		history_position = store_cursor_get_position(cursor);
+		calls_list = g_list_concat(calls_list, store_cursor_next_page(cursor, HISTORY_CALLS_LIMIT - 1));
+		store_cursor_free(cursor);
+	} else {
+		calls_list = store_get_all_calls(HISTORY_CALLS_LIMIT);
+		history_position = -1;
+	}
+
+	GtkTreeModel *calls = gtk_gui_new_model_from_calls(calls_list);
+	store_free_call_list(calls_list);
+	return calls;
+}
+
 static void gui_history_list_delete_model(void)
 {
 	gtk_tree_view_set_model(GTK_TREE_VIEW(g_history_calls.dials_view), NULL);
@@ -84,7 +127,7 @@ static void gui_history_list_double_click_callback(GtkTreeView *view, GtkTreePat
 		gtk_tree_model_get_iter(GTK_TREE_MODEL(model), &iter, path);
 		gtk_tree_model_get_value(model, &iter, GTK_UI_MOD_LINE_ID, &value);
 		contact.backend = backend ? backend->id : 0;
-		contact.line_identifier = (char*)g_value_get_string(&value);
+		contact.line_identifier = sphone_intern(g_value_get_string(&value));
 		gdk_window_destroy(gtk_widget_get_window(GTK_WIDGET(g_history_calls.window)));
 		g_history_calls.window = NULL;
 		gui_contact_show(&contact, NULL, NULL);
@@ -150,9 +193,7 @@ void gtk_gui_history_calls(void)
 	GtkTreeModel *calls;
 
 	if(g_history_calls.window){
-		GList *calls_list = store_get_all_calls(100);
-		calls = gtk_gui_new_model_from_calls(calls_list);
-		store_free_call_list(calls_list);
+		calls = gui_history_load();
 		gtk_tree_view_set_model(GTK_TREE_VIEW(g_history_calls.dials_view), GTK_TREE_MODEL(calls));
 		g_object_unref(G_OBJECT(calls));
 		gtk_window_present(GTK_WINDOW(g_history_calls.window));
@@ -178,9 +219,7 @@ void gtk_gui_history_calls(void)
 
 	g_signal_connect(G_OBJECT(g_history_calls.window), "delete-event", G_CALLBACK(gui_history_make_null), &g_history_calls.window);
 
-	GList *calls_list = store_get_all_calls(100);
-	calls = gtk_gui_new_model_from_calls(calls_list);
-	store_free_call_list(calls_list);
+	calls = gui_history_load();
 	gtk_tree_view_set_model(GTK_TREE_VIEW(g_history_calls.dials_view), GTK_TREE_MODEL(calls));
 	g_object_unref(G_OBJECT(calls));
 	
@@ -199,6 +238,7 @@ const gchar *sphone_module_init(void** data)
 	struct GuiFunctions func = {};
 	func.history_calls = gtk_gui_history_calls;
 	*data = GINT_TO_POINTER(gui_register(func));
+	insert_trigger_to_datapipe(&store_changed_pipe, gui_history_store_changed, NULL, DATAPIPE_PRIORITY_DEFAULT);
 
 	return NULL;
 }
@@ -207,5 +247,6 @@ SPHONE_MODULE_EXPORT void sphone_module_exit(void* data);
 void sphone_module_exit(void* data)
 {
 	(void)data;
+	remove_trigger_from_datapipe(&store_changed_pipe, gui_history_store_changed, NULL);
 	gui_remove(GPOINTER_TO_INT(data));
 }
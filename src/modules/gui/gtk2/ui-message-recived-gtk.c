@@ -112,10 +112,8 @@ static void gui_sms_receive_show(const MessageProperties *message)
 
 	gtk_widget_show_all(main_window);
 
-	MessageProperties *message_copy = message_properties_copy(message);
-
 	g_object_set_data_full(G_OBJECT(send_button), "message-proparties",
-						   message_copy, (void (*)(void *))message_properties_free);
+						   message_properties_ref(message), (void (*)(void *))message_properties_unref);
 
 	g_signal_connect(G_OBJECT(from_entry), "clicked", G_CALLBACK(gui_sms_open_contact_callback), NULL);
 	g_signal_connect(G_OBJECT(send_button), "clicked", G_CALLBACK(gui_sms_reply_callback), NULL);
@@ -30,6 +30,7 @@
 #include "gui.h"
 #include "comm.h"
 #include "storage.h"
+#include "contacts.h"
 #include "gtk-gui-utils.h"
 #include "datapipes.h"
 #include "datapipe.h"
@@ -78,26 +79,42 @@ static void new_message_trigger(const void* data, void *user_data)
 #endif
 	
 	const MessageProperties *msg = data;
-	const Contact *watch_contact = g_object_get_data(G_OBJECT(text), "contact");
-	if(watch_contact->backend == msg->backend &&
-		g_strcmp0(watch_contact->line_identifier, msg->line_identifier) == 0) {
-		GString *string = g_string_new(NULL);
-		char *time = gtk_gui_time_to_new_string(msg->time);
-		const char *name;
-		if(!msg->outbound) {
-			name = msg->contact && msg->contact->name ? msg->contact->name : msg->line_identifier;
-		} else {
-			name = getenv("LOGNAME") ?: "sphone";
-		}
-		g_string_append_printf(string, "\n[%s] <%s> %s", time, name, msg->text);
-		GtkTextIter iter;
-		gtk_text_buffer_get_end_iter(text, &iter);
-		gtk_text_buffer_insert(text, &iter, string->str, string->len);
-		gtk_text_buffer_get_end_iter(text, &iter);
-		//gtk_text_view_scroll_to_iter(GTK_TEXT_VIEW(text_view), &iter,  0, FALSE, 0, 0);
-		g_free(time);
-		g_string_free(string, TRUE);
+	GString *string = g_string_new(NULL);
+	char *time = gtk_gui_time_to_new_string(msg->time);
+	const char *name;
+	if(!msg->outbound) {
+		name = msg->contact && msg->contact->name ? msg->contact->name : msg->line_identifier;
+	} else {
+		name = getenv("LOGNAME") ?: "sphone";
 	}
+	g_string_append_printf(string, "\n[%s] <%s> %s", time, name, msg->text);
+	GtkTextIter iter;
+	gtk_text_buffer_get_end_iter(text, &iter);
+	gtk_text_buffer_insert(text, &iter, string->str, string->len);
+	gtk_text_buffer_get_end_iter(text, &iter);
+	//gtk_text_view_scroll_to_iter(GTK_TEXT_VIEW(text_view), &iter,  0, FALSE, 0, 0);
+	g_free(time);
+	g_string_free(string, TRUE);
+}
+
+/*
+ * Appends the messages stored with the contact of the thread since the newest one shown,
+ * this also picks up messages other applications wrote to the store
+ */
+static void thread_store_changed(const void *data, void *user_data)
+{
+	const StoreChange *change = data;
+	GtkWidget *text_view = GTK_WIDGET(user_data);
+
+	if(change->type != STORE_EVENT_MESSAGE)
+		return;
+
+	Contact *thread_contact = g_object_get_data(G_OBJECT(text_view), "contact");
+	gint64 *position = g_object_get_data(G_OBJECT(text_view), "position");
+	GList *msg_list = store_get_messages_since(thread_contact, *position, position);
+	for(GList *element = msg_list; element; element = element->next)
+		new_message_trigger(element->data, text_view);
+	store_free_message_list(msg_list);
 }
 
 static void remove_thread_view(GtkWidget *widget, gpointer data)
@@ -106,8 +123,12 @@ static void remove_thread_view(GtkWidget *widget, gpointer data)
 	GtkWidget *text_view = GTK_WIDGET(data);
 	const Contact *watch_contact = g_object_get_data(G_OBJECT(text_view), "contact");
 	shown_contacts = g_slist_remove(shown_contacts, watch_contact);
-	remove_trigger_from_datapipe(&message_send_pipe, new_message_trigger, text_view);
-	remove_trigger_from_datapipe(&message_received_pipe, new_message_trigger, text_view);
+	if(g_object_get_data(G_OBJECT(text_view), "cursor")) {
+		remove_keyed_trigger_from_datapipe(&store_changed_pipe, watch_contact, thread_store_changed, text_view);
+	} else {
+		remove_keyed_trigger_from_datapipe(&message_send_pipe, watch_contact, new_message_trigger, text_view);
+		remove_keyed_trigger_from_datapipe(&message_received_pipe, watch_contact, new_message_trigger, text_view);
+	}
 }
 
 static void gtk_gui_thread_view_reply_cb(GtkButton* button, Contact *contact)
@@ -121,7 +142,10 @@ static void gtk_gui_thread_view_reply_cb(GtkButton* button, Contact *contact)
 	gui_sms_send_show(&msg);
 }
 
-static GtkTextBuffer *gtk_gui_build_text_buffer(GList *msg_list)
+/* Messages shown when a thread is opened and loaded each time the view is scrolled to the top */
+#define THREAD_PAGE_SIZE 50
+
+static GString *gtk_gui_build_thread_text(GList *msg_list)
 {
 	GString *string = g_string_new(NULL);
 	GList *last_element = g_list_last(msg_list);
@@ -134,15 +158,58 @@ static GtkTextBuffer *gtk_gui_build_text_buffer(GList *msg_list)
 		} else {
 			name = getenv("LOGNAME") ?: "sphone";
 		}
-		g_string_append_printf(string, "%s[%s] <%s> %s", element != g_list_last(msg_list) ? "\n" : "", time, name, msg->text);
+		g_string_append_printf(string, "%s[%s] <%s> %s", element != last_element ? "\n" : "", time, name, msg->text);
 		g_free(time);
 	}
+	return string;
+}
+
+static GtkTextBuffer *gtk_gui_build_text_buffer(GList *msg_list)
+{
+	GString *string = gtk_gui_build_thread_text(msg_list);
 	GtkTextBuffer *text = gtk_text_buffer_new(NULL);
 	gtk_text_buffer_set_text(text, string->str, string->len);
 	g_string_free(string, TRUE);
 	return text;
 }
 
+static void gtk_gui_thread_load_older(GtkAdjustment *adjustment, gpointer data)
+{
+	GtkWidget *text_view = GTK_WIDGET(data);
+	StoreCursor *cursor = g_object_get_data(G_OBJECT(text_view), "cursor");
+
+	if(!cursor || store_cursor_at_end(cursor) ||
+	   gtk_adjustment_get_value(adjustment) > gtk_adjustment_get_lower(adjustment))
+		return;
+
+	GList *msg_list = store_cursor_next_page(cursor, THREAD_PAGE_SIZE);
+	if(!msg_list)
+		return;
+
+	GtkTextBuffer *text;
+#ifdef ENABLE_LIBHILDON
+	text = hildon_text_view_get_buffer(HILDON_TEXT_VIEW(text_view));
+#else
+	text = gtk_text_view_get_buffer(GTK_TEXT_VIEW(text_view));
+#endif
+
+	GString *string = gtk_gui_build_thread_text(msg_list);
+	g_string_append_c(string, '\n');
+	GtkTextIter iter;
+	gtk_text_buffer_get_start_iter(text, &iter);
+	gtk_text_buffer_insert(text, &iter, string->str, string->len);
+	g_string_free(string, TRUE);
+	store_free_message_list(msg_list);
+}
+
+/* A thread that does not fill the view can not be scrolled to the top, load older pages until it does */
+static void gtk_gui_thread_fill(GtkAdjustment *adjustment, gpointer data)
+{
+	if(gtk_adjustment_get_upper(adjustment) - gtk_adjustment_get_lower(adjustment) <=
+	   gtk_adjustment_get_page_size(adjustment))
+		gtk_gui_thread_load_older(adjustment, data);
+}
+
 static void gtk_gui_show_thread_for_contact(const Contact *contact)
 {
 	sphone_log(LL_DEBUG, "gtk_gui_thread_calls\n");
@@ -170,7 +237,8 @@ static void gtk_gui_show_thread_for_contact(const Contact *contact)
 	sphone_log(LL_DEBUG, "window FLOATING: %i", g_object_is_floating(window));
 	sphone_log(LL_DEBUG, "text_view FLOATING: %i", g_object_is_floating(text_view));
 
-	gtk_window_set_title(GTK_WINDOW(window), contact->name ?: "Thread");
+	Contact *thread_contact = sphone_contacts_get_for(contact) ?: contact_copy(contact);
+	gtk_window_set_title(GTK_WINDOW(window), thread_contact->name ?: "Thread");
 	gtk_window_set_default_size(GTK_WINDOW(window), 400, 600);
 
 	gtk_container_add(GTK_CONTAINER(text_view_scroll), text_view);
@@ -179,14 +247,28 @@ static void gtk_gui_show_thread_for_contact(const Contact *contact)
 	gtk_box_pack_start(GTK_BOX(v1), actions_bar, FALSE, FALSE, 0);
 	gtk_container_add(GTK_CONTAINER(window), v1);
 
-	Contact *contact_cpy = contact_copy(contact);
-	GList *msg_list = store_get_messages_for_contact(contact_cpy, 0);
+	StoreCursor *cursor = store_cursor_new(STORE_EVENT_MESSAGE, thread_contact, STORE_SORT_NEWEST_FIRST, NULL);
+	GList *msg_list = NULL;
+	if(cursor) {
+		gint64 *position = g_new(gint64, 1);
+		msg_list = store_cursor_next_page(cursor, 1);
+		*position = store_cursor_get_position(cursor);
+		msg_list = g_list_concat(msg_list, store_cursor_next_page(cursor, THREAD_PAGE_SIZE - 1));
+		g_object_set_data_full(G_OBJECT(text_view), "position", position, g_free);
+	}
 	GtkTextBuffer *text = gtk_gui_build_text_buffer(msg_list);
-	g_object_set_data_full(G_OBJECT(text), "contact", contact_cpy, (GDestroyNotify)contact_free);
+	g_object_set_data_full(G_OBJECT(text_view), "cursor", cursor, (GDestroyNotify)store_cursor_free);
+	g_object_set_data_full(G_OBJECT(text), "contact", thread_contact, (GDestroyNotify)contact_unref);
+	g_object_set_data(G_OBJECT(text_view), "contact", thread_contact);
 	g_signal_connect(GTK_WIDGET(window), "hide", G_CALLBACK(remove_thread_view), text_view);
-	shown_contacts = g_slist_prepend(shown_contacts, contact_cpy);
-	append_trigger_to_datapipe(&message_send_pipe, new_message_trigger, text_view);
-	append_trigger_to_datapipe(&message_received_pipe, new_message_trigger, text_view);
+	shown_contacts = g_slist_prepend(shown_contacts, thread_contact);
+	/* Follow the store if the thread was loaded from it, else the messages sphone sends and receives */
+	if(cursor) {
+		insert_keyed_trigger_to_datapipe(&store_changed_pipe, thread_contact, thread_store_changed, text_view, DATAPIPE_PRIORITY_DEFAULT);
+	} else {
+		insert_keyed_trigger_to_datapipe(&message_send_pipe, thread_contact, new_message_trigger, text_view, DATAPIPE_PRIORITY_DEFAULT);
+		insert_keyed_trigger_to_datapipe(&message_received_pipe, thread_contact, new_message_trigger, text_view, DATAPIPE_PRIORITY_DEFAULT);
+	}
 	gtk_text_view_set_editable(GTK_TEXT_VIEW(text_view), false);
 	gtk_text_view_set_cursor_visible(GTK_TEXT_VIEW(text_view), false);
 	gtk_text_view_set_wrap_mode(GTK_TEXT_VIEW(text_view), GTK_WRAP_WORD_CHAR);
@@ -199,7 +281,14 @@ static void gtk_gui_show_thread_for_contact(const Contact *contact)
 
 	g_object_unref(text);
 	store_free_message_list(msg_list);
-	g_signal_connect(G_OBJECT(reply_button), "clicked", G_CALLBACK(gtk_gui_thread_view_reply_cb), contact_cpy);
+	g_signal_connect(G_OBJECT(reply_button), "clicked", G_CALLBACK(gtk_gui_thread_view_reply_cb), thread_contact);
+#ifdef ENABLE_LIBHILDON
+	GtkAdjustment *adjustment = hildon_pannable_area_get_vadjustment(HILDON_PANNABLE_AREA(text_view_scroll));
+#else
+	GtkAdjustment *adjustment = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(text_view_scroll));
+#endif
+	g_signal_connect(G_OBJECT(adjustment), "value-changed", G_CALLBACK(gtk_gui_thread_load_older), text_view);
+	g_signal_connect(G_OBJECT(adjustment), "changed", G_CALLBACK(gtk_gui_thread_fill), text_view);
 
 	gtk_widget_show_all(window);
 	
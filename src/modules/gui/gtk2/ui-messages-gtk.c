@@ -69,7 +69,8 @@ static GtkWidget *gui_sms_create_selector(void)
 
 	for(GSList *element = list; element; element = element->next) {
 		CommBackend *backend = element->data; 
-		hildon_touch_selector_append_text(HILDON_TOUCH_SELECTOR(selector), backend->name);
+		if(sphone_comm_backend_usable(backend))
+			hildon_touch_selector_append_text(HILDON_TOUCH_SELECTOR(selector), backend->name);
 	}
 
 	hildon_touch_selector_set_active(HILDON_TOUCH_SELECTOR(selector), 0, 0);
@@ -85,7 +86,8 @@ static GtkWidget *gui_sms_create_backend_combo(void)
 
 	for(GSList *element = list; element; element = element->next) {
 		CommBackend *backend = element->data; 
-		gtk_combo_box_text_append_text(combo, backend->name);
+		if(sphone_comm_backend_usable(backend))
+			gtk_combo_box_text_append_text(combo, backend->name);
 	}
 	gtk_combo_box_set_active(GTK_COMBO_BOX(combo), 0);
 
@@ -214,14 +216,14 @@ static void gui_sms_send_callback(GtkWidget *button, GtkWidget *main_window)
 #endif
 
 	if(text && strlen(text) > 0 && strlen(to) > 0) {
-		MessageProperties *message = g_malloc0(sizeof(*message));
-		message->line_identifier = g_strdup(to);
-		message->text = text;
+		MessageProperties *message = message_properties_new();
+		message->line_identifier = sphone_intern(to);
+		message->text = g_ref_string_new(text);
 		message->backend = sphone_comm_find_backend_id(backend_name);
 		message->time = time(NULL);
 		message->outbound = true;
 		execute_datapipe(&message_send_pipe, message);
-		message_properties_free(message);
+		message_properties_unref(message);
 		gtk_widget_destroy(main_window);
 	} else {
 		const gchar *message =
@@ -233,6 +235,8 @@ static void gui_sms_send_callback(GtkWidget *button, GtkWidget *main_window)
 		
 		gtk_widget_show_all(dialog);
 	}
+
+	g_free(text);
 }
 
 SPHONE_MODULE_EXPORT const gchar *sphone_module_init(void** data);
@@ -22,6 +22,7 @@
 #include "types.h"
 #include "datapipe.h"
 #include "datapipes.h"
+#include "calls.h"
 #include "rtconf.h"
 #include "gui.h"
 
@@ -41,18 +42,32 @@ SPHONE_MODULE_EXPORT module_info_struct module_info = {
 	.priority = 10
 };
 
-static GSList *calls;
+struct needed_state {
+	bool incall;
+	bool incall_no_route;
+	bool incomeing_call;
+};
 
 inline static bool call_state_wants_route(const sphone_call_state_t state)
 {
 	return state == SPHONE_CALL_ACTIVE || state == SPHONE_CALL_DIALING || state == SPHONE_CALL_ALERTING;
 }
 
+static void check_call_state(const CallProperties *call, void *user_data)
+{
+	struct needed_state *needed = user_data;
+	sphone_module_log(LL_DEBUG, "%s: call %s state %s", __func__, call->line_identifier, sphone_get_state_string(call->state));
+	if(call->state == SPHONE_CALL_INCOMING)
+		needed->incomeing_call = true;
+	else  if(call_state_wants_route(call->state) && call->needs_route)
+		needed->incall = true;
+	else if(call_state_wants_route(call->state))
+		needed->incall_no_route = true;
+}
+
 static void check_needed_state(void)
 {
-	bool incall = false;
-	bool incall_no_route = false;
-	bool incomeing_call = false;
+	struct needed_state needed = {0};
 
 	bool playing = false;
 	sphone_audio_route_t route = datapipe_get_last_data_int(&audio_route_pipe);
@@ -60,29 +75,22 @@ static void check_needed_state(void)
 
 	execute_datapipe(&audio_playing_pipe, &playing);
 
-	for(GSList *element = calls; element; element = element->next) {
-		CallProperties *call = element->data;
-		sphone_module_log(LL_DEBUG, "%s: call %s state %s", __func__, call->line_identifier, sphone_get_state_string(call->state));
-		if(call->state == SPHONE_CALL_INCOMING)
-			incomeing_call = true;
-		else  if(call_state_wants_route(call->state) && call->needs_route)
-			incall = true;
-		else if(call_state_wants_route(call->state))
-			incall_no_route = true;
-	}
-	
-	sphone_module_log(LL_DEBUG, "%s: incall %s, incall_no_route %s", __func__, incall ? "true" : "false", incall_no_route ? "true" : "false");
+	sphone_calls_foreach(check_call_state, &needed);
 	
-	if(incall || incall_no_route) {
+	sphone_module_log(LL_DEBUG, "%s: incall %s, incall_no_route %s", __func__, needed.incall ? "true" : "false", needed.incall_no_route ? "true" : "false");
+
+	/* deliver the new mode, route and vibration state together, mode and route once with their final value */
+	datapipe_transaction_begin();
+	if(needed.incall || needed.incall_no_route) {
 		if(mode != SPHONE_MODE_INCALL) {
-			execute_datapipe(&call_mode_pipe, GINT_TO_POINTER(incall ? SPHONE_MODE_INCALL : SPHONE_MODE_INCALL_NO_ROUTE));
+			execute_datapipe(&call_mode_pipe, GINT_TO_POINTER(needed.incall ? SPHONE_MODE_INCALL : SPHONE_MODE_INCALL_NO_ROUTE));
 			if(route != SPHONE_AUDIO_ROUTE_HEADSET)
 				execute_datapipe(&audio_route_pipe, GINT_TO_POINTER(SPHONE_AUDIO_ROUTE_HANDSET));
 		}
 		if(playing)
 			execute_datapipe(&audio_stop_pipe, NULL);
 		execute_datapipe(&vibrate_pipe, GINT_TO_POINTER(SPHONE_VIBRATE_STOP));
-	} else if(incomeing_call) {
+	} else if(needed.incomeing_call) {
 		execute_datapipe(&call_mode_pipe, GINT_TO_POINTER(SPHONE_MODE_RINGING));
 		if(rtconf_vibration_enabled())
 			execute_datapipe(&vibrate_pipe, GINT_TO_POINTER(SPHONE_VIBRATE_CALL));
@@ -103,34 +111,24 @@ static void check_needed_state(void)
 		if(playing)
 			execute_datapipe(&audio_stop_pipe, NULL);
 	}
+	datapipe_transaction_commit();
 }
 
 static void call_new_trigger(const void *data, void *user_data)
 {
-	const CallProperties *call = (const CallProperties*)data;
+	(void)data;
 	(void)user_data;
-	
-	calls = g_slist_prepend(calls, call_properties_copy(call));
 	check_needed_state();
 }
 
 static void call_changed_trigger(const void *data, void *user_data)
 {
 	(void)user_data;
-	const CallProperties *icall = (const CallProperties*)data;
-	GSList *element;
-	for(element = calls; element; element = element->next) {
-		CallProperties *call = element->data;
-		if(call_properties_comp(icall, call)) {
-			call->state = icall->state;
-			if(call->state == SPHONE_CALL_DISCONNECTED) {
-				call_properties_free(call);
-				calls = g_slist_remove(calls, call);
-			}
-			break;
-		}
-	}
-	check_needed_state();
+	const CallProperties *call = data;
+
+	// the needed state only depends on the states and routing needs of the calls
+	if(call->changes & (SPHONE_CALL_CHANGED_STATE | SPHONE_CALL_CHANGED_NEEDS_ROUTE))
+		check_needed_state();
 }
 
 static void message_received_trigger(const void *data, void *user_data)
@@ -163,9 +161,9 @@ SPHONE_MODULE_EXPORT const gchar *sphone_module_init(void** data);
 const gchar *sphone_module_init(void** data)
 {
 	(void)data;
-	append_trigger_to_datapipe(&call_new_pipe, call_new_trigger, NULL);
-	append_trigger_to_datapipe(&call_properties_changed_pipe, call_changed_trigger, NULL);
-	append_trigger_to_datapipe(&message_received_pipe, message_received_trigger, NULL);
+	insert_trigger_to_datapipe(&call_new_pipe, call_new_trigger, NULL, DATAPIPE_PRIORITY_HIGH);
+	insert_trigger_to_datapipe(&call_properties_changed_pipe, call_changed_trigger, NULL, DATAPIPE_PRIORITY_HIGH);
+	insert_trigger_to_datapipe(&message_received_pipe, message_received_trigger, NULL, DATAPIPE_PRIORITY_HIGH);
 	return NULL;
 }
 
@@ -45,9 +45,6 @@ static void notificaion_reply_cb(NotifyNotification *notification, char *action,
 		gui_show_thread_for_contact(msg->contact);
 	else
 		gui_show_thread_for_contact(contact_from_message(msg));
-
-	g_free(msg->text);
-	msg->text = NULL;
 }
 
 static void message_received_trigger(gconstpointer data, gpointer user_data)
@@ -55,29 +52,19 @@ static void message_received_trigger(gconstpointer data, gpointer user_data)
 	const MessageProperties *message = (const MessageProperties*)data;
 	(void)user_data;
 
-	Contact *contact;
-	if(message->contact) {
-		contact = contact_copy(message->contact);
-	} else {
-		contact = g_malloc0(sizeof(*contact));
-		contact->line_identifier = g_strdup(message->line_identifier);
-		contact->backend = message->backend;
-	}
+	const Contact *contact = message->contact ?: contact_from_message(message);
 
-	if(gui_contact_thread_shown(contact)) {
-		contact_free(contact);
+	if(gui_contact_thread_shown(contact))
 		return;
-	}
 
-	MessageProperties *message_copy = message_properties_copy(message);
 	NotifyNotification *notification =
-		notify_notification_new(contact->name ? contact->name : contact->line_identifier, message_copy->text, "tasklaunch_sms_chat");
+		notify_notification_new(contact->name ? contact->name : contact->line_identifier, message->text, "tasklaunch_sms_chat");
 	notify_notification_set_category(notification, "im.received");
 	notify_notification_add_action(notification, "default", "Reply", notificaion_reply_cb, NULL, NULL);
 	notify_notification_set_hint_string(notification, "LED-Pattern", "PatternCommunicationSMS");
 	notify_notification_set_hint_string(notification, "Group", "_grouped_messages");
 	g_object_set_data_full(G_OBJECT(notification), "message-proparties",
-						   message_copy, (void (*)(void *))message_properties_free);
+						   message_properties_ref(message), (void (*)(void *))message_properties_unref);
 	g_signal_connect(G_OBJECT(notification), "closed", G_CALLBACK(notification_closed_cb), NULL);
 
 	GError *error = NULL;
@@ -85,8 +72,6 @@ static void message_received_trigger(gconstpointer data, gpointer user_data)
 		sphone_module_log(LL_WARN, "failed send notificaion to desktop notification server: %s", error->message);
 		g_error_free(error);
 	}
-
-	contact_free(contact);
 }
 
 static void notificaion_call_back_cb(NotifyNotification *notification, char *action, gpointer user_data)
@@ -111,11 +96,10 @@ static void call_properties_changed_trigger(const void *data, void *user_data)
 
 	sphone_module_log(LL_DEBUG, "%s, %i %i %i",  __func__, call->state != SPHONE_CALL_DISCONNECTED, call->outbound, call->answered);
 
-	if(call->state != SPHONE_CALL_DISCONNECTED || call->outbound || call->answered)
+	if(!(call->changes & SPHONE_CALL_CHANGED_STATE) ||
+	   call->state != SPHONE_CALL_DISCONNECTED || call->outbound || call->answered)
 		return;
 
-	CallProperties *call_copy = call_properties_copy(call);
-
 	NotifyNotification *notification =
 		notify_notification_new("Missed call", (call->contact && call->contact->name) ? call->contact->name : call->line_identifier, "general_missed");
 	notify_notification_set_category(notification, "im");
@@ -123,7 +107,7 @@ static void call_properties_changed_trigger(const void *data, void *user_data)
 	notify_notification_set_hint_string(notification, "LED-Pattern", "PatternCommunicationCall");
 	notify_notification_set_hint_string(notification, "Group", "_grouped_missed");
 	g_object_set_data_full(G_OBJECT(notification), "call-proparties",
-						   call_copy, (void (*)(void *))call_properties_free);
+						   call_properties_ref(call), (void (*)(void *))call_properties_unref);
 	g_signal_connect(G_OBJECT(notification), "closed", G_CALLBACK(notification_closed_cb), NULL);
 
 	GError *error = NULL;
@@ -139,8 +123,8 @@ const gchar *sphone_module_init(void** data)
 	(void)data;
 	if(!notify_init("sphone"))
 		return "Failed to init libnotify";
-	append_trigger_to_datapipe(&message_received_pipe, message_received_trigger, NULL);
-	append_trigger_to_datapipe(&call_properties_changed_pipe, call_properties_changed_trigger, NULL);
+	insert_trigger_to_datapipe_full(&message_received_pipe, message_received_trigger, NULL, DATAPIPE_PRIORITY_LOW, DATAPIPE_EXEC_DEFERRED);
+	insert_trigger_to_datapipe_full(&call_properties_changed_pipe, call_properties_changed_trigger, NULL, DATAPIPE_PRIORITY_LOW, DATAPIPE_EXEC_DEFERRED);
 
 	return NULL;
 }
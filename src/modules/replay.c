@@ -0,0 +1,248 @@
+/*
+ * replay.c
+ * Copyright (C) Carl Philipp Klemm 2021 <carl@uvos.xyz>
+ *
+ * replay.c is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * replay.c is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include "sphone-modules.h"
+#include "sphone-conf.h"
+#include "sphone-log.h"
+#include "datapipes.h"
+#include "datapipe.h"
+#include "types.h"
+#include "comm.h"
+#include "calls.h"
+
+/** Module name */
+#define MODULE_NAME		"replay"
+
+/** Functionality provided by this module */
+static const gchar *const provides[] = { MODULE_NAME, NULL };
+
+/** Module information */
+SPHONE_MODULE_EXPORT module_info_struct module_info = {
+	/** Name of the module */
+	.name = MODULE_NAME,
+	/** Module provides */
+	.provides = provides,
+	/** Module priority */
+	.priority = 250
+};
+
+struct replay_priv {
+	GPtrArray *records;
+	guint index;
+	double speed;
+	gint64 start;
+	guint timeout_id;
+	// backend id at recording time -> backend id registered by the replay
+	GHashTable *backends;
+};
+
+/*
+ * Map a recorded backend id to the id of the backend registered for it,
+ * returns false if the backend was not registered by the recording,
+ * the id may belong to an unrelated live backend then
+ */
+static bool replay_map_backend(struct replay_priv *priv, int *id)
+{
+	gpointer new_id;
+	if(*id < 0)
+		return true;
+	if(!g_hash_table_lookup_extended(priv->backends, GINT_TO_POINTER(*id), NULL, &new_id)) {
+		sphone_module_log(LL_WARN, "recorded backend %i is unknown", *id);
+		return false;
+	}
+	*id = GPOINTER_TO_INT(new_id);
+	return true;
+}
+
+static void replay_backend_added(struct replay_priv *priv, GVariant *data)
+{
+	int old_id;
+	int id = sphone_comm_add_backend_from_variant(data, &old_id);
+	if(id < 0) {
+		sphone_module_log(LL_WARN, "unable to register recorded backend");
+		return;
+	}
+	g_hash_table_insert(priv->backends, GINT_TO_POINTER(old_id), GINT_TO_POINTER(id));
+}
+
+static void replay_backend_removed(struct replay_priv *priv, GVariant *data)
+{
+	if(!g_variant_is_of_type(data, G_VARIANT_TYPE("(ssua(su)aii)")))
+		return;
+
+	int old_id;
+	g_variant_get_child(data, 5, "i", &old_id);
+
+	gpointer id;
+	if(!g_hash_table_lookup_extended(priv->backends, GINT_TO_POINTER(old_id), NULL, &id))
+		return;
+
+	g_hash_table_remove(priv->backends, GINT_TO_POINTER(old_id));
+	sphone_comm_remove_backend(GPOINTER_TO_INT(id));
+}
+
+static bool replay_remap_backends(struct replay_priv *priv, const datapipe_struct *pipe, gpointer data)
+{
+	if(!data)
+		return true;
+
+	Contact *contact = NULL;
+	if(g_strcmp0(pipe->type->name, "CallProperties") == 0) {
+		CallProperties *call = data;
+		if(!replay_map_backend(priv, &call->backend))
+			return false;
+		contact = call->contact;
+	} else if(g_strcmp0(pipe->type->name, "MessageProperties") == 0) {
+		MessageProperties *msg = data;
+		if(!replay_map_backend(priv, &msg->backend))
+			return false;
+		contact = msg->contact;
+	} else if(g_strcmp0(pipe->type->name, "Contact") == 0) {
+		contact = data;
+	}
+
+	return !contact || replay_map_backend(priv, &contact->backend);
+}
+
+static void replay_event(struct replay_priv *priv, GVariant *record)
+{
+	const char *name;
+	GVariant *data;
+	g_variant_get(record, "(x&sm@v)", NULL, &name, &data);
+
+	GVariant *payload = data ? g_variant_get_variant(data) : NULL;
+
+	if(g_strcmp0(name, "comm_backend_added_pipe") == 0) {
+		if(payload)
+			replay_backend_added(priv, payload);
+	} else if(g_strcmp0(name, "comm_backend_removed_pipe") == 0) {
+		if(payload)
+			replay_backend_removed(priv, payload);
+	} else {
+		datapipe_struct *pipe = datapipes_find(name);
+		if(!pipe || !pipe->type || !pipe->type->from_variant) {
+			sphone_module_log(LL_WARN, "can not replay event on %s", name);
+		} else {
+			gpointer indata = payload ? pipe->type->from_variant(payload) : NULL;
+			// events of unknown backends are dropped, calls are owned by the call registry, it emits these itself
+			if(!replay_remap_backends(priv, pipe, indata))
+				sphone_module_log(LL_WARN, "dropping event on %s", name);
+			else if(pipe == &call_new_pipe && indata)
+				sphone_calls_add(indata);
+			else if(pipe == &call_properties_changed_pipe && indata)
+				sphone_calls_update(indata);
+			else
+				execute_datapipe(pipe, indata);
+			if(indata && pipe->type->free)
+				pipe->type->free(indata);
+		}
+	}
+
+	if(payload)
+		g_variant_unref(payload);
+	if(data)
+		g_variant_unref(data);
+}
+
+static gboolean replay_next(gpointer user_data);
+
+static void replay_schedule(struct replay_priv *priv)
+{
+	GVariant *record = g_ptr_array_index(priv->records, priv->index);
+	gint64 time;
+	g_variant_get_child(record, 0, "x", &time);
+
+	gint64 due = priv->speed > 0 ? priv->start + (gint64)(time/priv->speed) : 0;
+	gint64 delay = due - g_get_monotonic_time();
+
+	if(delay > 0)
+		priv->timeout_id = g_timeout_add(delay/1000, replay_next, priv);
+	else
+		priv->timeout_id = g_idle_add(replay_next, priv);
+}
+
+static gboolean replay_next(gpointer user_data)
+{
+	struct replay_priv *priv = user_data;
+	priv->timeout_id = 0;
+
+	replay_event(priv, g_ptr_array_index(priv->records, priv->index));
+	++priv->index;
+
+	if(priv->index < priv->records->len) {
+		replay_schedule(priv);
+	} else {
+		sphone_module_log(LL_INFO, "replayed %u events in %.3f s", priv->records->len,
+						  (g_get_monotonic_time() - priv->start)/1000000.0);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+SPHONE_MODULE_EXPORT const gchar *sphone_module_init(void** data);
+const gchar *sphone_module_init(void** data)
+{
+	*data = NULL;
+	char *path = sphone_conf_get_string("Replay", "File", NULL, NULL);
+	if(!path)
+		return "No replay file set";
+
+	GPtrArray *records = datapipes_record_load(path);
+	g_free(path);
+	if(!records)
+		return "Unable to load replay file";
+
+	char *speed = sphone_conf_get_string("Replay", "Speed", NULL, NULL);
+
+	struct replay_priv *priv = g_malloc0(sizeof(*priv));
+	priv->records = records;
+	priv->speed = speed ? g_ascii_strtod(speed, NULL) : 1.0;
+	priv->backends = g_hash_table_new(g_direct_hash, g_direct_equal);
+	priv->start = g_get_monotonic_time();
+	*data = priv;
+	g_free(speed);
+
+	sphone_module_log(LL_INFO, "replaying %u events at speed %.2f", records->len, priv->speed);
+
+	if(records->len > 0)
+		replay_schedule(priv);
+
+	return NULL;
+}
+
+SPHONE_MODULE_EXPORT void sphone_module_exit(void* data);
+void sphone_module_exit(void* data)
+{
+	struct replay_priv *priv = data;
+	if(!priv)
+		return;
+
+	if(priv->timeout_id)
+		g_source_remove(priv->timeout_id);
+
+	GHashTableIter iter;
+	gpointer id;
+	g_hash_table_iter_init(&iter, priv->backends);
+	while(g_hash_table_iter_next(&iter, NULL, &id))
+		sphone_comm_remove_backend(GPOINTER_TO_INT(id));
+
+	g_hash_table_destroy(priv->backends);
+	g_ptr_array_unref(priv->records);
+	g_free(priv);
+}
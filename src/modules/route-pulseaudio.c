@@ -50,6 +50,8 @@ struct sphone_pa_if {
 	pa_mainloop_api *api;
 	pa_context *context;
 	GSList *cards;
+	/* carries the sphone_module_failed() argument of context failures to the main loop */
+	datapipe_struct failed_pipe;
 };
 
 static void sphone_pa_distroy_interface(struct sphone_pa_if* iface);
@@ -79,6 +81,18 @@ static void sphone_pa_card_info_cb(pa_context *c, const pa_card_info *i, int eol
 	}
 }
 
+/* Pulse callbacks run on the pa_threaded_mainloop thread, report failures from the main loop */
+static void sphone_pa_failed_trigger(gconstpointer data, gpointer user_data)
+{
+	(void)user_data;
+	sphone_module_failed(&module_info, GPOINTER_TO_INT(data));
+}
+
+static void sphone_pa_failed(struct sphone_pa_if *iface, sphone_module_error_t failure)
+{
+	execute_datapipe_async_from_thread(&iface->failed_pipe, GINT_TO_POINTER(failure));
+}
+
 static void sphone_pa_state_callback(pa_context *c, void *userdata)
 {
 	struct sphone_pa_if *iface = userdata;
@@ -101,12 +115,12 @@ static void sphone_pa_state_callback(pa_context *c, void *userdata)
 			break;
 		case PA_CONTEXT_TERMINATED:
 			sphone_module_log(LL_DEBUG, "Context terminated: %s", pa_strerror(pa_context_errno(c)));
-			sphone_module_failed(&module_info, SPHONE_MODULE_RELOAD);
+			sphone_pa_failed(iface, SPHONE_MODULE_RELOAD);
 			break;
 		case PA_CONTEXT_FAILED:
 		default:
 			sphone_module_log(LL_ERR, "Connection failure: %s", pa_strerror(pa_context_errno(c)));
-			sphone_module_failed(&module_info, SPHONE_MODULE_FATAL);
+			sphone_pa_failed(iface, SPHONE_MODULE_FATAL);
 	}
 }
 
@@ -192,15 +206,15 @@ static void audio_route_set_cb(pa_context *c, const pa_server_info *i, void *use
 	switch(mode) {
 		case SPHONE_AUDIO_ROUTE_SPEAKER:
 			operation = pa_context_set_sink_port_by_name(c, i->default_sink_name, "[Out] Speaker",
-														 sphone_pa_callback, (void*)"Set sink to Speaker");
+														 sphone_pa_callback, (void*)"set sink to Speaker");
 			break;
 		case SPHONE_AUDIO_ROUTE_HANDSET:
 			operation = pa_context_set_sink_port_by_name(c, i->default_sink_name, "[Out] Earpiece",
-														 sphone_pa_callback, (void*)"Set sink to Earpiece");
+														 sphone_pa_callback, (void*)"set sink to Earpiece");
 			break;
 		case SPHONE_AUDIO_ROUTE_HEADSET:
 			operation = pa_context_set_sink_port_by_name(c, i->default_sink_name, "[Out] Headphones",
-														 sphone_pa_callback, (void*)"Set sink to Headphones");
+														 sphone_pa_callback, (void*)"set sink to Headphones");
 			break;
 		case SPHONE_AUDIO_ROUTE_BT:
 			sphone_module_log(LL_WARN, "Currently audio routing via bluetooth is not supported");
@@ -260,6 +274,9 @@ const gchar *sphone_module_init(void** data)
 {
 	struct sphone_pa_if *pa_if = g_malloc0(sizeof(*pa_if));
 	*data = pa_if;
+	setup_datapipe(&pa_if->failed_pipe);
+	datapipe_set_name(&pa_if->failed_pipe, "pulseaudio_failed_pipe");
+	append_trigger_to_datapipe(&pa_if->failed_pipe, sphone_pa_failed_trigger, NULL);
 	if(sphone_pa_create_interface(pa_if) != 0)
 		return "Failed to create pulseaudio context";
 
@@ -273,6 +290,9 @@ void sphone_module_exit(void* data)
 {
 	struct sphone_pa_if *pa_if = data;
 	sphone_pa_distroy_interface(pa_if);
+	/* drops the failures the pulse thread reported that were not handled yet */
+	remove_trigger_from_datapipe(&pa_if->failed_pipe, sphone_pa_failed_trigger, NULL);
+	free_datapipe(&pa_if->failed_pipe);
 	remove_trigger_from_datapipe(&call_mode_pipe, call_mode_trigger, pa_if);
 	remove_trigger_from_datapipe(&audio_route_pipe, audio_route_trigger, pa_if);
 	g_free(pa_if);
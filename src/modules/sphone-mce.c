@@ -174,8 +174,9 @@ const gchar *sphone_module_init(void** data)
 	if(!s_bus_conn)
 		return "Failed to connect dbus system bus";
 	
-	append_trigger_to_datapipe(&vibrate_pipe, vibration_trigger, NULL);
-	append_trigger_to_datapipe(&call_mode_pipe, call_mode_trigger, NULL);
+	/* The triggers only use the thread safe GDBusConnection, run them off the main loop */
+	insert_threaded_trigger_to_datapipe(&vibrate_pipe, vibration_trigger, NULL, NULL, DATAPIPE_PRIORITY_DEFAULT);
+	insert_threaded_trigger_to_datapipe(&call_mode_pipe, call_mode_trigger, NULL, NULL, DATAPIPE_PRIORITY_DEFAULT);
 	
 	return NULL;
 }
@@ -185,6 +186,9 @@ void sphone_module_exit(void* data)
 {
 	(void)data;
 
+	/* send a queued stop or mode change before leaving, MCE keeps its state otherwise */
+	flush_trigger_of_datapipe(&vibrate_pipe, vibration_trigger, NULL);
+	flush_trigger_of_datapipe(&call_mode_pipe, call_mode_trigger, NULL);
 	remove_trigger_from_datapipe(&vibrate_pipe, vibration_trigger, NULL);
 	remove_trigger_from_datapipe(&call_mode_pipe, call_mode_trigger, NULL);
 }
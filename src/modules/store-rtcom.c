@@ -18,6 +18,7 @@
 
 #include <glib.h>
 #include <time.h>
+#include <string.h>
 #include <rtcom-eventlogger/eventlogger.h>
 #include <rtcom-eventlogger/eventlogger-query.h>
 #include <stdbool.h>
@@ -28,6 +29,8 @@
 #include "datapipe.h"
 #include "comm.h"
 #include "storage.h"
+#include "phonenumber.h"
+#include "contacts.h"
 
 /** Module name */
 #define MODULE_NAME		"store-rtcom"
@@ -48,7 +51,7 @@ SPHONE_MODULE_EXPORT module_info_struct module_info = {
 static RTComEl *evlog;
 int id = -1;
 
-static void add_event(RTComEl *el, RTComElEvent *ev)
+static int add_event(RTComEl *el, RTComElEvent *ev)
 {
 	GError *error = NULL;
 	int eid;
@@ -56,9 +59,386 @@ static void add_event(RTComEl *el, RTComElEvent *ev)
 	if((eid = rtcom_el_add_event(el, ev, &error)) < 0 ||
 	   rtcom_el_add_header(el, eid, "vcard-field", "tel", &error) < 0) {
 		sphone_module_log(LL_ERR, "failed to add event to rtcom: %s", error->message);
+		eid = -1;
 	}
 
 	g_clear_error(&error);
+	return eid;
+}
+
+/* Ids of the events written here, the new-event signals rtcom sends for them are ignored */
+#define OWN_EVENTS_MAX 32
+static GQueue own_events = G_QUEUE_INIT;
+
+static void store_changed(store_event_t type, int eid, int backend, const char *line_identifier)
+{
+	StoreChange change = {
+		.type = type,
+		.position = eid,
+		.backend = backend,
+		.line_identifier = sphone_intern(line_identifier),
+		.line_key = sphone_phone_number_key(line_identifier),
+	};
+	execute_datapipe(&store_changed_pipe, &change);
+}
+
+static void event_written(store_event_t type, int eid, int backend, const char *line_identifier)
+{
+	if(eid < 0)
+		return;
+
+	g_queue_push_tail(&own_events, GINT_TO_POINTER(eid));
+	if(g_queue_get_length(&own_events) > OWN_EVENTS_MAX)
+		g_queue_pop_head(&own_events);
+
+	store_changed(type, eid, backend, line_identifier);
+}
+
+/* Longest preview of the last message of a conversation in characters */
+#define PREVIEW_LENGTH 64
+
+/* Summary of the messages exchanged with one peer on one local account, the table is
+ * kept current by the message triggers and saved to the cache on exit. When it is first
+ * needed it is loaded from the cache and only messages newer than the cache are scanned,
+ * without a usable cache all messages are scanned once */
+struct conversation {
+	/* interned, compared by pointer */
+	const char *local_uid;
+	const char *line_key;
+	const char *line_identifier;
+	char *name;
+	gint64 last_id;
+	time_t last_time;
+	char *last_text;
+	bool last_outbound;
+	unsigned int count;
+};
+
+static GHashTable *conversations;
+
+#define CONVERSATIONS_CACHE_ENTRY_TYPE "(ssmsxxmsbu)"
+#define CONVERSATIONS_CACHE_TYPE "(xa" CONVERSATIONS_CACHE_ENTRY_TYPE ")"
+
+static guint conversation_hash(gconstpointer key)
+{
+	const struct conversation *conversation = key;
+	return g_direct_hash(conversation->local_uid) * 31 + g_direct_hash(conversation->line_key);
+}
+
+static gboolean conversation_equal(gconstpointer a, gconstpointer b)
+{
+	const struct conversation *conversation_a = a;
+	const struct conversation *conversation_b = b;
+	return conversation_a->local_uid == conversation_b->local_uid &&
+		conversation_a->line_key == conversation_b->line_key;
+}
+
+static void conversation_free(gpointer data)
+{
+	struct conversation *conversation = data;
+	g_free(conversation->name);
+	g_free(conversation->last_text);
+	g_free(conversation);
+}
+
+static char *create_preview(const char *text)
+{
+	if(!text)
+		return NULL;
+	if(g_utf8_strlen(text, PREVIEW_LENGTH+1) <= PREVIEW_LENGTH)
+		return g_strdup(text);
+	return g_strndup(text, g_utf8_offset_to_pointer(text, PREVIEW_LENGTH) - text);
+}
+
+static struct conversation *conversation_get(const char *local_uid, const char *line_identifier)
+{
+	struct conversation key = {
+		.local_uid = sphone_intern(local_uid),
+		.line_key = sphone_phone_number_key(line_identifier),
+	};
+
+	struct conversation *conversation = g_hash_table_lookup(conversations, &key);
+	if(!conversation) {
+		conversation = g_new0(struct conversation, 1);
+		*conversation = key;
+		conversation->line_identifier = sphone_intern(line_identifier);
+		conversation->last_id = -1;
+		g_hash_table_add(conversations, conversation);
+	}
+	return conversation;
+}
+
+/* Returns the conversation for the peer and whether the event with eid is the newest in it */
+static struct conversation *conversation_add_event(const char *local_uid, const char *line_identifier,
+												   gint64 eid, time_t time, bool *newest)
+{
+	struct conversation *conversation = conversation_get(local_uid, line_identifier);
+
+	++conversation->count;
+	*newest = eid > conversation->last_id;
+	if(*newest) {
+		conversation->last_id = eid;
+		conversation->last_time = time;
+	}
+	return conversation;
+}
+
+static void conversations_fill_from_service(const char *service, const char *event_type, gint64 after)
+{
+	RTComElQuery *query = rtcom_el_query_new(evlog);
+	if(!rtcom_el_query_prepare(query, "service-id", rtcom_el_get_service_id(evlog, service), RTCOM_EL_OP_EQUAL,
+							   "event-type-id", rtcom_el_get_eventtype_id(evlog, event_type), RTCOM_EL_OP_EQUAL,
+							   "id", (int)after, RTCOM_EL_OP_GREATER,
+							   NULL)) {
+		sphone_module_log(LL_ERR, "Failed to prepare query");
+		g_object_unref(query);
+		return;
+	}
+
+	RTComElIter *iter = rtcom_el_get_events(evlog, query);
+	if(iter) {
+		do {
+			int eid;
+			time_t start_time;
+			char *local_uid = NULL;
+			char *line_identifier = NULL;
+			if(!rtcom_el_iter_get_values(iter, "id", &eid, "local-uid", &local_uid,
+										 "remote-uid", &line_identifier, "start-time", &start_time, NULL) ||
+			   !local_uid || !line_identifier) {
+				g_free(local_uid);
+				g_free(line_identifier);
+				continue;
+			}
+
+			bool newest;
+			struct conversation *conversation = conversation_add_event(local_uid, line_identifier, eid, start_time, &newest);
+			g_free(local_uid);
+			g_free(line_identifier);
+
+			/* only the newest event of a conversation needs its text */
+			if(newest) {
+				char *text = NULL;
+				char *name = NULL;
+				gboolean outbound = false;
+				rtcom_el_iter_get_values(iter, "free-text", &text, "remote-name", &name, "outgoing", &outbound, NULL);
+				g_free(conversation->last_text);
+				conversation->last_text = create_preview(text);
+				conversation->last_outbound = outbound;
+				if(name) {
+					g_free(conversation->name);
+					conversation->name = name;
+				}
+				g_free(text);
+			}
+		} while(rtcom_el_iter_next(iter));
+		g_object_unref(iter);
+	}
+	g_object_unref(query);
+}
+
+/* Returns an iterator on the event with the id event_id or NULL, query is owned by the caller */
+static RTComElIter *query_event(RTComElQuery *query, int event_id)
+{
+	rtcom_el_query_set_limit(query, 1);
+	if(!rtcom_el_query_prepare(query, "id", event_id, RTCOM_EL_OP_EQUAL, NULL)) {
+		sphone_module_log(LL_ERR, "Failed to prepare query");
+		return NULL;
+	}
+	return rtcom_el_get_events(evlog, query);
+}
+
+static bool event_exists(gint64 eid)
+{
+	RTComElQuery *query = rtcom_el_query_new(evlog);
+	RTComElIter *iter = query_event(query, (int)eid);
+	bool exists = iter;
+	if(iter)
+		g_object_unref(iter);
+	g_object_unref(query);
+	return exists;
+}
+
+static char *conversations_cache_path(void)
+{
+	return g_build_filename(g_get_user_cache_dir(), "sphone", "conversations", NULL);
+}
+
+/* Returns the id of the newest message in the cache, 0 if there is no usable cache */
+static gint64 conversations_load(void)
+{
+	char *path = conversations_cache_path();
+	gchar *contents;
+	gsize length;
+	bool loaded = g_file_get_contents(path, &contents, &length, NULL);
+	g_free(path);
+	if(!loaded)
+		return 0;
+
+	GBytes *bytes = g_bytes_new_take(contents, length);
+	SphoneTypesStream stream;
+	sphone_type_tag_t tag = SPHONE_TYPE_NONE;
+	GVariant *cache = sphone_types_stream_init(&stream, bytes) ? sphone_types_stream_next(&stream, &tag) : NULL;
+	sphone_types_stream_clear(&stream);
+	g_bytes_unref(bytes);
+
+	/* caches of an older encoding version are rebuilt */
+	if(!cache || tag != SPHONE_TYPE_VARIANT || !g_variant_is_of_type(cache, G_VARIANT_TYPE(CONVERSATIONS_CACHE_TYPE))) {
+		sphone_module_log(LL_INFO, "conversation cache is unreadable");
+		if(cache)
+			sphone_types_free(tag, cache);
+		return 0;
+	}
+
+	gint64 scanned;
+	GVariantIter *iter;
+	g_variant_get(cache, "(xa" CONVERSATIONS_CACHE_ENTRY_TYPE ")", &scanned, &iter);
+
+	/* a database that was replaced or lost its newest messages does not match the cache */
+	if(scanned <= 0 || !event_exists(scanned)) {
+		sphone_module_log(LL_INFO, "conversation cache is stale");
+		g_variant_iter_free(iter);
+		g_variant_unref(cache);
+		return 0;
+	}
+
+	const char *local_uid;
+	const char *line_identifier;
+	char *name;
+	gint64 last_id;
+	gint64 last_time;
+	char *last_text;
+	gboolean last_outbound;
+	guint32 count;
+	while(g_variant_iter_next(iter, CONVERSATIONS_CACHE_ENTRY_TYPE, &local_uid, &line_identifier, &name,
+							  &last_id, &last_time, &last_text, &last_outbound, &count)) {
+		struct conversation *conversation = conversation_get(local_uid, line_identifier);
+		g_free(conversation->name);
+		g_free(conversation->last_text);
+		conversation->name = name;
+		conversation->last_id = last_id;
+		conversation->last_time = last_time;
+		conversation->last_text = last_text;
+		conversation->last_outbound = last_outbound;
+		conversation->count = count;
+	}
+	g_variant_iter_free(iter);
+	g_variant_unref(cache);
+	return scanned;
+}
+
+static void conversations_save(void)
+{
+	GVariantBuilder builder;
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a" CONVERSATIONS_CACHE_ENTRY_TYPE));
+
+	gint64 scanned = 0;
+	GHashTableIter iter;
+	gpointer key;
+	g_hash_table_iter_init(&iter, conversations);
+	while(g_hash_table_iter_next(&iter, &key, NULL)) {
+		const struct conversation *conversation = key;
+		g_variant_builder_add(&builder, CONVERSATIONS_CACHE_ENTRY_TYPE, conversation->local_uid,
+							  conversation->line_identifier, conversation->name, conversation->last_id,
+							  (gint64)conversation->last_time, conversation->last_text,
+							  conversation->last_outbound, conversation->count);
+		scanned = MAX(scanned, conversation->last_id);
+	}
+
+	GVariant *cache = g_variant_ref_sink(g_variant_new("(x@a" CONVERSATIONS_CACHE_ENTRY_TYPE ")",
+													   scanned, g_variant_builder_end(&builder)));
+	GByteArray *stream = g_byte_array_new();
+	sphone_types_stream_begin(stream);
+	bool encoded = sphone_types_stream_append(stream, SPHONE_TYPE_VARIANT, cache);
+	g_variant_unref(cache);
+
+	char *path = conversations_cache_path();
+	char *dir = g_path_get_dirname(path);
+	GError *error = NULL;
+	if(!encoded || g_mkdir_with_parents(dir, 0700) != 0 ||
+	   !g_file_set_contents(path, (const gchar *)stream->data, stream->len, &error)) {
+		sphone_module_log(LL_WARN, "Failed to save the conversation cache %s: %s", path, error ? error->message : "");
+		g_clear_error(&error);
+	}
+	g_free(dir);
+	g_free(path);
+	g_byte_array_unref(stream);
+}
+
+static void conversations_fill(void)
+{
+	conversations = g_hash_table_new_full(conversation_hash, conversation_equal, conversation_free, NULL);
+	gint64 scanned = conversations_load();
+	conversations_fill_from_service("RTCOM_EL_SERVICE_SMS", "RTCOM_EL_EVENTTYPE_SMS_MESSAGE", scanned);
+	conversations_fill_from_service("RTCOM_EL_SERVICE_CHAT", "RTCOM_EL_EVENTTYPE_CHAT_MESSAGE", scanned);
+	sphone_module_log(LL_DEBUG, "%u conversations, messages after %lld scanned", g_hash_table_size(conversations),
+					  (long long)scanned);
+}
+
+static void conversations_add_message(const MessageProperties *msg, const char *local_uid, bool outbound, int eid)
+{
+	if(!conversations || eid < 0 || !msg->line_identifier)
+		return;
+
+	/* events are reported both when written and by the new-event signal */
+	struct conversation key = {
+		.local_uid = sphone_intern(local_uid),
+		.line_key = sphone_phone_number_key(msg->line_identifier),
+	};
+	const struct conversation *known = g_hash_table_lookup(conversations, &key);
+	if(known && eid <= known->last_id)
+		return;
+
+	bool newest;
+	struct conversation *conversation = conversation_add_event(local_uid, msg->line_identifier, eid, msg->time, &newest);
+	if(newest) {
+		g_free(conversation->last_text);
+		conversation->last_text = create_preview(msg->text);
+		conversation->last_outbound = outbound;
+		if(msg->contact && msg->contact->name) {
+			g_free(conversation->name);
+			conversation->name = g_strdup(msg->contact->name);
+		}
+	}
+}
+
+static gint compare_conversations(gconstpointer a, gconstpointer b)
+{
+	const StoreConversation *conversation_a = a;
+	const StoreConversation *conversation_b = b;
+	if(conversation_a->last_time != conversation_b->last_time)
+		return conversation_a->last_time < conversation_b->last_time ? 1 : -1;
+	return 0;
+}
+
+static GList *get_conversations(void)
+{
+	if(!evlog)
+		return NULL;
+
+	if(!conversations)
+		conversations_fill();
+
+	GList *list = NULL;
+	GHashTableIter iter;
+	gpointer key;
+	g_hash_table_iter_init(&iter, conversations);
+	while(g_hash_table_iter_next(&iter, &key, NULL)) {
+		const struct conversation *conversation = key;
+		int backend = sphone_comm_find_backend_id_from_uid(conversation->local_uid);
+		if(backend < 0)
+			continue;
+
+		StoreConversation *summary = g_new0(StoreConversation, 1);
+		summary->contact = sphone_contacts_get(backend, conversation->line_identifier, conversation->name);
+		summary->backend = backend;
+		summary->last_time = conversation->last_time;
+		summary->last_text = g_strdup(conversation->last_text);
+		summary->last_outbound = conversation->last_outbound;
+		summary->count = conversation->count;
+		list = g_list_prepend(list, summary);
+	}
+
+	return g_list_sort(list, compare_conversations);
 }
 
 static void call_properties_changed_trigger(const void *data, void *user_data)
@@ -66,7 +446,8 @@ static void call_properties_changed_trigger(const void *data, void *user_data)
 	RTComEl *el = user_data;
 	const CallProperties *call = data;
 
-	if(call->state != SPHONE_CALL_DISCONNECTED)
+	// log a call once, when it is disconnected, later updates only touch the ended call
+	if(call->state != SPHONE_CALL_DISCONNECTED || !(call->changes & SPHONE_CALL_CHANGED_STATE))
 		return;
 
 	CommBackend *backend = sphone_comm_get_backend(call->backend);
@@ -94,7 +475,7 @@ static void call_properties_changed_trigger(const void *data, void *user_data)
 
 	RTCOM_EL_EVENT_SET_FIELD(ev, remote_uid, g_strdup(call->line_identifier));
 
-	add_event(el, ev);
+	event_written(STORE_EVENT_CALL, add_event(el, ev), call->backend, call->line_identifier);
 	rtcom_el_event_free(ev);
 }
 
@@ -138,7 +519,9 @@ static void message_received_trigger(const void *data, void *user_data)
 	RTComElEvent *ev = create_message_event(msg);
 	RTCOM_EL_EVENT_SET_FIELD(ev, outgoing, false);
 
-	add_event(el, ev);
+	int eid = add_event(el, ev);
+	conversations_add_message(msg, backend->uid, false, eid);
+	event_written(STORE_EVENT_MESSAGE, eid, msg->backend, msg->line_identifier);
 	rtcom_el_event_free(ev);
 }
 
@@ -154,18 +537,20 @@ static void message_send_trigger(const void *data, void *user_data)
 	RTComElEvent *ev = create_message_event(msg);
 	RTCOM_EL_EVENT_SET_FIELD(ev, outgoing, true);
 
-	add_event(el, ev);
+	int eid = add_event(el, ev);
+	conversations_add_message(msg, backend->uid, true, eid);
+	event_written(STORE_EVENT_MESSAGE, eid, msg->backend, msg->line_identifier);
 	rtcom_el_event_free(ev);
 }
 
-static MessageProperties *convert_to_message_properties(RTComElIter *iter, const Contact *contact)
+static MessageProperties *convert_to_message_properties(RTComElIter *iter)
 {
-	char *line_identifier;
-	char *local_uid;
-	char *text;
-	char *name;
+	char *line_identifier = NULL;
+	char *local_uid = NULL;
+	char *text = NULL;
+	char *name = NULL;
 	gboolean outbound;
-	MessageProperties *msg = g_malloc0(sizeof(*msg));
+	MessageProperties *msg = message_properties_new();
 	if(!rtcom_el_iter_get_values(iter, "local-uid", &local_uid,
 									"remote-uid", &line_identifier,
 									"outgoing", &outbound,
@@ -173,181 +558,458 @@ static MessageProperties *convert_to_message_properties(RTComElIter *iter, const
 									"free-text", &text,
 									"remote-name", &name, NULL)) {
 		sphone_module_log(LL_ERR, "Failed to access event by iterator");
-		g_free(msg);
+		message_properties_unref(msg);
 		return NULL;
 	}
 
-	msg->line_identifier = g_strdup(line_identifier);
-	msg->text = g_strdup(text);
+	msg->line_identifier = sphone_intern(line_identifier);
+	msg->line_key = sphone_phone_number_key(line_identifier);
+	g_free(line_identifier);
+	msg->text = text ? g_ref_string_new(text) : NULL;
 	msg->outbound = outbound;
-
 	msg->backend = sphone_comm_find_backend_id_from_uid(local_uid);
+	g_free(local_uid);
+	g_free(text);
+
 	if(msg->backend < 0) {
-		message_properties_free(msg);
+		g_free(name);
+		message_properties_unref(msg);
 		return NULL;
 	}
 
-	if(name) {
-		msg->contact = g_malloc0(sizeof(*msg->contact));
-		msg->contact->name = g_strdup(name);
-		msg->contact->line_identifier = g_strdup(line_identifier);
-		msg->contact->backend = msg->backend;
-	} else if(contact && contact->name) {
-		msg->contact = contact_copy(contact);
-	}
+	msg->contact = sphone_contacts_get(msg->backend, msg->line_identifier, name);
+	g_free(name);
 	return msg;
 }
 
-static GList *get_messages_for_contact(Contact *contact, unsigned int limit)
+static CallProperties *convert_to_call_properties(RTComElIter *iter)
 {
-	if(!evlog)
+	char *line_identifier;
+	char *local_uid;
+	char *name;
+	int type;
+	gboolean outbound;
+	CallProperties *call = call_properties_new();
+
+	if(!rtcom_el_iter_get_values(iter, "local-uid", &local_uid,
+									"remote-uid", &line_identifier,
+									"outgoing", &outbound,
+									"start-time", &call->start_time,
+									"end-time", &call->end_time,
+									"event-type-id", &type,
+									"remote-name", &name, NULL)) {
+		sphone_module_log(LL_ERR, "Failed to access event by iterator");
+		call_properties_unref(call);
 		return NULL;
+	}
+	sphone_module_log(LL_DEBUG, "got line: %s", line_identifier ?: "NULL");
+	call->line_identifier = sphone_intern(line_identifier);
+	call->line_key = sphone_phone_number_key(line_identifier);
+	g_free(line_identifier);
+	call->answered = type != rtcom_el_get_eventtype_id(evlog, "RTCOM_EL_EVENTTYPE_CALL_MISSED");
+	call->outbound = outbound;
+	call->state = SPHONE_CALL_DISCONNECTED;
+	call->backend = sphone_comm_find_backend_id_from_uid(local_uid);
+	g_free(local_uid);
+
+	call->contact = sphone_contacts_get(call->backend, call->line_identifier, name);
+	g_free(name);
+	return call;
+}
 
-	RTComElQuery* querySms = rtcom_el_query_new(evlog);
-	RTComElQuery* queryChat = rtcom_el_query_new(evlog);
+/* Rows of the oldest first streams are read in windows of event ids, since rtcom
+ * always returns the newest events first, the window grows while it comes up empty */
+#define WINDOW_MIN 256
+#define WINDOW_MAX 8192
 
+struct rtcom_row {
+	gint64 id;
+	void *data;
+};
+
+struct rtcom_condition {
+	const char *key;
+	int value;
+	RTComElOp op;
+};
+
+struct rtcom_source {
+	int service_id;
+	struct rtcom_condition event_type;
+	RTComElQuery *query;
+	RTComElIter *iter;
+	/* id of the last row read from the database, or the window end for oldest first */
+	gint64 bound;
+	gint64 last_id;
+	gint64 window_size;
+	GArray *window;
+	struct rtcom_row head;
+	bool done;
+};
+
+struct rtcom_stream {
+	store_event_t type;
+	store_sort_t sort;
+	char *local_uid;
+	char *remote_uid;
+	struct rtcom_condition direction;
+	struct rtcom_condition since;
+	struct rtcom_condition until;
+	/* rtcom has no substring operator, so this is checked before a row is converted */
+	char *text;
+	struct rtcom_source sources[2];
+	size_t n_sources;
+};
+
+static void free_row_data(store_event_t type, void *data)
+{
+	if(type == STORE_EVENT_MESSAGE)
+		message_properties_unref(data);
+	else
+		call_properties_unref(data);
+}
+
+/* Filters that are not set are replaced by a condition every event matches,
+ * so that all queries can be prepared with the same argument list */
+static void set_condition(struct rtcom_condition *condition, bool enabled, const char *key, int value, RTComElOp op)
+{
+	if(enabled) {
+		condition->key = key;
+		condition->value = value;
+		condition->op = op;
+	} else {
+		condition->key = "id";
+		condition->value = 0;
+		condition->op = RTCOM_EL_OP_GREATER;
+	}
+}
+
+static bool prepare_source_query(struct rtcom_stream *stream, struct rtcom_source *source,
+								 gint64 after, gint64 before, unsigned int limit)
+{
+	source->query = rtcom_el_query_new(evlog);
 	if(limit > 0)
-	{
-		rtcom_el_query_set_limit(querySms, limit);
-		rtcom_el_query_set_limit(queryChat, limit);
+		rtcom_el_query_set_limit(source->query, limit);
+
+	/* a NULL key ends the conditions early */
+	bool ret = rtcom_el_query_prepare(source->query, "id", (int)after, RTCOM_EL_OP_GREATER,
+									  "id", (int)before, RTCOM_EL_OP_LESS,
+									  "service-id", source->service_id, RTCOM_EL_OP_EQUAL,
+									  source->event_type.key, source->event_type.value, source->event_type.op,
+									  stream->direction.key, stream->direction.value, stream->direction.op,
+									  stream->since.key, stream->since.value, stream->since.op,
+									  stream->until.key, stream->until.value, stream->until.op,
+									  stream->local_uid ? "local-uid" : NULL, stream->local_uid, RTCOM_EL_OP_EQUAL,
+									  stream->remote_uid ? "remote-uid" : NULL, stream->remote_uid, RTCOM_EL_OP_EQUAL,
+									  NULL);
+
+	if(!ret) {
+		sphone_module_log(LL_ERR, "Failed to prepare query");
+		g_clear_object(&source->query);
 	}
+	return ret;
+}
 
-	if(!contact) {
-		if(!rtcom_el_query_prepare(querySms, "service-id", rtcom_el_get_service_id(evlog, "RTCOM_EL_SERVICE_SMS"), RTCOM_EL_OP_EQUAL,
-			                       "event-type-id", rtcom_el_get_eventtype_id(evlog, "RTCOM_EL_EVENTTYPE_SMS_MESSAGE"), RTCOM_EL_OP_EQUAL,
-			                       NULL))
-			return NULL;
-		if(!rtcom_el_query_prepare(queryChat, "service-id", rtcom_el_get_service_id(evlog, "RTCOM_EL_SERVICE_CHAT"), RTCOM_EL_OP_EQUAL,
-			                       "event-type-id", rtcom_el_get_eventtype_id(evlog, "RTCOM_EL_EVENTTYPE_CHAT_MESSAGE"), RTCOM_EL_OP_EQUAL,
-			                       NULL))
-			return NULL;
-	} else {
-		CommBackend *backend = sphone_comm_get_backend(contact->backend);
-		if(!contact->name)
-			execute_datapipe_filters(&contact_fill_pipe, contact);
-		if(!contact->line_identifier)
-			return NULL;
-		if(!backend)
-			return NULL;
+static void source_release(struct rtcom_source *source)
+{
+	g_clear_object(&source->iter);
+	g_clear_object(&source->query);
+}
 
-		if(!rtcom_el_query_prepare(querySms, "service-id", rtcom_el_get_service_id(evlog, "RTCOM_EL_SERVICE_SMS"), RTCOM_EL_OP_EQUAL,
-			                       "event-type-id", rtcom_el_get_eventtype_id(evlog, "RTCOM_EL_EVENTTYPE_SMS_MESSAGE"), RTCOM_EL_OP_EQUAL,
-			                       "local-uid", backend->uid, RTCOM_EL_OP_EQUAL, "remote-uid", contact->line_identifier, RTCOM_EL_OP_EQUAL,
-			                       NULL))
-			return NULL;
-		if(!rtcom_el_query_prepare(queryChat, "service-id", rtcom_el_get_service_id(evlog, "RTCOM_EL_SERVICE_CHAT"), RTCOM_EL_OP_EQUAL,
-			                       "event-type-id", rtcom_el_get_eventtype_id(evlog, "RTCOM_EL_EVENTTYPE_CHAT_MESSAGE"), RTCOM_EL_OP_EQUAL,
-			                       "local-uid", backend->uid, RTCOM_EL_OP_EQUAL, "remote-uid", contact->line_identifier, RTCOM_EL_OP_EQUAL,
-			                       NULL))
+static void *convert_row(struct rtcom_stream *stream, RTComElIter *iter, gint64 *id)
+{
+	int event_id;
+	if(!rtcom_el_iter_get_values(iter, "id", &event_id, NULL)) {
+		sphone_module_log(LL_ERR, "Failed to access event by iterator");
+		return NULL;
+	}
+	*id = event_id;
+
+	if(stream->text) {
+		char *text = NULL;
+		rtcom_el_iter_get_values(iter, "free-text", &text, NULL);
+		char *folded = text ? g_utf8_casefold(text, -1) : NULL;
+		bool match = folded && strstr(folded, stream->text);
+		g_free(folded);
+		g_free(text);
+		if(!match)
 			return NULL;
 	}
 
-	RTComElIter *iterSms = rtcom_el_get_events(evlog, querySms);
-	RTComElIter *iterChat = rtcom_el_get_events(evlog, queryChat);
-	if(!iterSms && !iterChat)
-		return NULL;
+	if(stream->type == STORE_EVENT_MESSAGE)
+		return convert_to_message_properties(iter);
+	else
+		return convert_to_call_properties(iter);
+}
 
-	GList *messages = NULL;
+/* Returns the next row in descending id order, the query is reopened after the last row read if it was suspended */
+static bool source_pull_newest(struct rtcom_stream *stream, struct rtcom_source *source, struct rtcom_row *row)
+{
+	while(!source->done) {
+		if(!source->iter) {
+			if(!prepare_source_query(stream, source, 0, source->bound, 0)) {
+				source->done = true;
+				break;
+			}
+			source->iter = rtcom_el_get_events(evlog, source->query);
+			if(!source->iter) {
+				source->done = true;
+				break;
+			}
+		} else if(!rtcom_el_iter_next(source->iter)) {
+			source->done = true;
+			break;
+		}
 
-	if(iterSms) {
-		do {
-			MessageProperties *msg = convert_to_message_properties(iterSms, contact);
-			if(msg)
-				messages = g_list_append(messages, msg);
-		} while(rtcom_el_iter_next(iterSms));
+		gint64 id = -1;
+		row->data = convert_row(stream, source->iter, &id);
+		if(id >= 0)
+			source->bound = id;
+		if(row->data) {
+			row->id = id;
+			return true;
+		}
+		if(id < 0)
+			source->done = true;
 	}
 
-	if(iterChat) {
-		do {
-			MessageProperties *msg = convert_to_message_properties(iterChat, contact);
-			if(msg)
-				messages = g_list_append(messages, msg);
-		} while(rtcom_el_iter_next(iterChat));
+	source_release(source);
+	return false;
+}
+
+/* Returns the next row in ascending id order by reading windows of ids newest first and reversing them */
+static bool source_pull_oldest(struct rtcom_stream *stream, struct rtcom_source *source, struct rtcom_row *row)
+{
+	while(source->window->len == 0) {
+		if(source->done || source->bound >= source->last_id) {
+			source->done = true;
+			return false;
+		}
+
+		gint64 end = MIN(source->bound + source->window_size, source->last_id);
+		if(prepare_source_query(stream, source, source->bound, end + 1, 0)) {
+			source->iter = rtcom_el_get_events(evlog, source->query);
+			if(source->iter) {
+				do {
+					struct rtcom_row window_row;
+					window_row.data = convert_row(stream, source->iter, &window_row.id);
+					if(window_row.data)
+						g_array_append_val(source->window, window_row);
+				} while(rtcom_el_iter_next(source->iter));
+			}
+			source_release(source);
+		} else {
+			source->done = true;
+		}
+		source->bound = end;
+
+		if(source->window->len == 0 && source->window_size < WINDOW_MAX)
+			source->window_size *= 2;
 	}
 
-	g_object_unref(querySms);
-	g_object_unref(queryChat);
+	*row = g_array_index(source->window, struct rtcom_row, source->window->len-1);
+	g_array_set_size(source->window, source->window->len-1);
+	return true;
+}
 
-	return messages;
+/* The newest event of the source, the oldest first streams stop there */
+static gint64 source_last_id(struct rtcom_stream *stream, struct rtcom_source *source)
+{
+	gint64 id = -1;
+	if(!prepare_source_query(stream, source, 0, G_MAXINT, 1))
+		return -1;
+	source->iter = rtcom_el_get_events(evlog, source->query);
+	if(source->iter) {
+		int event_id;
+		if(rtcom_el_iter_get_values(source->iter, "id", &event_id, NULL))
+			id = event_id;
+	}
+	source_release(source);
+	return id;
 }
 
-static GList *get_calls_for_contact(Contact *contact, unsigned int limit)
+static void add_source(struct rtcom_stream *stream, const char *service, const char *event_type,
+					   RTComElOp event_type_op, gint64 after)
+{
+	struct rtcom_source *source = &stream->sources[stream->n_sources++];
+	source->service_id = rtcom_el_get_service_id(evlog, service);
+	set_condition(&source->event_type, event_type, "event-type-id",
+				  event_type ? rtcom_el_get_eventtype_id(evlog, event_type) : 0, event_type_op);
+	source->window = g_array_new(FALSE, FALSE, sizeof(struct rtcom_row));
+	source->window_size = WINDOW_MIN;
+
+	if(stream->sort == STORE_SORT_NEWEST_FIRST) {
+		source->bound = after >= 0 ? after : G_MAXINT;
+	} else {
+		source->bound = MAX(after, 0);
+		source->last_id = source_last_id(stream, source);
+	}
+}
+
+static void stream_close(void *data)
+{
+	struct rtcom_stream *stream = data;
+	for(size_t i = 0; i < stream->n_sources; ++i) {
+		struct rtcom_source *source = &stream->sources[i];
+		source_release(source);
+		if(source->head.data)
+			free_row_data(stream->type, source->head.data);
+		for(guint j = 0; j < source->window->len; ++j)
+			free_row_data(stream->type, g_array_index(source->window, struct rtcom_row, j).data);
+		g_array_free(source->window, TRUE);
+	}
+	g_free(stream->local_uid);
+	g_free(stream->remote_uid);
+	g_free(stream->text);
+	g_free(stream);
+}
+
+static void *stream_open(const StoreQuery *query, store_sort_t sort, gint64 after)
 {
 	if(!evlog)
-		return 0;
+		return NULL;
 
-	RTComElQuery* query = rtcom_el_query_new(evlog);
+	struct rtcom_stream *stream = g_new0(struct rtcom_stream, 1);
+	stream->type = query->type;
+	stream->sort = sort;
 
-	if(limit > 0)
-		rtcom_el_query_set_limit(query, limit);
+	int backend_id = query->backend;
+	if(query->contact) {
+		if(!query->contact->line_identifier || (backend_id >= 0 && backend_id != query->contact->backend)) {
+			g_free(stream);
+			return NULL;
+		}
+		backend_id = query->contact->backend;
+		stream->remote_uid = g_strdup(query->contact->line_identifier);
+	}
 
-	if(!contact) {
-		if(!rtcom_el_query_prepare(query, "service-id", rtcom_el_get_service_id(evlog, "RTCOM_EL_SERVICE_CALL"), RTCOM_EL_OP_EQUAL, NULL))
+	if(backend_id >= 0) {
+		CommBackend *backend = sphone_comm_get_backend(backend_id);
+		if(!backend) {
+			g_free(stream->remote_uid);
+			g_free(stream);
 			return NULL;
+		}
+		stream->local_uid = g_strdup(backend->uid);
+	}
+
+	set_condition(&stream->direction, query->direction != STORE_DIRECTION_ANY, "outgoing",
+				  query->direction == STORE_DIRECTION_OUTBOUND, RTCOM_EL_OP_EQUAL);
+	set_condition(&stream->since, query->since > 0, "start-time", query->since, RTCOM_EL_OP_GREATER_EQUAL);
+	set_condition(&stream->until, query->until > 0, "start-time", query->until, RTCOM_EL_OP_LESS);
+
+	if(query->type == STORE_EVENT_MESSAGE) {
+		if(query->text)
+			stream->text = g_utf8_casefold(query->text, -1);
+		add_source(stream, "RTCOM_EL_SERVICE_SMS", "RTCOM_EL_EVENTTYPE_SMS_MESSAGE", RTCOM_EL_OP_EQUAL, after);
+		add_source(stream, "RTCOM_EL_SERVICE_CHAT", "RTCOM_EL_EVENTTYPE_CHAT_MESSAGE", RTCOM_EL_OP_EQUAL, after);
 	} else {
-		CommBackend *backend = sphone_comm_get_backend(contact->backend);
+		const char *missed = query->answered != STORE_ANSWERED_ANY ? "RTCOM_EL_EVENTTYPE_CALL_MISSED" : NULL;
+		add_source(stream, "RTCOM_EL_SERVICE_CALL", missed,
+				   query->answered == STORE_MISSED_ONLY ? RTCOM_EL_OP_EQUAL : RTCOM_EL_OP_NOT_EQUAL, after);
+	}
 
-		if(!contact->name)
-			execute_datapipe_filters(&contact_fill_pipe, contact);
-		if(!contact->line_identifier)
-			return NULL;
-		if(!backend)
-			return NULL;
+	return stream;
+}
 
-		if(!rtcom_el_query_prepare(query, "service-id", rtcom_el_get_service_id(evlog, "RTCOM_EL_SERVICE_CALL"), RTCOM_EL_OP_EQUAL,
-			                              "local-uid", backend->uid, RTCOM_EL_OP_EQUAL,
-			                              "remote-uid", contact->line_identifier, RTCOM_EL_OP_EQUAL, NULL))
-			return NULL;
+static void *stream_next(void *data, gint64 *position)
+{
+	struct rtcom_stream *stream = data;
+	struct rtcom_source *best = NULL;
+
+	for(size_t i = 0; i < stream->n_sources; ++i) {
+		struct rtcom_source *source = &stream->sources[i];
+		if(!source->head.data) {
+			if(stream->sort == STORE_SORT_NEWEST_FIRST)
+				source_pull_newest(stream, source, &source->head);
+			else
+				source_pull_oldest(stream, source, &source->head);
+		}
+		if(!source->head.data)
+			continue;
+		if(!best ||
+		   (stream->sort == STORE_SORT_NEWEST_FIRST && source->head.id > best->head.id) ||
+		   (stream->sort == STORE_SORT_OLDEST_FIRST && source->head.id < best->head.id))
+			best = source;
 	}
 
-	RTComElIter *iter = rtcom_el_get_events(evlog, query);
-	if(!iter)
+	if(!best)
 		return NULL;
 
-	GList *calls = NULL;
-
-	do {
-		char *line_identifier;
-		char *local_uid;
-		char *name;
-		int type;
-		gboolean outbound;
-		CallProperties *call = g_malloc0(sizeof(*call));
-
-		if(!rtcom_el_iter_get_values(iter, "local-uid", &local_uid,
-			                               "remote-uid", &line_identifier,
-			                               "outgoing", &outbound,
-			                               "start-time", &call->start_time,
-			                               "end-time", &call->end_time,
-			                               "event-type-id", &type,
-			                               "remote-name", &name, NULL)) {
-			sphone_module_log(LL_ERR, "Failed to access event by iterator");
-			g_free(call);
-			continue;
-		}
-		sphone_module_log(LL_DEBUG, "got line: %s", line_identifier ?: "NULL");
-		call->line_identifier = g_strdup(line_identifier);
-		call->answered = type != rtcom_el_get_eventtype_id(evlog, "RTCOM_EL_EVENTTYPE_CALL_MISSED");
-		call->outbound = outbound;
-		call->state = SPHONE_CALL_DISCONNECTED;
-		call->backend = sphone_comm_find_backend_id_from_uid(local_uid);
-
-		if(name) {
-			call->contact = g_malloc0(sizeof(*call->contact));
-			call->contact->name = g_strdup(name);
-			call->contact->line_identifier = g_strdup(line_identifier);
-			call->contact->backend = call->backend;
-		} else if(contact && contact->name) {
-			call->contact = contact_copy(contact);
-		} else {
-			execute_datapipe_filters(&call_new_pipe, call);
-		}
-		calls = g_list_append(calls, call);
-	} while(rtcom_el_iter_next(iter));
-	
+	void *row = best->head.data;
+	*position = best->head.id;
+	best->head.data = NULL;
+	return row;
+}
+
+/* Drop the open statements between pages so the database is not kept locked */
+static void stream_suspend(void *data)
+{
+	struct rtcom_stream *stream = data;
+	for(size_t i = 0; i < stream->n_sources; ++i)
+		source_release(&stream->sources[i]);
+}
+
+static const StoreCursorBackend cursor_backend = {
+	.open = stream_open,
+	.next = stream_next,
+	.suspend = stream_suspend,
+	.close = stream_close,
+};
+
+static bool event_is_of_type(RTComElIter *iter, store_event_t type)
+{
+	int service_id = -1;
+	int event_type_id = -1;
+	if(!rtcom_el_iter_get_values(iter, "service-id", &service_id, "event-type-id", &event_type_id, NULL))
+		return false;
+
+	if(type == STORE_EVENT_CALL)
+		return service_id == rtcom_el_get_service_id(evlog, "RTCOM_EL_SERVICE_CALL");
+	return event_type_id == rtcom_el_get_eventtype_id(evlog, "RTCOM_EL_EVENTTYPE_SMS_MESSAGE") ||
+		event_type_id == rtcom_el_get_eventtype_id(evlog, "RTCOM_EL_EVENTTYPE_CHAT_MESSAGE");
+}
+
+/* Returns the call or message with the event id event_id, or NULL if that event is none */
+static void *get_event(store_event_t type, int event_id)
+{
+	void *row = NULL;
+	RTComElQuery *query = rtcom_el_query_new(evlog);
+	RTComElIter *iter = query_event(query, event_id);
+	if(iter) {
+		if(event_is_of_type(iter, type))
+			row = type == STORE_EVENT_MESSAGE ? (void*)convert_to_message_properties(iter) : (void*)convert_to_call_properties(iter);
+		g_object_unref(iter);
+	}
 	g_object_unref(query);
+	return row;
+}
+
+/* rtcom relays the new event D-Bus signals of all writers of the database, including other applications */
+static void new_event_cb(RTComEl *el, int event_id, const char *local_uid, const char *remote_uid,
+						 const char *remote_ebook_uid, const char *group_uid, const char *service, gpointer user_data)
+{
+	(void)el;
+	(void)remote_ebook_uid;
+	(void)group_uid;
+	(void)user_data;
 
-	return calls;
+	if(g_queue_remove(&own_events, GINT_TO_POINTER(event_id)))
+		return;
+
+	sphone_module_log(LL_DEBUG, "new event %i of %s", event_id, service ?: "NULL");
+
+	if(g_strcmp0(service, "RTCOM_EL_SERVICE_CALL") == 0) {
+		store_changed(STORE_EVENT_CALL, event_id, sphone_comm_find_backend_id_from_uid(local_uid), remote_uid);
+	} else if(g_strcmp0(service, "RTCOM_EL_SERVICE_SMS") == 0 || g_strcmp0(service, "RTCOM_EL_SERVICE_CHAT") == 0) {
+		// Other events of these services, like delivery reports, are not messages
+		MessageProperties *msg = get_event(STORE_EVENT_MESSAGE, event_id);
+		if(!msg)
+			return;
+		conversations_add_message(msg, local_uid, msg->outbound, event_id);
+		store_changed(STORE_EVENT_MESSAGE, event_id, msg->backend, msg->line_identifier);
+		message_properties_unref(msg);
+	}
 }
 
 SPHONE_MODULE_EXPORT const gchar *sphone_module_init(void** data);
@@ -361,11 +1023,13 @@ const gchar *sphone_module_init(void** data)
 
 	sphone_module_log(LL_INFO, "Successfully opened rtcom-eventlogger database");
 
-	append_trigger_to_datapipe(&call_properties_changed_pipe, call_properties_changed_trigger, evlog);
-	append_trigger_to_datapipe(&message_received_pipe, message_received_trigger, evlog);
-	append_trigger_to_datapipe(&message_send_pipe, message_send_trigger, evlog);
+	insert_trigger_to_datapipe_full(&call_properties_changed_pipe, call_properties_changed_trigger, evlog, DATAPIPE_PRIORITY_LOWEST, DATAPIPE_EXEC_DEFERRED_LOW);
+	insert_trigger_to_datapipe_full(&message_received_pipe, message_received_trigger, evlog, DATAPIPE_PRIORITY_LOWEST, DATAPIPE_EXEC_DEFERRED_LOW);
+	insert_trigger_to_datapipe_full(&message_send_pipe, message_send_trigger, evlog, DATAPIPE_PRIORITY_LOWEST, DATAPIPE_EXEC_DEFERRED_LOW);
 
-	id = store_register_backend(get_messages_for_contact, get_calls_for_contact);
+	id = store_register_cursor_backend(&cursor_backend);
+	store_register_conversation_backend(get_conversations);
+	g_signal_connect(G_OBJECT(evlog), "new-event", G_CALLBACK(new_event_cb), NULL);
 
 	return NULL;
 }
@@ -375,10 +1039,21 @@ void sphone_module_exit(void* data)
 {
 	(void)data;
 	if(evlog) {
+		/* write the events still waiting for their deferred trigger, they are lost otherwise */
+		flush_trigger_of_datapipe(&call_properties_changed_pipe, call_properties_changed_trigger, evlog);
+		flush_trigger_of_datapipe(&message_received_pipe, message_received_trigger, evlog);
+		flush_trigger_of_datapipe(&message_send_pipe, message_send_trigger, evlog);
 		remove_trigger_from_datapipe(&call_properties_changed_pipe, call_properties_changed_trigger, evlog);
 		remove_trigger_from_datapipe(&message_received_pipe, message_received_trigger, evlog);
 		remove_trigger_from_datapipe(&message_send_pipe, message_send_trigger, evlog);
+		g_signal_handlers_disconnect_by_func(G_OBJECT(evlog), G_CALLBACK(new_event_cb), NULL);
 		store_unregister_backend(id);
+		g_queue_clear(&own_events);
+		if(conversations) {
+			conversations_save();
+			g_hash_table_destroy(conversations);
+		}
+		conversations = NULL;
 		g_object_unref(evlog);
 	}
 }
@@ -20,7 +20,7 @@ MaemoCallHandler::MaemoCallHandler(MaemoManager* mgr_, VoiceCallHandler* handler
 MaemoCallHandler::~MaemoCallHandler()
 {
 	disconnect(voicecall_handler);
-	call_properties_free(call_properties);
+	call_properties_unref(call_properties);
 }
 
 void MaemoCallHandler::setupProvider()
@@ -50,7 +50,7 @@ void MaemoCallHandler::statusChanged()
 
 	if (call_status == VoiceCallHandler::STATUS_NULL) {
 		sphone_module_log(LL_DEBUG, "Creating call");
-		call_properties = (CallProperties*)g_malloc0(sizeof(*call_properties));
+		call_properties = call_properties_new();
 
 		call_properties->backend = backend->sphone_backend_id;
 		call_properties->needs_route = backend->type == "tel";
@@ -68,10 +68,11 @@ void MaemoCallHandler::statusChanged()
 		call_properties->start_time = time(NULL);
 
 		call_properties->emergency = voicecall_handler->isEmergency();
-		call_properties->line_identifier = g_strdup(voicecall_handler->lineId().toStdString().c_str());
+		call_properties->line_identifier = sphone_intern(voicecall_handler->lineId().toStdString().c_str());
+		call_properties->line_key = sphone_phone_number_key(call_properties->line_identifier);
 		call_properties->backend_data = g_strdup(voicecall_handler->handlerId().toStdString().c_str());
 
-		execute_datapipe(&call_new_pipe, call_properties);
+		sphone_calls_add(call_properties);
 	} else if (current_status == VoiceCallHandler::STATUS_ACTIVE) {
 #if 0
 		// Is this the right place?
@@ -81,19 +82,19 @@ void MaemoCallHandler::statusChanged()
 		call_properties->answered = true;
 
 		call_properties->state = SPHONE_CALL_ACTIVE;
-		execute_datapipe(&call_properties_changed_pipe, call_properties);
+		sphone_calls_update(call_properties);
 	} else if (current_status == VoiceCallHandler::STATUS_DIALING) {
 		call_properties->state = SPHONE_CALL_DIALING;
-		execute_datapipe(&call_properties_changed_pipe, call_properties);
+		sphone_calls_update(call_properties);
 	} else if (current_status == VoiceCallHandler::STATUS_ALERTING) {
 		call_properties->state = SPHONE_CALL_ALERTING;
-		execute_datapipe(&call_properties_changed_pipe, call_properties);
+		sphone_calls_update(call_properties);
 	} else if (current_status == VoiceCallHandler::STATUS_HELD) {
 		call_properties->state = SPHONE_CALL_HELD;
-		execute_datapipe(&call_properties_changed_pipe, call_properties);
+		sphone_calls_update(call_properties);
 	} else if (current_status == VoiceCallHandler::STATUS_WAITING) {
 		call_properties->state = SPHONE_CALL_WAITING;
-		execute_datapipe(&call_properties_changed_pipe, call_properties);
+		sphone_calls_update(call_properties);
 	} else if (current_status == VoiceCallHandler::STATUS_DISCONNECTED) {
 		sphone_module_log(LL_DEBUG, "call status: disconnected");
 
@@ -102,7 +103,7 @@ void MaemoCallHandler::statusChanged()
 			call_properties->state = SPHONE_CALL_DISCONNECTED;
 			call_properties->end_time = time(NULL);
 
-			execute_datapipe(&call_properties_changed_pipe, call_properties);
+			sphone_calls_update(call_properties);
 			hangup_communicated = 1;
 		}
 	}
@@ -134,7 +135,7 @@ void MaemoCallHandler::hangup()
 		if (!hangup_communicated) {
 			call_properties->state = SPHONE_CALL_DISCONNECTED;
 			call_properties->end_time = time(NULL);
-			execute_datapipe(&call_properties_changed_pipe, call_properties);
+			sphone_calls_update(call_properties);
 		}
 	}
 
@@ -4,6 +4,8 @@
 #include "datapipe.h"
 #include "datapipes.h"
 #include "types.h"
+#include "calls.h"
+#include "phonenumber.h"
 
 #include <QtCore>
 
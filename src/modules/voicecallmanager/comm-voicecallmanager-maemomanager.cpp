@@ -4,6 +4,8 @@
 
 #include "moc_comm-voicecallmanager-maemomanager.cpp"
 
+#include "comm.h"
+
 MaemoManager::MaemoManager()
 {
 }
@@ -136,7 +138,9 @@ void MaemoManager::acceptTrigger(const CallProperties* call)
 
 	if (voicecalls.contains(call_handler)) {
 		MaemoCallHandler* mch = voicecalls[call_handler];
+		gint64 start = sphone_comm_operation_begin(call->backend, COMM_OP_ANSWER);
 		mch->answer();
+		sphone_comm_operation_reply(call->backend, COMM_OP_ANSWER, start, true);
 	}
 }
 
@@ -158,7 +162,9 @@ void MaemoManager::hangupTrigger(const CallProperties* call)
 
 	if (voicecalls.contains(call_handler)) {
 		MaemoCallHandler* mch = voicecalls[call_handler];
+		gint64 start = sphone_comm_operation_begin(call->backend, COMM_OP_HANGUP);
 		mch->hangup();
+		sphone_comm_operation_reply(call->backend, COMM_OP_HANGUP, start, true);
 	}
 }
 
@@ -173,7 +179,9 @@ void MaemoManager::dialTrigger(const CallProperties* call)
 
 		if ((mp->sphone_backend_id) == call->backend) {
 			sphone_module_log(LL_DEBUG, "found matching backend for call");
+			gint64 start = sphone_comm_operation_begin(call->backend, COMM_OP_DIAL);
 			qt_voicecall_manager->dial(mp->id, call->line_identifier);
+			sphone_comm_operation_reply(call->backend, COMM_OP_DIAL, start, true);
 			break;
 		}
 	}
@@ -41,6 +41,7 @@ void MaemoProvider::registerBackend()
 
 	QString tmp = QString(id).replace("/org/freedesktop/Telepathy/Account/", "");
 	sphone_backend_id = sphone_comm_add_backend(tmp.toStdString().c_str(), tmp.toStdString().c_str(), schemes, BACKEND_FLAG_CALL, fields, char_valid);
+	sphone_comm_set_availability(sphone_backend_id, COMM_AVAILABILITY_AVAILABLE);
 
 	sphone_module_log(LL_DEBUG, "Registered backend: %s", tmp.toStdString().c_str());
 }
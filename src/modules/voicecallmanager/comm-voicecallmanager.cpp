@@ -1,8 +1,7 @@
 #include <glib.h>
 #include <gmodule.h>
 
-#include "datapipe.h"
-#include "datapipes.h"
+#include "datapipes.hpp"
 #include "sphone-modules.h"
 #include "types.h"
 
@@ -18,6 +17,26 @@
 #include "comm-voicecallmanager-maemomanager.h"
 #include "comm-voicecallmanager-maemoprovider.h"
 
+/* The triggers are removed before the manager is destroyed */
+struct VoiceCallManagerModule
+{
+    MaemoManager manager;
+    sphone::Subscription dial;
+    sphone::Subscription accept;
+    sphone::Subscription hold;
+    sphone::Subscription hangup;
+
+    VoiceCallManagerModule()
+    {
+        manager.setup();
+
+        dial = sphone::pipes::callDial.subscribe<&MaemoManager::dialTrigger>(&manager);
+        accept = sphone::pipes::callAccept.subscribe<&MaemoManager::acceptTrigger>(&manager);
+        hold = sphone::pipes::callHold.subscribe<&MaemoManager::holdTrigger>(&manager);
+        hangup = sphone::pipes::callHangup.subscribe<&MaemoManager::hangupTrigger>(&manager);
+    }
+};
+
 extern "C" {
     /** Functionality provided by this module */
     static const gchar* const provides[] = { MODULE_NAME, NULL };
@@ -32,49 +51,10 @@ extern "C" {
         .priority = 250
     };
 
-    static void call_dial_trigger(gconstpointer data, gpointer user_data)
-    {
-        const CallProperties* call = (const CallProperties*)data;
-        MaemoManager* maemo_mgr = (MaemoManager*)user_data;
-
-        maemo_mgr->dialTrigger(call);
-    }
-
-    static void call_accept_trigger(gconstpointer data, gpointer user_data)
-    {
-        const CallProperties* call = (const CallProperties*)data;
-        MaemoManager* maemo_mgr = (MaemoManager*)user_data;
-        maemo_mgr->acceptTrigger(call);
-    }
-
-    static void call_hold_trigger(gconstpointer data, gpointer user_data)
-    {
-        const CallProperties* call = (const CallProperties*)data;
-        MaemoManager* maemo_mgr = (MaemoManager*)user_data;
-        maemo_mgr->holdTrigger(call);
-    }
-
-    static void call_hangup_trigger(gconstpointer data, gpointer user_data)
-    {
-        const CallProperties* call = (const CallProperties*)data;
-        MaemoManager* maemo_mgr = (MaemoManager*)user_data;
-
-        maemo_mgr->hangupTrigger(call);
-    }
-
     G_MODULE_EXPORT const gchar* sphone_module_init(void** data);
     const gchar* sphone_module_init(void** data)
     {
-        MaemoManager* maemo_mgr = new MaemoManager();
-
-        maemo_mgr->setup();
-
-        *data = maemo_mgr;
-
-        append_trigger_to_datapipe(&call_dial_pipe, call_dial_trigger, maemo_mgr);
-        append_trigger_to_datapipe(&call_accept_pipe, call_accept_trigger, maemo_mgr);
-        append_trigger_to_datapipe(&call_hold_pipe, call_hold_trigger, maemo_mgr);
-        append_trigger_to_datapipe(&call_hangup_pipe, call_hangup_trigger, maemo_mgr);
+        *data = new VoiceCallManagerModule();
 
         return NULL;
     }
@@ -82,13 +62,6 @@ extern "C" {
     G_MODULE_EXPORT void sphone_module_exit(void* data);
     void sphone_module_exit(void* data)
     {
-        MaemoManager* maemo_mgr = (MaemoManager*)data;
-
-        remove_trigger_from_datapipe(&call_dial_pipe, call_dial_trigger, maemo_mgr);
-        remove_trigger_from_datapipe(&call_accept_pipe, call_accept_trigger, maemo_mgr);
-        remove_trigger_from_datapipe(&call_hold_pipe, call_hold_trigger, maemo_mgr);
-        remove_trigger_from_datapipe(&call_hangup_pipe, call_hangup_trigger, maemo_mgr);
-
-        delete maemo_mgr;
+        delete static_cast<VoiceCallManagerModule*>(data);
     }
 }
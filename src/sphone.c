@@ -59,6 +59,9 @@
 #include "gui.h"
 #include "types.h"
 #include "comm.h"
+#include "calls.h"
+#include "phonenumber.h"
+#include "contacts.h"
 #include "signal.h"
 
 #define SPHONE_SERVICE "xyz.uvos.sphone"
@@ -73,6 +76,7 @@ typedef enum {
 	SPHONE_CMD_OPTIONS,
 	SPHONE_CMD_INSMOD,
 	SPHONE_CMD_RMMOD,
+	SPHONE_CMD_DUMP_STATS,
 	SPHONE_CMD_NONE,
 } sphone_cmd;
 
@@ -102,6 +106,9 @@ static const gchar dbus_introspection_xml[] =
 "		</method>"
 "		<method name='OpenCallHistory'>"
 "		</method>"
+"		<method name='DumpStats'>"
+"			<arg name='stats' type='s' direction='out'/>"
+"		</method>"
 "	</interface>"
 "</node>"; 
 
@@ -144,6 +151,16 @@ struct sphone_options {
 	gchar *number;
 };
 
+static char *dump_stats(void)
+{
+	char *datapipe_stats = datapipes_dump_stats();
+	char *comm_stats = sphone_comm_dump_stats();
+	char *stats = g_strconcat(datapipe_stats, comm_stats, NULL);
+	g_free(datapipe_stats);
+	g_free(comm_stats);
+	return stats;
+}
+
 static void run_command(const struct sphone_options *options)
 {
 	sphone_log(LL_INFO, "running command");
@@ -154,7 +171,7 @@ static void run_command(const struct sphone_options *options)
 		case SPHONE_CMD_DIALER_OPEN:
 		{
 			CallProperties call = {
-				.line_identifier = options->number,
+				.line_identifier = sphone_intern(options->number),
 				.backend = backend ? backend->id : 0
 			};
 			gui_dialer_show(&call);
@@ -163,7 +180,7 @@ static void run_command(const struct sphone_options *options)
 		case SPHONE_CMD_SMS_NEW:
 		{
 			MessageProperties msg = {
-				.line_identifier = options->number,
+				.line_identifier = sphone_intern(options->number),
 				.backend = backend ? backend->id : 0
 			};
 			gui_sms_send_show(&msg);
@@ -184,6 +201,13 @@ static void run_command(const struct sphone_options *options)
 		case SPHONE_CMD_RMMOD:
 			sphone_module_unload(options->number);
 			break;
+		case SPHONE_CMD_DUMP_STATS:
+		{
+			char *stats = dump_stats();
+			printf("%s", stats);
+			g_free(stats);
+			break;
+		}
 		default:
 			break;
 	}
@@ -248,7 +272,17 @@ static void send_command(GDBusConnection *connection, const struct sphone_option
 				SPHONE_INTERFACE, "Rmmod", params, NULL,
 				(GDBusCallFlags)G_DBUS_SEND_MESSAGE_FLAGS_NONE, -1, NULL, &error);
 			break;
-		break;
+		case SPHONE_CMD_DUMP_STATS:
+			resp = g_dbus_connection_call_sync(connection,
+				SPHONE_SERVICE, SPHONE_PATH,
+				SPHONE_INTERFACE, "DumpStats", NULL, G_VARIANT_TYPE("(s)"),
+				(GDBusCallFlags)G_DBUS_SEND_MESSAGE_FLAGS_NONE, -1, NULL, &error);
+			if(resp) {
+				const char *stats;
+				g_variant_get(resp, "(&s)", &stats);
+				printf("%s", stats);
+			}
+			break;
 		default:
 			break;
 	}
@@ -300,23 +334,26 @@ static int get_backend_id(const char* uri, const char* backend_name, BackendFlag
 	return ret;
 }
 
-static char* remove_scheme(const char* uri)
+/* Only line identifiers the backend, or the default backend, accepts are interned,
+ * the interned strings are never freed */
+static const char* remove_scheme(const char* uri, int backend_id)
 {
-	gchar** split = g_strsplit(uri, ":", 2);
-	char* ret = NULL;
-	if(split[1] != NULL) {
-		if(split[1][0] == '/' && split[1][1] == '/') {
-			ret = g_strdup((split[1])+2);
-		}
-		else {
-			ret = g_strdup(split[1]);
-		}
+	const char* ret = strchr(uri, ':');
+	ret = ret ? ret + 1 : uri;
+	if(ret[0] == '/' && ret[1] == '/')
+		ret += 2;
+
+	if(backend_id < 0) {
+		CommBackend *backend = sphone_comm_default_backend();
+		backend_id = backend ? backend->id : -1;
 	}
-	else {
-		ret = g_strdup(uri);
+
+	if(!sphone_comm_valid_string(backend_id, ret)) {
+		sphone_log(LL_WARN, "%s is not a valid line identifier", uri);
+		return NULL;
 	}
-	g_strfreev(split);
-	return ret;
+
+	return sphone_intern(ret);
 }
 
 static void method_call_callback(GDBusConnection* connection,
@@ -336,34 +373,38 @@ static void method_call_callback(GDBusConnection* connection,
 	(void)invocation;
 	(void)user_data;
 
+	GVariant *ret = NULL;
+
 	sphone_log(LL_DEBUG, "got dbus call to %s with %s parameters",
 			   method_name, g_variant_get_type_string(parameters));
 
 	if(g_strcmp0(method_name, "OpenDialer") == 0) {
 		CallProperties *call = NULL;
 		if(g_strcmp0(g_variant_get_type_string(parameters), "(ss)") == 0) {
-			call = g_malloc0(sizeof(*call));
-			char *backend_name;
-			char *line_identifier;
-			g_variant_get(parameters, "(ss)", &line_identifier, &backend_name);
+			call = call_properties_new();
+			const char *backend_name;
+			const char *line_identifier;
+			g_variant_get(parameters, "(&s&s)", &line_identifier, &backend_name);
 			call->backend = get_backend_id(line_identifier, backend_name, BACKEND_FLAG_CALL);
-			call->line_identifier = remove_scheme(line_identifier);
+			call->line_identifier = remove_scheme(line_identifier, call->backend);
 		}
 		gui_dialer_show(call);
-		g_free(call);
+		call_properties_unref(call);
 	}
 	else if(g_strcmp0(method_name, "OpenSendMessage") == 0) {
 		MessageProperties *message = NULL;
 		if(g_strcmp0(g_variant_get_type_string(parameters), "(sss)") == 0) {
-			message = g_malloc0(sizeof(*message));
-			char *backend_name;
-			char *line_identifier;
-			g_variant_get(parameters, "(sss)", &line_identifier, &message->text, &backend_name);
+			message = message_properties_new();
+			const char *backend_name;
+			const char *line_identifier;
+			const char *text;
+			g_variant_get(parameters, "(&s&s&s)", &line_identifier, &text, &backend_name);
+			message->text = g_ref_string_new(text);
 			message->backend = get_backend_id(line_identifier, backend_name, BACKEND_FLAG_MESSAGE);
-			message->line_identifier = remove_scheme(line_identifier);
+			message->line_identifier = remove_scheme(line_identifier, message->backend);
 		}
 		gui_sms_send_show(message);
-		g_free(message);
+		message_properties_unref(message);
 	}
 	else if(g_strcmp0(method_name, "OpenOptions") == 0)
 		gui_options_open();
@@ -391,9 +432,14 @@ static void method_call_callback(GDBusConnection* connection,
 			sphone_log(LL_WARN, "%s called with invalid parameters", method_name);
 		}
 	}
+	else if(g_strcmp0(method_name, "DumpStats") == 0) {
+		char *stats = dump_stats();
+		ret = g_variant_new("(s)", stats);
+		g_free(stats);
+	}
 	else
 		sphone_log(LL_WARN, "Unkown dbus method %s called", method_name);
-	g_dbus_method_invocation_return_value(invocation, NULL);
+	g_dbus_method_invocation_return_value(invocation, ret);
 }
   
 static void on_bus_acquired(GDBusConnection *connection, const gchar *name, gpointer user_data)
@@ -580,6 +626,9 @@ static int sphone_main(struct sphone_options options, int argc, char *argv[])
 
 	load_loop_module(&loop_module);
 	main_loop_init(argc, argv);
+	sphone_phone_number_init();
+	sphone_contacts_init();
+	sphone_calls_init();
 
 	dbus_introspection_data = g_dbus_node_info_new_for_xml(dbus_introspection_xml, NULL);
 	if(!dbus_introspection_data) {
@@ -605,6 +654,9 @@ static int sphone_main(struct sphone_options options, int argc, char *argv[])
 	append_filter_to_datapipe(&comm_backend_removed_pipe, drop, NULL);
 	sphone_modules_exit();
 	remove_filter_from_datapipe(&comm_backend_removed_pipe, drop, NULL);
+	sphone_calls_exit();
+	sphone_contacts_exit();
+	sphone_phone_number_exit();
 	datapipes_exit();
 
 	g_bus_unown_name(owner_id);
@@ -681,7 +733,7 @@ int main(int argc, char *argv[])
 				      "   -n [number]\topen with number\n"
 				      "   -s  do not self superivse\n"
 				      "   -y  log to syslog\n"
-				      "   -c [cmd]\tExecute command. Accepted commands are: dialer-open, history-calls, sms-new, history-sms, options, insmod, rmmod\n"
+				      "   -c [cmd]\tExecute command. Accepted commands are: dialer-open, history-calls, sms-new, history-sms, options, insmod, rmmod, dump-stats\n"
 				      , argv[0]);
 				return 0;
 			case 'c':
@@ -699,6 +751,8 @@ int main(int argc, char *argv[])
 					options.command = SPHONE_CMD_INSMOD;
 				else if(!g_strcmp0(optarg, "rmmod"))
 					options.command = SPHONE_CMD_RMMOD;
+				else if(!g_strcmp0(optarg, "dump-stats"))
+					options.command = SPHONE_CMD_DUMP_STATS;
 				break;
 				break;
 			case 's':
@@ -0,0 +1,307 @@
+/*
+ * calls.c
+ * Copyright (C) Carl Philipp Klemm 2021 <carl@uvos.xyz>
+ *
+ * calls.c is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * calls.c is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <time.h>
+#include <glib.h>
+#include "calls.h"
+#include "comm.h"
+#include "phonenumber.h"
+#include "datapipe.h"
+#include "datapipes.h"
+#include "sphone-log.h"
+
+// Live calls in the order they were added, the array owns one reference
+static GPtrArray *calls;
+// The indices use the calls themselves as keys
+static GHashTable *calls_by_data;
+static GHashTable *calls_by_line;
+
+static guint call_data_hash(gconstpointer key)
+{
+	const CallProperties *call = key;
+	return g_str_hash(call->backend_data) ^ (guint)call->backend;
+}
+
+static gboolean call_data_equal(gconstpointer a, gconstpointer b)
+{
+	const CallProperties *call_a = a;
+	const CallProperties *call_b = b;
+	return call_a->backend == call_b->backend && g_strcmp0(call_a->backend_data, call_b->backend_data) == 0;
+}
+
+static guint call_line_hash(gconstpointer key)
+{
+	return call_properties_hash(key);
+}
+
+static gboolean call_line_equal(gconstpointer a, gconstpointer b)
+{
+	return call_properties_comp(a, b);
+}
+
+static void calls_index(CallProperties *call)
+{
+	if(call->backend_data)
+		g_hash_table_replace(calls_by_data, call, call);
+	if(call->line_identifier)
+		g_hash_table_replace(calls_by_line, call, call);
+}
+
+static void calls_unindex(CallProperties *call)
+{
+	if(call->backend_data && g_hash_table_lookup(calls_by_data, call) == call)
+		g_hash_table_remove(calls_by_data, call);
+	if(call->line_identifier && g_hash_table_lookup(calls_by_line, call) == call)
+		g_hash_table_remove(calls_by_line, call);
+}
+
+static CallProperties *calls_lookup(const CallProperties *call)
+{
+	if(!calls)
+		return NULL;
+	if(call->backend_data)
+		return g_hash_table_lookup(calls_by_data, call);
+	if(call->line_identifier)
+		return g_hash_table_lookup(calls_by_line, call);
+	return NULL;
+}
+
+static void calls_remove(CallProperties *call)
+{
+	calls_unindex(call);
+	g_ptr_array_remove(calls, call);
+}
+
+static void calls_emit(datapipe_struct *pipe, CallProperties *call)
+{
+	call_properties_ref(call);
+	execute_datapipe(pipe, call);
+	if(call->state == SPHONE_CALL_DISCONNECTED)
+		calls_remove(call);
+	call_properties_unref(call);
+}
+
+static bool calls_contact_equal(const Contact *a, const Contact *b)
+{
+	return contact_cmp(a, b) && (!a || g_strcmp0(a->name, b->name) == 0);
+}
+
+static unsigned int calls_apply(CallProperties *live, const CallProperties *call)
+{
+	unsigned int changes = 0;
+
+	if(live->state != call->state) {
+		live->state = call->state;
+		changes |= SPHONE_CALL_CHANGED_STATE;
+	}
+
+	if(live->line_identifier != call->line_identifier) {
+		calls_unindex(live);
+		live->line_identifier = call->line_identifier;
+		live->line_key = sphone_phone_number_key(call->line_identifier);
+		calls_index(live);
+		changes |= SPHONE_CALL_CHANGED_LINE_IDENTIFIER;
+	}
+
+	// Backends usually do not know the contact, keep the one filled in by the filters
+	if(call->contact && !calls_contact_equal(live->contact, call->contact)) {
+		contact_unref(live->contact);
+		live->contact = contact_copy(call->contact);
+		changes |= SPHONE_CALL_CHANGED_CONTACT;
+	}
+
+	if(live->start_time != call->start_time || live->end_time != call->end_time) {
+		live->start_time = call->start_time;
+		live->end_time = call->end_time;
+		changes |= SPHONE_CALL_CHANGED_TIME;
+	}
+
+	if(live->answered != call->answered) {
+		live->answered = call->answered;
+		changes |= SPHONE_CALL_CHANGED_ANSWERED;
+	}
+
+	if(live->needs_route != call->needs_route) {
+		live->needs_route = call->needs_route;
+		changes |= SPHONE_CALL_CHANGED_NEEDS_ROUTE;
+	}
+
+	if(live->emergency != call->emergency || live->outbound != call->outbound) {
+		live->emergency = call->emergency;
+		live->outbound = call->outbound;
+		changes |= SPHONE_CALL_CHANGED_FLAGS;
+	}
+
+	return changes;
+}
+
+/**
+ * Register a new call and emit it on call_new_pipe
+ *
+ * @param call The call, it is copied
+ * @return false if the call was already registered, it is updated instead
+ */
+bool sphone_calls_add(const CallProperties *call)
+{
+	g_return_val_if_fail(calls, false);
+
+	// A call without either can never be found again to update or remove it
+	if(!call->backend_data && !call->line_identifier) {
+		sphone_log(LL_WARN, "%s: call of backend %d has neither backend data nor a line identifier",
+				   __func__, call->backend);
+		return false;
+	}
+
+	if(calls_lookup(call)) {
+		sphone_log(LL_WARN, "%s: call %s of backend %d is already registered",
+				   __func__, call->line_identifier, call->backend);
+		sphone_calls_update(call);
+		return false;
+	}
+
+	CallProperties *live = call_properties_copy(call);
+	live->changes = 0;
+	calls_index(live);
+	g_ptr_array_add(calls, live);
+	sphone_comm_call_state_changed(live);
+	calls_emit(&call_new_pipe, live);
+	return true;
+}
+
+static void calls_update_live(CallProperties *live, const CallProperties *call)
+{
+	live->changes = calls_apply(live, call);
+	if(live->changes & SPHONE_CALL_CHANGED_STATE)
+		sphone_comm_call_state_changed(live);
+	if(live->changes)
+		calls_emit(&call_properties_changed_pipe, live);
+}
+
+/**
+ * Update a registered call from a snapshot of the backend
+ *
+ * Emits call_properties_changed_pipe if any field changed, a contact of NULL is ignored.
+ * The snapshot may be a shallow copy of the registered call.
+ *
+ * @param call The new properties of the call
+ * @return false if the call is not registered
+ */
+bool sphone_calls_update(const CallProperties *call)
+{
+	CallProperties *live = calls_lookup(call);
+	if(!live) {
+		sphone_log(LL_WARN, "%s: call %s of backend %d is not registered",
+				   __func__, call->line_identifier, call->backend);
+		return false;
+	}
+
+	calls_update_live(live, call);
+	return true;
+}
+
+const CallProperties *sphone_calls_find(int backend, const char *backend_data)
+{
+	CallProperties key = {.backend = backend, .backend_data = (char*)backend_data};
+	return backend_data ? calls_lookup(&key) : NULL;
+}
+
+const CallProperties *sphone_calls_find_line(int backend, const char *line_identifier)
+{
+	CallProperties key = {.backend = backend, .line_key = sphone_phone_number_key(line_identifier)};
+	return calls && key.line_key ? g_hash_table_lookup(calls_by_line, &key) : NULL;
+}
+
+/**
+ * Find the registered call a snapshot, e.g. the data of a call datapipe, belongs to
+ */
+const CallProperties *sphone_calls_find_call(const CallProperties *call)
+{
+	return calls_lookup(call);
+}
+
+/**
+ * Call func for every registered call, func must not add or update calls
+ */
+void sphone_calls_foreach(void (*func)(const CallProperties *call, void *user_data), void *user_data)
+{
+	if(!calls)
+		return;
+	for(guint i = 0; i < calls->len; ++i)
+		func(g_ptr_array_index(calls, i), user_data);
+}
+
+unsigned int sphone_calls_count(void)
+{
+	return calls ? calls->len : 0;
+}
+
+static CallProperties *calls_first_of_backend(int backend)
+{
+	for(guint i = 0; i < calls->len; ++i) {
+		CallProperties *call = g_ptr_array_index(calls, i);
+		if(call->backend == backend)
+			return call;
+	}
+	return NULL;
+}
+
+/**
+ * Disconnect all calls of a backend that is going away
+ */
+void sphone_calls_remove_backend(int backend)
+{
+	if(!calls)
+		return;
+
+	CallProperties *call;
+	while((call = calls_first_of_backend(backend))) {
+		sphone_log(LL_DEBUG, "%s: disconnecting call %s", __func__, call->line_identifier);
+		CallProperties update = *call;
+		update.state = SPHONE_CALL_DISCONNECTED;
+		update.end_time = time(NULL);
+		// Update the call itself, a lookup could find another call of the same line
+		call_properties_ref(call);
+		calls_update_live(call, &update);
+		// A call that was already disconnected is not emitted and has to be removed here
+		if(g_ptr_array_find(calls, call, NULL))
+			calls_remove(call);
+		call_properties_unref(call);
+	}
+}
+
+void sphone_calls_init(void)
+{
+	calls = g_ptr_array_new_with_free_func((GDestroyNotify)call_properties_unref);
+	calls_by_data = g_hash_table_new(call_data_hash, call_data_equal);
+	calls_by_line = g_hash_table_new(call_line_hash, call_line_equal);
+}
+
+void sphone_calls_exit(void)
+{
+	if(!calls)
+		return;
+
+	if(calls->len > 0)
+		sphone_log(LL_WARN, "%s: %u calls still registered", __func__, calls->len);
+
+	g_hash_table_destroy(calls_by_data);
+	g_hash_table_destroy(calls_by_line);
+	g_ptr_array_unref(calls);
+	calls_by_data = NULL;
+	calls_by_line = NULL;
+	calls = NULL;
+}
@@ -17,15 +17,92 @@
  */
 #include "comm.h"
 #include "datapipes.h"
+#include "calls.h"
+#include "contacts.h"
 #include "sphone-log.h"
 #include "types.h"
+#include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 
+/*
+ * The registered backends in registration order, indexed by id in backends_by_id
+ * and by name, uid and scheme. Removed backends leave a NULL slot in backends_by_id,
+ * their id is kept for their uid in retired_ids and is only handed out again when a
+ * backend with the same uid registers, so stale ids held by calls, messages or the
+ * history never resolve to an unrelated backend.
+ */
 static GSList *backends;
+static GPtrArray *backends_by_id;
+static GHashTable *backends_by_name;
+static GHashTable *backends_by_uid;
+// Interned schemes to a GSList of the backends supporting them in registration order
+static GHashTable *backends_by_scheme;
+// Interned uids of removed backends to their id
+static GHashTable *retired_ids;
 
 static CommBackend *default_backend;
 
+static void sphone_comm_init_indexes(void)
+{
+	if(backends_by_id)
+		return;
+	backends_by_id = g_ptr_array_new();
+	backends_by_name = g_hash_table_new(g_str_hash, g_str_equal);
+	backends_by_uid = g_hash_table_new(g_direct_hash, g_direct_equal);
+	backends_by_scheme = g_hash_table_new(g_direct_hash, g_direct_equal);
+	retired_ids = g_hash_table_new(g_direct_hash, g_direct_equal);
+}
+
+static int sphone_comm_allocate_id(const char *uid)
+{
+	gpointer id;
+	if(uid && g_hash_table_lookup_extended(retired_ids, uid, NULL, &id)) {
+		g_hash_table_remove(retired_ids, uid);
+		return GPOINTER_TO_INT(id);
+	}
+
+	g_ptr_array_add(backends_by_id, NULL);
+	return backends_by_id->len-1;
+}
+
+static void sphone_comm_index_backend(CommBackend *backend)
+{
+	g_ptr_array_index(backends_by_id, backend->id) = backend;
+	if(backend->name)
+		g_hash_table_insert(backends_by_name, backend->name, backend);
+	if(backend->uid)
+		g_hash_table_insert(backends_by_uid, (gpointer)backend->uid, backend);
+
+	for(size_t i = 0; backend->schemes[i]; ++i) {
+		const char *scheme = sphone_intern(backend->schemes[i]->scheme);
+		GSList *list = g_hash_table_lookup(backends_by_scheme, scheme);
+		if(!g_slist_find(list, backend))
+			g_hash_table_insert(backends_by_scheme, (gpointer)scheme, g_slist_append(list, backend));
+	}
+}
+
+static void sphone_comm_unindex_backend(CommBackend *backend)
+{
+	for(size_t i = 0; backend->schemes[i]; ++i) {
+		const char *scheme = sphone_intern(backend->schemes[i]->scheme);
+		GSList *list = g_hash_table_lookup(backends_by_scheme, scheme);
+		list = g_slist_remove(list, backend);
+		if(list)
+			g_hash_table_insert(backends_by_scheme, (gpointer)scheme, list);
+		else
+			g_hash_table_remove(backends_by_scheme, scheme);
+	}
+
+	if(backend->uid) {
+		g_hash_table_remove(backends_by_uid, backend->uid);
+		g_hash_table_insert(retired_ids, (gpointer)backend->uid, GINT_TO_POINTER(backend->id));
+	}
+	if(backend->name)
+		g_hash_table_remove(backends_by_name, backend->name);
+	g_ptr_array_index(backends_by_id, backend->id) = NULL;
+}
+
 static Scheme *sphone_comm_copy_scheme(const Scheme* scheme)
 {
 	Scheme* copy = g_malloc0(sizeof(*copy));
@@ -60,6 +137,48 @@ static bool sphone_comm_any_ch(uint32_t codepoint)
 	return true;
 }
 
+static bool sphone_comm_ranges_contain(const CodepointRange *ranges, size_t count, uint32_t codepoint)
+{
+	size_t low = 0;
+	size_t high = count;
+	while(low < high) {
+		size_t mid = low + (high - low)/2;
+		if(codepoint < ranges[mid].first)
+			high = mid;
+		else if(codepoint > ranges[mid].last)
+			low = mid + 1;
+		else
+			return true;
+	}
+	return false;
+}
+
+static inline bool sphone_comm_ascii_valid(const CommBackend *backend, unsigned char ch)
+{
+	return backend->valid_ascii[ch >> 6] & (UINT64_C(1) << (ch & 63));
+}
+
+static bool sphone_comm_codepoint_valid(const CommBackend *backend, uint32_t codepoint)
+{
+	if(codepoint < 128)
+		return sphone_comm_ascii_valid(backend, codepoint);
+	if(backend->valid_ranges)
+		return sphone_comm_ranges_contain(backend->valid_ranges, backend->n_valid_ranges, codepoint);
+	return backend->is_valid_ch(codepoint);
+}
+
+static void sphone_comm_fill_valid_ascii(CommBackend *backend)
+{
+	backend->valid_ascii[0] = 0;
+	backend->valid_ascii[1] = 0;
+	for(uint32_t ch = 1; ch < 128; ++ch) {
+		bool valid = backend->valid_ranges ?
+			sphone_comm_ranges_contain(backend->valid_ranges, backend->n_valid_ranges, ch) : backend->is_valid_ch(ch);
+		if(valid)
+			backend->valid_ascii[ch >> 6] |= UINT64_C(1) << (ch & 63);
+	}
+}
+
 static void sphone_comm_free_scheme_array(Scheme** schemes)
 {
 	for(size_t i = 0; schemes[i]; ++i)
@@ -99,22 +218,19 @@ int sphone_comm_add_backend(const char* name, const char* uid, const Scheme** sc
 		return -1;
 	}
 
-	CommBackend *backend = g_malloc0(sizeof(*backend));
-	int id = 0;
-	if(backends != NULL) {
-		GSList *element = g_slist_last(backends);
-		CommBackend *last_backend = (CommBackend*)element->data;
-		id = last_backend->id+1;
-	}
+	sphone_comm_init_indexes();
 
-	backend->id = id;
+	CommBackend *backend = g_malloc0(sizeof(*backend));
+	backend->uid = sphone_intern(uid);
+	backend->id = sphone_comm_allocate_id(backend->uid);
 	backend->name = g_strdup(name);
-	backend->uid = g_strdup(uid);
 	backend->flags = flags;
 	backend->schemes = sphone_comm_copy_scheme_array(schemes);
 	backend->applicable_fields = sphone_comm_copy_field_array(fields);
 	backend->is_valid_ch = is_valid_ch ?: &sphone_comm_any_ch;
-	
+	sphone_comm_fill_valid_ascii(backend);
+	sphone_comm_index_backend(backend);
+
 	sphone_log(LL_INFO, "Comm backend added: %s", backend->name);
 
 	backends = g_slist_append(backends, backend);
@@ -122,39 +238,116 @@ int sphone_comm_add_backend(const char* name, const char* uid, const Scheme** sc
 
 	execute_datapipe(&comm_backend_added_pipe, backend);
 
-	return id;
+	return backend->id;
 }
 
 void sphone_comm_remove_backend(int id)
 {
-	GSList *element;
-	for(element = backends; element; element = element->next) {
-		CommBackend *last_backend = (CommBackend*)element->data;
-		if(last_backend->id == id)
-			break;
-	}
-	if (!element)
+	CommBackend *backend = sphone_comm_get_backend(id);
+	if(!backend) {
 		sphone_log(LL_WARN, "Trying to remove non-existing comm backend with id %d", id);
+		return;
+	}
 
-	if(default_backend && default_backend->id == id)
+	if(default_backend == backend)
 		default_backend = NULL;
 
-	CommBackend* backend = (CommBackend*)(element->data);
-
+	// The backend stays registered until everyone was told it is going away
+	sphone_calls_remove_backend(id);
+	sphone_contacts_remove_backend(id);
 	execute_datapipe(&comm_backend_removed_pipe, backend);
 
+	sphone_comm_unindex_backend(backend);
+	backends = g_slist_remove(backends, backend);
+
 	g_free(backend->name);
 	sphone_comm_free_scheme_array(backend->schemes);
-	g_free(element->data);
 	g_free(backend->applicable_fields);
+	g_free(backend->valid_ranges);
+	g_free(backend);
+}
+
+/* name, uid, flags, schemes, applicable fields and id */
+#define COMM_BACKEND_VARIANT_TYPE "(ssua(su)aii)"
+
+GVariant *sphone_comm_backend_to_variant(const CommBackend *backend)
+{
+	GVariantBuilder schemes;
+	GVariantBuilder fields;
+
+	g_variant_builder_init(&schemes, G_VARIANT_TYPE("a(su)"));
+	for(size_t i = 0; backend->schemes[i]; ++i)
+		g_variant_builder_add(&schemes, "(su)", backend->schemes[i]->scheme, (guint32)backend->schemes[i]->flags);
+
+	g_variant_builder_init(&fields, G_VARIANT_TYPE("ai"));
+	for(const sphone_contact_field_t *field = backend->applicable_fields; *field != SPHONE_FIELD_INVALID; ++field)
+		g_variant_builder_add(&fields, "i", (gint32)*field);
+
+	return g_variant_new(COMM_BACKEND_VARIANT_TYPE, backend->name, backend->uid ?: "",
+						 (guint32)backend->flags, &schemes, &fields, (gint32)backend->id);
+}
+
+/**
+ * Register a backend described by a variant created with sphone_comm_backend_to_variant
+ * The backend accepts any character
+ *
+ * @param variant The serialized backend
+ * @param id Set to the id the backend had when it was serialized, may be NULL
+ * @return The id of the new backend or -1 on error
+ */
+int sphone_comm_add_backend_from_variant(GVariant *variant, int *id)
+{
+	if(!g_variant_is_of_type(variant, G_VARIANT_TYPE(COMM_BACKEND_VARIANT_TYPE)))
+		return -1;
+
+	const char *name;
+	const char *uid;
+	guint32 flags;
+	GVariantIter *scheme_iter;
+	GVariantIter *field_iter;
+	gint32 old_id;
+	g_variant_get(variant, "(&s&sua(su)aii)", &name, &uid, &flags, &scheme_iter, &field_iter, &old_id);
+
+	gsize n_schemes = g_variant_iter_n_children(scheme_iter);
+	Scheme *scheme_storage = g_malloc0(sizeof(*scheme_storage)*(n_schemes+1));
+	const Scheme **schemes = g_malloc0(sizeof(*schemes)*(n_schemes+1));
+	for(gsize i = 0; i < n_schemes; ++i) {
+		guint32 scheme_flags;
+		g_variant_iter_next(scheme_iter, "(&su)", &scheme_storage[i].scheme, &scheme_flags);
+		scheme_storage[i].flags = scheme_flags;
+		schemes[i] = &scheme_storage[i];
+	}
+
+	gsize n_fields = g_variant_iter_n_children(field_iter);
+	sphone_contact_field_t *fields = g_malloc0(sizeof(*fields)*(n_fields+1));
+	for(gsize i = 0; i < n_fields; ++i) {
+		gint32 field;
+		g_variant_iter_next(field_iter, "i", &field);
+		fields[i] = field;
+	}
+	fields[n_fields] = SPHONE_FIELD_INVALID;
+
+	int new_id = sphone_comm_add_backend(name, uid, schemes, flags, fields, NULL);
+
+	g_free(fields);
+	g_free(schemes);
+	g_free(scheme_storage);
+	g_variant_iter_free(scheme_iter);
+	g_variant_iter_free(field_iter);
 
-	backends = g_slist_remove(backends, element->data);
+	if(id)
+		*id = old_id;
+	return new_id;
 }
 
 CommBackend *sphone_comm_get_backend_for_scheme(const char* scheme, BackendFlag requiredFlags)
 {
-	GSList *element;
-	for(element = backends; element; element = element->next) {
+	// Schemes of backends are interned, a string that was never interned belongs to no backend
+	scheme = sphone_intern_lookup(scheme);
+	if(!scheme || !backends_by_scheme)
+		return NULL;
+
+	for(GSList *element = g_hash_table_lookup(backends_by_scheme, scheme); element; element = element->next) {
 		CommBackend *backend = (CommBackend*)element->data;
 		for(size_t i = 0; backend->schemes[i]; ++i) {
 			if((requiredFlags & ~backend->schemes[i]->flags) == 0 && g_str_equal(backend->schemes[i]->scheme, scheme))
@@ -176,101 +369,368 @@ CommBackend *sphone_comm_default_backend(void)
 
 CommBackend *sphone_comm_get_backend(int id)
 {
-	GSList *element;
-	for(element = backends; element; element = element->next) {
-		CommBackend *last_backend = (CommBackend*)element->data;
-		if(last_backend->id == id)
-			return element->data;
-	}
-	return NULL;
+	if(!backends_by_id || id < 0 || (guint)id >= backends_by_id->len)
+		return NULL;
+	return g_ptr_array_index(backends_by_id, id);
 }
 
 bool sphone_comm_set_default_backend(int id)
 {
-	GSList *element;
-	for(element = backends; element; element = element->next) {
-		CommBackend *last_backend = (CommBackend*)element->data;
-		if(last_backend->id == id) {
-			default_backend = last_backend;
-			break;
-		}
-	}
-	return (bool)element;
+	CommBackend *backend = sphone_comm_get_backend(id);
+	if(backend)
+		default_backend = backend;
+	return backend;
 }
 
 int sphone_comm_find_backend_id(const char* name)
 {
-	GSList *element;
-	for(element = backends; element; element = element->next) {
-		CommBackend *last_backend = (CommBackend*)element->data;
-		if(g_strcmp0(last_backend->name, name) == 0)
-			return last_backend->id;
-	}
-	return -1;
+	CommBackend *backend = name && backends_by_name ? g_hash_table_lookup(backends_by_name, name) : NULL;
+	return backend ? backend->id : -1;
 }
 
 int sphone_comm_find_backend_id_from_uid(const char* uid)
 {
-	GSList *element;
-	for(element = backends; element; element = element->next) {
-		CommBackend *last_backend = (CommBackend*)element->data;
-		if(g_strcmp0(last_backend->uid, uid) == 0)
-			return last_backend->id;
+	// uids of backends are interned, a string that was never interned belongs to no backend
+	uid = sphone_intern_lookup(uid);
+	if(!uid || !backends_by_uid)
+		return -1;
+
+	CommBackend *backend = g_hash_table_lookup(backends_by_uid, uid);
+	return backend ? backend->id : -1;
+}
+
+static int sphone_comm_compare_ranges(const void *a, const void *b)
+{
+	const CodepointRange *range_a = a;
+	const CodepointRange *range_b = b;
+	if(range_a->first != range_b->first)
+		return range_a->first < range_b->first ? -1 : 1;
+	return 0;
+}
+
+/**
+ * Set the codepoints a backend accepts in line identifiers as a table of ranges,
+ * used instead of the is_valid_ch function of the backend
+ *
+ * @param id The id of the backend
+ * @param ranges The ranges, in any order, they may overlap
+ * @param count The number of ranges
+ * @return true on success
+ */
+bool sphone_comm_set_valid_ranges(int id, const CodepointRange *ranges, size_t count)
+{
+	CommBackend *backend = sphone_comm_get_backend(id);
+	if(!backend)
+		return false;
+
+	CodepointRange *sorted = g_malloc(sizeof(*sorted)*MAX(count, 1));
+	size_t n_sorted = 0;
+	memcpy(sorted, ranges, sizeof(*sorted)*count);
+	qsort(sorted, count, sizeof(*sorted), sphone_comm_compare_ranges);
+	for(size_t i = 0; i < count; ++i) {
+		if(sorted[i].first > sorted[i].last)
+			continue;
+		if(n_sorted > 0 && (uint64_t)sorted[n_sorted-1].last + 1 >= sorted[i].first)
+			sorted[n_sorted-1].last = MAX(sorted[n_sorted-1].last, sorted[i].last);
+		else
+			sorted[n_sorted++] = sorted[i];
 	}
-	return -1;
+
+	g_free(backend->valid_ranges);
+	backend->valid_ranges = sorted;
+	backend->n_valid_ranges = n_sorted;
+	sphone_comm_fill_valid_ascii(backend);
+	return true;
+}
+
+#define COMM_WORD_HIGH_BITS UINT64_C(0x8080808080808080)
+
+/*
+ * Length of the leading run of valid ASCII characters of str,
+ * runs of 8 ASCII bytes are tested without branching on each byte
+ */
+static size_t sphone_comm_valid_ascii_run(const CommBackend *backend, const char *str, size_t length)
+{
+	size_t i = 0;
+	for(; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, str + i, sizeof(word));
+		if(word & COMM_WORD_HIGH_BITS)
+			break;
+
+		bool valid = true;
+		for(size_t j = 0; j < sizeof(word); ++j)
+			valid &= sphone_comm_ascii_valid(backend, str[i+j]);
+		if(!valid)
+			break;
+	}
+
+	while(i < length && !((unsigned char)str[i] & 0x80) && sphone_comm_ascii_valid(backend, str[i]))
+		++i;
+	return i;
 }
 
 bool sphone_comm_valid_string(int id, const char* str)
 {
-	GError *err = NULL;
-	glong cpoints;
 	CommBackend *backend = sphone_comm_get_backend(id);
-	uint32_t *unistring = g_utf8_to_ucs4(str, -1, NULL, &cpoints, &err);
+	size_t length = strlen(str);
+
+	if(!backend)
+		return false;
 
-	if(err) {
+	if(!g_utf8_validate(str, length, NULL)) {
 		sphone_log(LL_DEBUG, "user input contains an invalid unicode codepoint");
-		g_clear_error(&err);
 		return false;
 	}
 
-	bool ret = true;
-	for(ssize_t i = 0; i < cpoints && ret; ++i) {
-		if(!backend->is_valid_ch(unistring[i]))
-			ret = false;
+	const char *end = str + length;
+	for(const char *pos = str; pos < end; pos = g_utf8_next_char(pos)) {
+		pos += sphone_comm_valid_ascii_run(backend, pos, end - pos);
+		if(pos == end)
+			break;
+		if(!sphone_comm_codepoint_valid(backend, g_utf8_get_char(pos)))
+			return false;
 	}
 
-	g_free(unistring);
-
-	return ret;
+	return true;
 }
 
 char *sphone_comm_create_cleaned_string(int id, const char* str)
 {
-	GError *err = NULL;
-	glong cpoints;
 	CommBackend *backend = sphone_comm_get_backend(id);
-	uint32_t *unistring = g_utf8_to_ucs4(str, -1, NULL, &cpoints, &err);
-	uint32_t *resultunistring = g_malloc0(sizeof(*resultunistring)*cpoints+1);
+	size_t length = strlen(str);
 
-	if(err) {
+	if(!backend)
+		return NULL;
+
+	if(!g_utf8_validate(str, length, NULL)) {
 		sphone_log(LL_DEBUG, "user input contains an invalid unicode codepoint");
-		g_clear_error(&err);
 		return NULL;
 	}
 
-	ssize_t j = 0;
-	for(ssize_t i = 0; i < cpoints; ++i) {
-		if(backend->is_valid_ch(unistring[i])) {
-			resultunistring[j] = unistring[i];
-			++j;
+	char *result = g_malloc(length+1);
+	char *out = result;
+	const char *end = str + length;
+	const char *pos = str;
+	while(pos < end) {
+		size_t run = sphone_comm_valid_ascii_run(backend, pos, end - pos);
+		memcpy(out, pos, run);
+		out += run;
+		pos += run;
+		if(pos == end)
+			break;
+
+		const char *next = g_utf8_next_char(pos);
+		if(sphone_comm_codepoint_valid(backend, g_utf8_get_char(pos))) {
+			memcpy(out, pos, next - pos);
+			out += next - pos;
 		}
+		pos = next;
 	}
+	*out = '\0';
+
+	return result;
+}
 
-	g_free(unistring);
+// Backends in a degraded state after this many failed requests in a row
+#define COMM_DEGRADED_ERRORS 3
 
-	char *result = g_ucs4_to_utf8(resultunistring, -1, NULL, NULL, NULL);
+static const char *const operation_names[COMM_OP_COUNT] = {
+	[COMM_OP_DIAL] = "dial",
+	[COMM_OP_ANSWER] = "answer",
+	[COMM_OP_HANGUP] = "hangup",
+	[COMM_OP_SEND_MESSAGE] = "send message",
+};
 
-	g_free(resultunistring);
+const char *sphone_comm_availability_string(CommAvailability availability)
+{
+	switch(availability) {
+		case COMM_AVAILABILITY_AVAILABLE:
+			return "Available";
+		case COMM_AVAILABILITY_DEGRADED:
+			return "Degraded";
+		case COMM_AVAILABILITY_UNAVAILABLE:
+			return "Unavailable";
+		case COMM_AVAILABILITY_UNKNOWN:
+		default:
+			return "Unknown";
+	}
+}
 
-	return result;
+static void sphone_comm_latency_add(CommLatency *latency, gint64 start)
+{
+	guint64 elapsed = MAX(g_get_monotonic_time() - start, 0);
+	++latency->count;
+	latency->total_us += elapsed;
+	if(elapsed > latency->max_us)
+		latency->max_us = elapsed;
+}
+
+static void sphone_comm_update_availability(CommBackend *backend, CommAvailability availability)
+{
+	if(backend->stats.availability == availability)
+		return;
+
+	sphone_log(LL_INFO, "Comm backend %s is now %s", backend->name, sphone_comm_availability_string(availability));
+	backend->stats.availability = availability;
+	backend->stats.availability_since = g_get_monotonic_time();
+	execute_datapipe(&comm_backend_changed_pipe, backend);
+}
+
+/**
+ * Note that a request reached a backend
+ *
+ * @param id The id of the backend
+ * @param operation The requested operation
+ * @return The start time of the request, pass it to sphone_comm_operation_reply()
+ */
+gint64 sphone_comm_operation_begin(int id, CommOperation operation)
+{
+	gint64 start = g_get_monotonic_time();
+	CommBackend *backend = sphone_comm_get_backend(id);
+	g_return_val_if_fail(operation < COMM_OP_COUNT, start);
+	if(!backend)
+		return start;
+
+	CommOperationStats *stats = &backend->stats.operations[operation];
+	++stats->requests;
+	if(!stats->pending_since)
+		stats->pending_since = start;
+	return start;
+}
+
+/**
+ * Note that the service of a backend acknowledged or refused a request
+ *
+ * Messages have no state to wait for, a successful reply completes them.
+ *
+ * @param id The id of the backend
+ * @param operation The requested operation
+ * @param start The time returned by sphone_comm_operation_begin()
+ * @param success false if the request failed
+ */
+void sphone_comm_operation_reply(int id, CommOperation operation, gint64 start, bool success)
+{
+	CommBackend *backend = sphone_comm_get_backend(id);
+	g_return_if_fail(operation < COMM_OP_COUNT);
+	if(!backend)
+		return;
+
+	CommOperationStats *stats = &backend->stats.operations[operation];
+	sphone_comm_latency_add(&stats->reply, start);
+
+	if(!success) {
+		++stats->errors;
+		stats->pending_since = 0;
+		if(++backend->stats.consecutive_errors >= COMM_DEGRADED_ERRORS &&
+			backend->stats.availability != COMM_AVAILABILITY_UNAVAILABLE)
+			sphone_comm_update_availability(backend, COMM_AVAILABILITY_DEGRADED);
+		return;
+	}
+
+	backend->stats.consecutive_errors = 0;
+	if(backend->stats.availability == COMM_AVAILABILITY_DEGRADED)
+		sphone_comm_update_availability(backend, COMM_AVAILABILITY_AVAILABLE);
+
+	if(operation == COMM_OP_SEND_MESSAGE && stats->pending_since) {
+		sphone_comm_latency_add(&stats->complete, stats->pending_since);
+		stats->pending_since = 0;
+	}
+}
+
+static void sphone_comm_operation_complete(CommBackend *backend, CommOperation operation)
+{
+	CommOperationStats *stats = &backend->stats.operations[operation];
+	if(!stats->pending_since)
+		return;
+	sphone_comm_latency_add(&stats->complete, stats->pending_since);
+	stats->pending_since = 0;
+}
+
+void sphone_comm_call_state_changed(const CallProperties *call)
+{
+	CommBackend *backend = sphone_comm_get_backend(call->backend);
+	if(!backend)
+		return;
+
+	switch(call->state) {
+		case SPHONE_CALL_ALERTING:
+			if(call->outbound)
+				sphone_comm_operation_complete(backend, COMM_OP_DIAL);
+			break;
+		case SPHONE_CALL_ACTIVE:
+			sphone_comm_operation_complete(backend, call->outbound ? COMM_OP_DIAL : COMM_OP_ANSWER);
+			break;
+		case SPHONE_CALL_DISCONNECTED:
+			sphone_comm_operation_complete(backend, COMM_OP_HANGUP);
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+ * Set the availability of a backend as seen by the backend, e.g. whether its modem is present
+ */
+void sphone_comm_set_availability(int id, CommAvailability availability)
+{
+	CommBackend *backend = sphone_comm_get_backend(id);
+	if(!backend) {
+		sphone_log(LL_WARN, "%s: no comm backend with id %d", __func__, id);
+		return;
+	}
+
+	backend->stats.consecutive_errors = 0;
+	sphone_comm_update_availability(backend, availability);
+}
+
+/**
+ * Check whether a backend should be offered to the user
+ */
+bool sphone_comm_backend_usable(const CommBackend *backend)
+{
+	return backend && backend->stats.availability != COMM_AVAILABILITY_UNAVAILABLE;
+}
+
+static void sphone_comm_dump_latency(GString *out, const char *name, const CommLatency *latency)
+{
+	if(!latency->count)
+		return;
+	g_string_append_printf(out, "\t\t%s: avg %lluus, max %lluus\n", name,
+						   (unsigned long long)(latency->total_us/latency->count), (unsigned long long)latency->max_us);
+}
+
+/**
+ * Dump the health and operation latencies of all backends
+ *
+ * @return A newly allocated string
+ */
+char *sphone_comm_dump_stats(void)
+{
+	GString *out = g_string_new(NULL);
+	gint64 now = g_get_monotonic_time();
+
+	for(GSList *element = backends; element; element = element->next) {
+		const CommBackend *backend = element->data;
+		const CommBackendStats *stats = &backend->stats;
+
+		g_string_append_printf(out, "comm backend %s (%s): %s", backend->name, backend->uid ?: "",
+							   sphone_comm_availability_string(stats->availability));
+		if(stats->availability_since)
+			g_string_append_printf(out, " for %llds", (long long)((now - stats->availability_since)/G_USEC_PER_SEC));
+		g_string_append_c(out, '\n');
+
+		for(int i = 0; i < COMM_OP_COUNT; ++i) {
+			const CommOperationStats *operation = &stats->operations[i];
+			if(!operation->requests)
+				continue;
+			g_string_append_printf(out, "\t%s: %llu requests, %llu errors%s\n", operation_names[i],
+								   (unsigned long long)operation->requests, (unsigned long long)operation->errors,
+								   operation->pending_since ? ", pending" : "");
+			sphone_comm_dump_latency(out, "reply", &operation->reply);
+			sphone_comm_dump_latency(out, "complete", &operation->complete);
+		}
+	}
+
+	return g_string_free(out, FALSE);
 }
@@ -0,0 +1,192 @@
+/*
+ * contacts.c
+ * Copyright (C) Carl Philipp Klemm 2021 <carl@uvos.xyz>
+ *
+ * contacts.c is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * contacts.c is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <glib.h>
+#include "contacts.h"
+#include "phonenumber.h"
+#include "datapipe.h"
+#include "datapipes.h"
+#include "sphone-log.h"
+
+#define CONTACTS_RESOLVE_BATCH 16
+
+// The registered contacts, used as their own keys, the table owns one reference
+static GHashTable *contacts;
+// Contacts waiting for contacts_resolve_idle(), the queue owns one reference
+static GQueue resolve_queue = G_QUEUE_INIT;
+static guint resolve_id;
+
+static guint contacts_hash(gconstpointer key)
+{
+	return contact_hash(key);
+}
+
+static gboolean contacts_equal(gconstpointer a, gconstpointer b)
+{
+	return contact_cmp(a, b);
+}
+
+static void contacts_resolve_contact(Contact *contact)
+{
+	// The filters fill in a private contact, the shared one keeps its name if none is found
+	Contact probe = {
+		.line_identifier = contact->line_identifier,
+		.line_key = contact->line_key,
+		.line_identifier_field = contact->line_identifier_field,
+		.backend = contact->backend,
+	};
+	execute_datapipe_filters(&contact_fill_pipe, &probe);
+	if(!probe.name || g_strcmp0(probe.name, contact->name) == 0) {
+		g_free(probe.name);
+		return;
+	}
+
+	sphone_log(LL_DEBUG, "%s: %s is %s", __func__, contact->line_identifier, probe.name);
+	g_free(contact->name);
+	contact->name = probe.name;
+}
+
+/**
+ * Get the shared contact of a line identifier
+ *
+ * @param backend The backend of the contact
+ * @param line_identifier The line identifier of the contact
+ * @param name The name to use if the contact can not be resolved, e.g. one stored in the history, may be NULL
+ * @return A new reference to the contact or NULL if line_identifier is NULL
+ */
+Contact *sphone_contacts_get(int backend, const char *line_identifier, const char *name)
+{
+	g_return_val_if_fail(contacts, NULL);
+	if(!line_identifier)
+		return NULL;
+
+	Contact key = {
+		.line_identifier = sphone_intern(line_identifier),
+		.line_key = sphone_phone_number_key(line_identifier),
+		.backend = backend,
+	};
+
+	Contact *contact = g_hash_table_lookup(contacts, &key);
+	if(!contact) {
+		contact = contact_new();
+		contact->line_identifier = key.line_identifier;
+		contact->line_key = key.line_key;
+		contact->backend = backend;
+		contacts_resolve_contact(contact);
+		contact->shared = true;
+		g_hash_table_add(contacts, contact);
+	}
+
+	if(!contact->name && name)
+		contact->name = g_strdup(name);
+
+	return contact_ref(contact);
+}
+
+/**
+ * Get the shared contact equal to contact, its name is used if it can not be resolved
+ */
+Contact *sphone_contacts_get_for(const Contact *contact)
+{
+	if(!contact)
+		return NULL;
+	if(contact->shared)
+		return contact_ref(contact);
+	return sphone_contacts_get(contact->backend, contact->line_identifier, contact->name);
+}
+
+static gboolean contacts_resolve_idle(gpointer user_data)
+{
+	(void)user_data;
+
+	for(unsigned int i = 0; i < CONTACTS_RESOLVE_BATCH && !g_queue_is_empty(&resolve_queue); ++i) {
+		Contact *contact = g_queue_pop_head(&resolve_queue);
+		contacts_resolve_contact(contact);
+		contact_unref(contact);
+	}
+
+	if(!g_queue_is_empty(&resolve_queue))
+		return G_SOURCE_CONTINUE;
+
+	resolve_id = 0;
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean contacts_is_unreferenced(gpointer key, gpointer value, gpointer user_data)
+{
+	(void)value;
+	(void)user_data;
+	Contact *contact = key;
+	return g_atomic_ref_count_compare(&contact->ref_count, 1);
+}
+
+/**
+ * Resolve the names of the registered contacts again, e.g. after the address book changed
+ *
+ * Contacts only the registry references are dropped, they are resolved when requested
+ * the next time. The others are resolved in batches from an idle source.
+ */
+void sphone_contacts_resolve(void)
+{
+	if(!contacts)
+		return;
+
+	g_queue_clear_full(&resolve_queue, (GDestroyNotify)contact_unref);
+	g_hash_table_foreach_remove(contacts, contacts_is_unreferenced, NULL);
+
+	GHashTableIter iter;
+	gpointer key;
+	g_hash_table_iter_init(&iter, contacts);
+	while(g_hash_table_iter_next(&iter, &key, NULL))
+		g_queue_push_tail(&resolve_queue, contact_ref(key));
+
+	if(!resolve_id && !g_queue_is_empty(&resolve_queue))
+		resolve_id = g_idle_add_full(G_PRIORITY_LOW, contacts_resolve_idle, NULL, NULL);
+}
+
+static gboolean contacts_is_of_backend(gpointer key, gpointer value, gpointer user_data)
+{
+	(void)value;
+	const Contact *contact = key;
+	return contact->backend == GPOINTER_TO_INT(user_data);
+}
+
+/**
+ * Forget the contacts of a backend that is going away, references held elsewhere stay valid
+ */
+void sphone_contacts_remove_backend(int backend)
+{
+	if(contacts)
+		g_hash_table_foreach_remove(contacts, contacts_is_of_backend, GINT_TO_POINTER(backend));
+}
+
+void sphone_contacts_init(void)
+{
+	contacts = g_hash_table_new_full(contacts_hash, contacts_equal, (GDestroyNotify)contact_unref, NULL);
+}
+
+void sphone_contacts_exit(void)
+{
+	if(!contacts)
+		return;
+	if(resolve_id)
+		g_source_remove(resolve_id);
+	resolve_id = 0;
+	g_queue_clear_full(&resolve_queue, (GDestroyNotify)contact_unref);
+	g_hash_table_destroy(contacts);
+	contacts = NULL;
+}
@@ -17,114 +17,1510 @@
  */
 #include <glib.h>
 #include <stdbool.h>
+#include <string.h>
 #include "datapipe.h"
 #include "sphone-log.h"
 
+struct thread_subscriber;
+
 struct callback {
 	void *callback;
 	void *data;
+	int priority;
+	datapipe_exec_t exec;
+	struct thread_subscriber *subscriber;
+};
+
+/*
+ * Callback arrays are never modified in place once published in a datapipe,
+ * with the exception of removal which clears the callback pointer of the entry
+ * so that a dispatch currently iterating over an old array skips it.
+ * Dispatch holds a reference to the array it iterates over, so filters and
+ * triggers may add or remove callbacks on the pipe they are called from.
+ * Replaced arrays that are still being iterated over are kept in the retired
+ * chain of the current array until the dispatch is done, so that removal can
+ * clear the entry in them too.
+ * Entries are sorted by descending priority, callbacks with equal priority
+ * are kept in the order they where added.
+ */
+struct callback_array {
+	int ref_count;
+	unsigned int length;
+	struct callback_array *retired;
+	struct callback callbacks[];
+};
+
+static struct callback_array *callback_array_new(unsigned int length)
+{
+	struct callback_array *array = g_malloc(sizeof(*array) + sizeof(struct callback)*length);
+	array->ref_count = 1;
+	array->length = length;
+	array->retired = NULL;
+	return array;
+}
+
+static struct callback_array *callback_array_ref(struct callback_array *array)
+{
+	if(array)
+		++array->ref_count;
+	return array;
+}
+
+static void callback_array_unref(struct callback_array *array)
+{
+	while(array && --array->ref_count == 0) {
+		struct callback_array *retired = array->retired;
+		g_free(array);
+		array = retired;
+	}
+}
+
+/* Publish new in place of the current array, retiring the current one if a dispatch still uses it */
+static void callback_array_replace(struct callback_array **array, struct callback_array *new)
+{
+	struct callback_array *old = *array;
+	struct callback_array *retired = NULL;
+
+	if(old) {
+		struct callback_array **link = &old->retired;
+		while(*link) {
+			struct callback_array *done = *link;
+			if(done->ref_count == 1) {
+				*link = done->retired;
+				done->retired = NULL;
+				callback_array_unref(done);
+			} else {
+				link = &done->retired;
+			}
+		}
+
+		if(old->ref_count > 1) {
+			/* the reference of the datapipe moves to the retired chain */
+			retired = old;
+		} else {
+			retired = old->retired;
+			old->retired = NULL;
+			callback_array_unref(old);
+		}
+	}
+
+	if(retired && !new)
+		new = callback_array_new(0);
+	if(new)
+		new->retired = retired;
+	*array = new;
+}
+
+static void callback_array_insert(struct callback_array **array, const struct callback *entry)
+{
+	struct callback_array *old = *array;
+	unsigned int length = old ? old->length : 0;
+	struct callback_array *new = callback_array_new(length+1);
+
+	unsigned int index = length;
+	while(index > 0 && old->callbacks[index-1].priority < entry->priority)
+		--index;
+
+	if(index > 0)
+		memcpy(new->callbacks, old->callbacks, sizeof(struct callback)*index);
+	if(index < length)
+		memcpy(new->callbacks+index+1, old->callbacks+index, sizeof(struct callback)*(length-index));
+	new->callbacks[index] = *entry;
+
+	callback_array_replace(array, new);
+}
+
+static unsigned int callback_array_find(const struct callback_array *array, void *callback, void *data)
+{
+	unsigned int index;
+	for(index = 0; index < array->length; ++index) {
+		if(array->callbacks[index].callback == callback && array->callbacks[index].data == data)
+			break;
+	}
+	return index;
+}
+
+static bool callback_array_remove(struct callback_array **array, void *callback, void *data,
+								  struct callback *removed)
+{
+	struct callback_array *old = *array;
+	if(!old)
+		return false;
+
+	unsigned int index = callback_array_find(old, callback, data);
+	if(index == old->length)
+		return false;
+
+	struct callback_array *new = NULL;
+	if(old->length > 1) {
+		new = callback_array_new(old->length-1);
+		memcpy(new->callbacks, old->callbacks, sizeof(struct callback)*index);
+		memcpy(new->callbacks+index, old->callbacks+index+1, sizeof(struct callback)*(old->length-index-1));
+	}
+
+	if(removed)
+		*removed = old->callbacks[index];
+	old->callbacks[index].callback = NULL;
+	for(struct callback_array *retired = old->retired; retired; retired = retired->retired) {
+		unsigned int retired_index = callback_array_find(retired, callback, data);
+		if(retired_index < retired->length)
+			retired->callbacks[retired_index].callback = NULL;
+	}
+
+	callback_array_replace(array, new);
+	return true;
+}
+
+#define DATAPIPE_STATS_BUCKETS 16
+
+/* Statistics are kept per subscriber, callbacks registered with different user data are counted apart */
+struct callback_stats {
+	void *callback;
+	void *user_data;
+	bool filter;
+	guint64 count;
+	guint64 total_us;
+	guint64 max_us;
+	/* bucket 0 counts calls below 1us, bucket n calls in [2^(n-1), 2^n) us,
+	 * the last bucket also counts everything slower */
+	guint64 buckets[DATAPIPE_STATS_BUCKETS];
+};
+
+struct datapipe_stats {
+	guint64 events;
+	guint64 dropped;
+	GHashTable *callbacks;
+};
+
+static guint callback_stats_hash(gconstpointer key)
+{
+	const struct callback_stats *cb_stats = key;
+	return g_direct_hash(cb_stats->callback) ^ g_direct_hash(cb_stats->user_data);
+}
+
+static gboolean callback_stats_equal(gconstpointer a, gconstpointer b)
+{
+	const struct callback_stats *stats_a = a;
+	const struct callback_stats *stats_b = b;
+	return stats_a->callback == stats_b->callback && stats_a->user_data == stats_b->user_data;
+}
+
+static void datapipe_stats_add(struct datapipe_stats *stats, void *callback, void *user_data,
+							   bool filter, guint64 elapsed)
+{
+	const struct callback_stats key = {.callback = callback, .user_data = user_data};
+	struct callback_stats *cb_stats = g_hash_table_lookup(stats->callbacks, &key);
+
+	if(!cb_stats) {
+		cb_stats = g_malloc0(sizeof(*cb_stats));
+		cb_stats->callback = callback;
+		cb_stats->user_data = user_data;
+		cb_stats->filter = filter;
+		g_hash_table_add(stats->callbacks, cb_stats);
+	}
+
+	guint bucket = MIN(elapsed ? g_bit_storage(elapsed) : 0, DATAPIPE_STATS_BUCKETS-1);
+	++cb_stats->buckets[bucket];
+	++cb_stats->count;
+	cb_stats->total_us += elapsed;
+	if(elapsed > cb_stats->max_us)
+		cb_stats->max_us = elapsed;
+}
+
+static void datapipe_stats_record(struct datapipe_stats *stats, void *callback, void *user_data,
+								  bool filter, gint64 start)
+{
+	datapipe_stats_add(stats, callback, user_data, filter, g_get_monotonic_time() - start);
+}
+
+static gint callback_stats_compare(gconstpointer a, gconstpointer b)
+{
+	const struct callback_stats *stats_a = a;
+	const struct callback_stats *stats_b = b;
+
+	if(stats_a->total_us == stats_b->total_us)
+		return 0;
+	return stats_a->total_us < stats_b->total_us ? 1 : -1;
+}
+
+struct datapipe_payload {
+	int ref_count;
+	const datapipe_type_struct *type;
+	gpointer data;
+};
+
+struct deferred_job {
+	const datapipe_struct *datapipe;
+	void *callback;
+	void *user_data;
+	struct datapipe_payload *payload;
+	guint source_id;
+	bool cancelled;
+	GList link;
+};
+
+/** Deferred triggers that have been scheduled but not yet run */
+static GQueue pending_jobs = G_QUEUE_INIT;
+
+static struct datapipe_payload *datapipe_payload_new(const datapipe_type_struct *type, gconstpointer data)
+{
+	struct datapipe_payload *payload = g_malloc(sizeof(*payload));
+	payload->ref_count = 1;
+	payload->type = type;
+	payload->data = data && type->copy ? type->copy(data) : (gpointer)data;
+	return payload;
+}
+
+static struct datapipe_payload *datapipe_payload_ref(struct datapipe_payload *payload)
+{
+	g_atomic_int_inc(&payload->ref_count);
+	return payload;
+}
+
+/* May be called from worker threads, type->free must thus be thread safe */
+static void datapipe_payload_unref(struct datapipe_payload *payload)
+{
+	if(!payload || !g_atomic_int_dec_and_test(&payload->ref_count))
+		return;
+
+	if(payload->data && payload->type->free)
+		payload->type->free(payload->data);
+	g_free(payload);
+}
+
+static gint datapipe_exec_to_glib_priority(datapipe_exec_t exec)
+{
+	switch(exec) {
+		case DATAPIPE_EXEC_DEFERRED_HIGH:
+			return G_PRIORITY_HIGH_IDLE;
+		case DATAPIPE_EXEC_DEFERRED_LOW:
+			return G_PRIORITY_LOW;
+		case DATAPIPE_EXEC_DEFERRED:
+		default:
+			return G_PRIORITY_DEFAULT_IDLE;
+	}
+}
+
+static void deferred_job_call(struct deferred_job *job)
+{
+	void (*trigger)(gconstpointer data, gpointer user_data) = job->callback;
+	struct datapipe_stats *stats = job->datapipe->stats;
+
+	gint64 start = G_UNLIKELY(stats) ? g_get_monotonic_time() : 0;
+	trigger(job->payload->data, job->user_data);
+	if(G_UNLIKELY(stats))
+		datapipe_stats_record(stats, job->callback, job->user_data, false, start);
+}
+
+static gboolean deferred_job_run(gpointer user_data)
+{
+	struct deferred_job *job = user_data;
+	deferred_job_call(job);
+	job->source_id = 0;
+	return G_SOURCE_REMOVE;
+}
+
+static void deferred_job_free(gpointer user_data)
+{
+	struct deferred_job *job = user_data;
+	g_queue_unlink(&pending_jobs, &job->link);
+	datapipe_payload_unref(job->payload);
+	g_free(job);
+}
+
+static void deferred_job_schedule(const datapipe_struct *datapipe, const struct callback *cb,
+								  struct datapipe_payload *payload)
+{
+	struct deferred_job *job = g_malloc0(sizeof(*job));
+	job->datapipe = datapipe;
+	job->callback = cb->callback;
+	job->user_data = cb->data;
+	job->payload = datapipe_payload_ref(payload);
+	job->link.data = job;
+	g_queue_push_tail_link(&pending_jobs, &job->link);
+	job->source_id = g_idle_add_full(datapipe_exec_to_glib_priority(cb->exec), deferred_job_run, job, deferred_job_free);
+}
+
+/*
+ * Cancel pending deferred triggers of a datapipe, if callback is NULL all
+ * pending triggers of the datapipe are canceled
+ */
+static void deferred_jobs_cancel(const datapipe_struct *datapipe, void *callback, void *user_data)
+{
+	GList *element = pending_jobs.head;
+	while(element) {
+		struct deferred_job *job = element->data;
+		element = element->next;
+
+		if(job->cancelled || job->source_id == 0 || job->datapipe != datapipe)
+			continue;
+		if(callback && (job->callback != callback || job->user_data != user_data))
+			continue;
+
+		job->cancelled = true;
+		g_source_remove(job->source_id);
+	}
+}
+
+/*
+ * Run the pending deferred jobs of a trigger now, in the order they where scheduled
+ * The trigger may schedule or cancel jobs, so the queue is searched again after every job
+ */
+static void deferred_jobs_flush(const datapipe_struct *datapipe, void *callback, void *user_data)
+{
+	for(;;) {
+		struct deferred_job *job = NULL;
+		for(GList *element = pending_jobs.head; element; element = element->next) {
+			struct deferred_job *candidate = element->data;
+			if(!candidate->cancelled && candidate->source_id != 0 && candidate->datapipe == datapipe &&
+			   candidate->callback == callback && candidate->user_data == user_data) {
+				job = candidate;
+				break;
+			}
+		}
+		if(!job)
+			return;
+
+		job->cancelled = true;
+		deferred_job_call(job);
+		g_source_remove(job->source_id);
+	}
+}
+
+/*
+ * Threaded triggers
+ *
+ * Every threaded trigger has a serial queue of events. At most one pool task
+ * per subscriber is queued or running at any time, so events are delivered to
+ * a subscriber in order, while different subscribers run in parallel.
+ * A task runs a single event and requeues itself if more are pending, to
+ * share the pool fairly between subscribers.
+ */
+#define DATAPIPE_THREAD_POOL_SIZE 4
+
+struct thread_subscriber {
+	gint ref_count;
+	GMutex lock;
+	GCond idle;
+	GQueue events;
+	bool scheduled;
+	bool running;
+	bool cancelled;
+	const datapipe_struct *datapipe;
+	void *callback;
+	void *complete;
+	void *user_data;
+};
+
+struct thread_completion {
+	struct thread_subscriber *subscriber;
+	struct datapipe_payload *payload;
+	guint64 elapsed;
+};
+
+static GThreadPool *thread_pool = NULL;
+
+static struct thread_subscriber *thread_subscriber_ref(struct thread_subscriber *subscriber)
+{
+	g_atomic_int_inc(&subscriber->ref_count);
+	return subscriber;
+}
+
+static void thread_subscriber_unref(struct thread_subscriber *subscriber)
+{
+	if(!g_atomic_int_dec_and_test(&subscriber->ref_count))
+		return;
+
+	g_queue_clear_full(&subscriber->events, (GDestroyNotify)datapipe_payload_unref);
+	g_mutex_clear(&subscriber->lock);
+	g_cond_clear(&subscriber->idle);
+	g_free(subscriber);
+}
+
+static gboolean thread_completion_run(gpointer user_data)
+{
+	struct thread_completion *completion = user_data;
+	struct thread_subscriber *subscriber = completion->subscriber;
+
+	if(!subscriber->cancelled) {
+		struct datapipe_stats *stats = subscriber->datapipe->stats;
+		if(G_UNLIKELY(stats))
+			datapipe_stats_add(stats, subscriber->callback, subscriber->user_data, false, completion->elapsed);
+
+		if(subscriber->complete) {
+			void (*complete)(gconstpointer data, gpointer user_data) = subscriber->complete;
+			complete(completion->payload->data, subscriber->user_data);
+		}
+	}
+
+	datapipe_payload_unref(completion->payload);
+	thread_subscriber_unref(subscriber);
+	g_free(completion);
+	return G_SOURCE_REMOVE;
+}
+
+static void thread_subscriber_push(struct thread_subscriber *subscriber)
+{
+	GError *error = NULL;
+
+	subscriber->scheduled = true;
+	if(!g_thread_pool_push(thread_pool, thread_subscriber_ref(subscriber), &error)) {
+		sphone_log(LL_ERR, "Unable to run trigger %p on worker thread: %s", subscriber->callback, error->message);
+		g_error_free(error);
+		subscriber->scheduled = false;
+		g_queue_clear_full(&subscriber->events, (GDestroyNotify)datapipe_payload_unref);
+		g_cond_broadcast(&subscriber->idle);
+		thread_subscriber_unref(subscriber);
+	}
+}
+
+static void thread_subscriber_run(gpointer data, gpointer user_data)
+{
+	struct thread_subscriber *subscriber = data;
+	(void)user_data;
+
+	g_mutex_lock(&subscriber->lock);
+	struct datapipe_payload *payload = subscriber->cancelled ? NULL : g_queue_pop_head(&subscriber->events);
+	if(!payload) {
+		subscriber->scheduled = false;
+		g_cond_broadcast(&subscriber->idle);
+		g_mutex_unlock(&subscriber->lock);
+		thread_subscriber_unref(subscriber);
+		return;
+	}
+	subscriber->running = true;
+	g_mutex_unlock(&subscriber->lock);
+
+	void (*trigger)(gconstpointer data, gpointer user_data) = subscriber->callback;
+	gint64 start = g_get_monotonic_time();
+	trigger(payload->data, subscriber->user_data);
+	guint64 elapsed = g_get_monotonic_time() - start;
+
+	if(subscriber->complete || subscriber->datapipe->stats) {
+		struct thread_completion *completion = g_malloc(sizeof(*completion));
+		completion->subscriber = thread_subscriber_ref(subscriber);
+		completion->payload = payload;
+		completion->elapsed = elapsed;
+		g_idle_add_full(G_PRIORITY_DEFAULT, thread_completion_run, completion, NULL);
+	} else {
+		datapipe_payload_unref(payload);
+	}
+
+	g_mutex_lock(&subscriber->lock);
+	subscriber->running = false;
+	if(!subscriber->cancelled && !g_queue_is_empty(&subscriber->events)) {
+		thread_subscriber_push(subscriber);
+	} else {
+		subscriber->scheduled = false;
+		g_cond_broadcast(&subscriber->idle);
+	}
+	g_mutex_unlock(&subscriber->lock);
+	thread_subscriber_unref(subscriber);
+}
+
+static struct thread_subscriber *thread_subscriber_new(const datapipe_struct *datapipe, void *callback,
+													   void *complete, void *user_data)
+{
+	if(!thread_pool) {
+		GError *error = NULL;
+		thread_pool = g_thread_pool_new(thread_subscriber_run, NULL, DATAPIPE_THREAD_POOL_SIZE, FALSE, &error);
+		if(!thread_pool) {
+			sphone_log(LL_ERR, "Unable to create datapipe thread pool: %s", error->message);
+			g_error_free(error);
+			return NULL;
+		}
+	}
+
+	struct thread_subscriber *subscriber = g_malloc0(sizeof(*subscriber));
+	subscriber->ref_count = 1;
+	g_mutex_init(&subscriber->lock);
+	g_cond_init(&subscriber->idle);
+	g_queue_init(&subscriber->events);
+	subscriber->datapipe = datapipe;
+	subscriber->callback = callback;
+	subscriber->complete = complete;
+	subscriber->user_data = user_data;
+	return subscriber;
+}
+
+static void thread_subscriber_queue(struct thread_subscriber *subscriber, struct datapipe_payload *payload)
+{
+	g_mutex_lock(&subscriber->lock);
+	if(!subscriber->cancelled) {
+		g_queue_push_tail(&subscriber->events, datapipe_payload_ref(payload));
+		if(!subscriber->scheduled)
+			thread_subscriber_push(subscriber);
+	}
+	g_mutex_unlock(&subscriber->lock);
+}
+
+/* Wait until the worker threads delivered every pending event of a subscriber */
+static void thread_subscriber_drain(struct thread_subscriber *subscriber)
+{
+	g_mutex_lock(&subscriber->lock);
+	while(subscriber->scheduled || !g_queue_is_empty(&subscriber->events))
+		g_cond_wait(&subscriber->idle, &subscriber->lock);
+	g_mutex_unlock(&subscriber->lock);
+}
+
+/*
+ * Drop the pending events of a subscriber and wait for the running one to finish,
+ * so that user_data may be freed once the trigger is removed.
+ * Pending completions are discarded on the main loop.
+ */
+static void thread_subscriber_cancel(struct thread_subscriber *subscriber)
+{
+	g_mutex_lock(&subscriber->lock);
+	subscriber->cancelled = true;
+	g_queue_clear_full(&subscriber->events, (GDestroyNotify)datapipe_payload_unref);
+	while(subscriber->running)
+		g_cond_wait(&subscriber->idle, &subscriber->lock);
+	g_mutex_unlock(&subscriber->lock);
+	thread_subscriber_unref(subscriber);
+}
+
+/**
+ * Execute the filters of a datapipe
+ *
+ * @param datapipe The datapipe to execute
+ * @param indata The input data to run through the datapipe
+ * @return The processed data
+ */
+gconstpointer execute_datapipe_filters(datapipe_struct *const datapipe, gpointer indata)
+{
+	gpointer data = indata;
+	bool entryNull = !indata;
+
+	if (datapipe == NULL) {
+		sphone_log(LL_ERR, "%s called without a valid datapipe", __func__);
+		return NULL;
+	}
+
+	struct callback_array *filters = callback_array_ref(datapipe->filters);
+	if(!filters)
+		return data;
+
+	struct datapipe_stats *stats = datapipe->stats;
+	for (unsigned int i = 0; i < filters->length; i++) {
+		const struct callback *cb = &filters->callbacks[i];
+		if(!cb->callback)
+			continue;
+		void *callback = cb->callback;
+		gpointer (*filter)(gpointer data, gpointer user_data) = callback;
+		gint64 start = G_UNLIKELY(stats) ? g_get_monotonic_time() : 0;
+		gpointer tmp = filter(data, cb->data);
+		if(G_UNLIKELY(stats))
+			datapipe_stats_record(stats, callback, cb->data, true, start);
+		if(!entryNull && !tmp) {
+			data = NULL;
+			break;
+		}
+
+		data = tmp;
+	}
+
+	callback_array_unref(filters);
+	return data;
+}
+
+static void callback_array_run_triggers(const datapipe_struct *const datapipe, struct callback_array *triggers,
+										gconstpointer indata, struct datapipe_payload **payload)
+{
+	struct datapipe_stats *stats = datapipe->stats;
+	for (unsigned int i = 0; i < triggers->length; i++) {
+		const struct callback *cb = &triggers->callbacks[i];
+		if(!cb->callback)
+			continue;
+		if(cb->exec != DATAPIPE_EXEC_IMMEDIATE) {
+			if(!*payload)
+				*payload = datapipe_payload_new(datapipe->type, indata);
+			if(cb->exec == DATAPIPE_EXEC_THREAD)
+				thread_subscriber_queue(cb->subscriber, *payload);
+			else
+				deferred_job_schedule(datapipe, cb, *payload);
+			continue;
+		}
+		void *callback = cb->callback;
+		void (*trigger)(gconstpointer data, gpointer user_data) = callback;
+		gint64 start = G_UNLIKELY(stats) ? g_get_monotonic_time() : 0;
+		trigger(indata, cb->data);
+		if(G_UNLIKELY(stats))
+			datapipe_stats_record(stats, callback, cb->data, false, start);
+	}
+}
+
+/*
+ * Keyed triggers
+ *
+ * Keyed triggers are registered for a single key and kept in a hash table of
+ * callback arrays, dispatch only looks up the array of the key of the data.
+ * The table owns a copy of every key, made with the key type of the datapipe.
+ */
+struct datapipe_keys {
+	const datapipe_type_struct *type;
+	gconstpointer (*get_key)(gconstpointer data);
+	GHashTable *triggers;
+};
+
+struct keyed_triggers {
+	const datapipe_type_struct *type;
+	gpointer key;
+	struct callback_array *triggers;
 };
 
+static void keyed_triggers_free(gpointer data)
+{
+	struct keyed_triggers *keyed = data;
+
+	callback_array_unref(keyed->triggers);
+	if(keyed->key && keyed->type->free)
+		keyed->type->free(keyed->key);
+	g_free(keyed);
+}
+
+
+static void execute_datapipe_keyed_triggers(const datapipe_struct *const datapipe, gconstpointer indata,
+											struct datapipe_payload **payload)
+{
+	struct datapipe_keys *keys = datapipe->keys;
+	gconstpointer key = keys->get_key(indata);
+	if(!key)
+		return;
+
+	struct keyed_triggers *keyed = g_hash_table_lookup(keys->triggers, key);
+	if(!keyed || !keyed->triggers)
+		return;
+
+	/* the entry may be removed by the triggers, the array stays alive through its reference */
+	struct callback_array *triggers = callback_array_ref(keyed->triggers);
+	callback_array_run_triggers(datapipe, triggers, indata, payload);
+	callback_array_unref(triggers);
+}
+
+/**
+ * Execute the output triggers of a datapipe
+ *
+ * Keyed triggers are executed after the other triggers.
+ *
+ * @param datapipe The datapipe to execute
+ * @param indata The input data to run through the datapipe
+ */
+void execute_datapipe_output_triggers(const datapipe_struct *const datapipe, gconstpointer indata)
+{
+	if (datapipe == NULL) {
+		sphone_log(LL_ERR, "%s called without a valid datapipe", __func__);
+		return;
+	}
+
+	struct datapipe_payload *payload = NULL;
+	struct callback_array *triggers = callback_array_ref(datapipe->output_triggers);
+	if(triggers) {
+		callback_array_run_triggers(datapipe, triggers, indata, &payload);
+		callback_array_unref(triggers);
+	}
+
+	if(datapipe->keys && indata)
+		execute_datapipe_keyed_triggers(datapipe, indata, &payload);
+
+	datapipe_payload_unref(payload);
+}
+
+static void datapipe_cache_clear(datapipe_struct *const datapipe)
+{
+	if(datapipe->cache_valid && datapipe->cached_data && datapipe->type->free)
+		datapipe->type->free(datapipe->cached_data);
+	datapipe->cached_data = NULL;
+	datapipe->cache_valid = false;
+}
+
+static void datapipe_cache_store(datapipe_struct *const datapipe, gconstpointer data)
+{
+	gpointer copy = data && datapipe->type->copy ? datapipe->type->copy(data) : (gpointer)data;
+	datapipe_cache_clear(datapipe);
+	datapipe->cached_data = copy;
+	datapipe->cache_valid = true;
+}
+
+static gpointer datapipe_copy_data(const datapipe_struct *const datapipe, gconstpointer data)
+{
+	return data && datapipe->type->copy ? datapipe->type->copy(data) : (gpointer)data;
+}
+
+static void datapipe_free_data(const datapipe_struct *const datapipe, gpointer data)
+{
+	if(data && datapipe->type->free)
+		datapipe->type->free(data);
+}
+
+/*
+ * Recorder
+ *
+ * Events on recorded datapipes are passed to the recorder when they enter
+ * execute_datapipe(), before filters, transactions or coalescing act on them.
+ * Storing them is up to the recorder, see datapipes_recorder_start().
+ */
+static void (*recorder)(const char *name, GVariant *data) = NULL;
+
+/**
+ * Set the function that receives the events of recorded datapipes
+ *
+ * @param record Called with the name of the datapipe and the data of the event
+ *           serialized by the to_variant function given to datapipe_set_recorded(),
+ *           or NULL if the event has no data. A floating data reference is
+ *           for the recorder to sink. NULL stops recording
+ */
+void datapipe_set_recorder(void (*record)(const char *name, GVariant *data))
+{
+	recorder = record;
+}
+
+/**
+ * Record the events of a datapipe while a recorder is set
+ *
+ * @param datapipe The datapipe to manipulate
+ * @param to_variant Serializes the data of an event, usually the to_variant of the
+ *                   type of the datapipe, NULL stops recording the datapipe
+ */
+void datapipe_set_recorded(datapipe_struct *const datapipe, GVariant *(*to_variant)(gconstpointer data))
+{
+	if (datapipe == NULL) {
+		sphone_log(LL_ERR, "%s called without a valid datapipe", __func__);
+		return;
+	}
+
+	datapipe->record = to_variant;
+}
+
+/*
+ * Transactions
+ *
+ * While a transaction is open, events on typed datapipes are queued instead of
+ * executed and the commit executes them in order. Cached datapipes carry state,
+ * a repeated event on one of them replaces the queued data but keeps its
+ * position, so the commit delivers only its final state. Events on other
+ * datapipes are all delivered.
+ * Untyped datapipes can not be copied and datapipes with filters return the
+ * filtered data to the caller, both are still executed immediately.
+ */
+struct transaction_event {
+	datapipe_struct *datapipe;
+	gpointer data;
+};
+
+static unsigned int transaction_depth = 0;
+static GArray *transaction_events = NULL;
+
+/* Nested dispatches of the same datapipe deeper than this are treated as a cycle */
+#define DATAPIPE_MAX_DISPATCH_DEPTH 8
+
+static void transaction_event_clear(struct transaction_event *event)
+{
+	datapipe_free_data(event->datapipe, event->data);
+	event->data = NULL;
+}
+
+static void transaction_queue(datapipe_struct *const datapipe, gconstpointer indata)
+{
+	gpointer copy = datapipe_copy_data(datapipe, indata);
+
+	if(!transaction_events)
+		transaction_events = g_array_new(FALSE, FALSE, sizeof(struct transaction_event));
+
+	for(unsigned int i = 0; datapipe->cache_enabled && i < transaction_events->len; ++i) {
+		struct transaction_event *event = &g_array_index(transaction_events, struct transaction_event, i);
+		if(event->datapipe == datapipe) {
+			transaction_event_clear(event);
+			event->data = copy;
+			if(G_UNLIKELY(datapipe->stats))
+				++datapipe->stats->dropped;
+			return;
+		}
+	}
+
+	struct transaction_event event = {datapipe, copy};
+	g_array_append_val(transaction_events, event);
+}
+
+static void transaction_drop_datapipe(const datapipe_struct *const datapipe)
+{
+	if(!transaction_events)
+		return;
+
+	for(unsigned int i = transaction_events->len; i > 0; --i) {
+		struct transaction_event *event = &g_array_index(transaction_events, struct transaction_event, i-1);
+		if(event->datapipe == datapipe) {
+			transaction_event_clear(event);
+			g_array_remove_index(transaction_events, i-1);
+		}
+	}
+}
+
+static bool transaction_queues(const datapipe_struct *const datapipe)
+{
+	return transaction_depth > 0 && datapipe->type && (!datapipe->filters || datapipe->filters->length == 0);
+}
+
+/**
+ * Begin a datapipe transaction
+ *
+ * Transactions nest, the events are only executed when the outermost
+ * transaction is committed.
+ */
+void datapipe_transaction_begin(void)
+{
+	++transaction_depth;
+}
+
+/**
+ * Commit a datapipe transaction
+ *
+ * When the outermost transaction is committed, the queued events are executed.
+ * Events emitted by triggers during the commit are executed immediately.
+ */
+void datapipe_transaction_commit(void)
+{
+	if(transaction_depth == 0) {
+		sphone_log(LL_ERR, "%s called without an open transaction", __func__);
+		return;
+	}
+
+	if(--transaction_depth > 0)
+		return;
+
+	GArray *events = transaction_events;
+	transaction_events = NULL;
+	if(!events)
+		return;
+
+	for(unsigned int i = 0; i < events->len; ++i) {
+		struct transaction_event *event = &g_array_index(events, struct transaction_event, i);
+		execute_datapipe(event->datapipe, event->data);
+		transaction_event_clear(event);
+	}
+
+	g_array_free(events, TRUE);
+}
+
+/* Run a datapipe without transaction or coalescing handling */
+static gconstpointer datapipe_dispatch(datapipe_struct *const datapipe, gpointer indata)
+{
+	gconstpointer data = NULL;
+
+	if(datapipe->dispatch_depth >= DATAPIPE_MAX_DISPATCH_DEPTH) {
+		sphone_log(LL_ERR, "%s: %s recursed %u times, dropping event to break the cycle",
+				   __func__, datapipe_get_name(datapipe), datapipe->dispatch_depth);
+		if(G_UNLIKELY(datapipe->stats))
+			++datapipe->stats->dropped;
+		return NULL;
+	}
+
+	++datapipe->dispatch_depth;
+
+	data = execute_datapipe_filters(datapipe, indata);
+
+	if(!data && indata) {
+		if(G_UNLIKELY(datapipe->stats))
+			++datapipe->stats->dropped;
+		--datapipe->dispatch_depth;
+		return NULL;
+	}
+
+	if(datapipe->cache_enabled)
+		datapipe_cache_store(datapipe, data);
+
+	execute_datapipe_output_triggers(datapipe, data);
+
+	--datapipe->dispatch_depth;
+	return data;
+}
+
+/*
+ * Coalescing
+ *
+ * Events are grouped by key. The first event for a key is executed right away
+ * and opens a window, further events for that key inside the window are held
+ * back and only the newest one is executed when the window closes.
+ * Events the significant callback flags against the last executed event for the
+ * key are never held, they supersede any held event and reopen the window.
+ * A held event that is superseded is folded into its replacement by the merge
+ * callback, so state that only the dropped event carried is not lost.
+ */
+struct datapipe_coalescer {
+	datapipe_struct *datapipe;
+	guint window_ms;
+	GHashTable *entries;
+	bool (*significant)(gconstpointer last, gconstpointer data);
+	void (*merge)(gpointer data, gconstpointer held);
+};
+
+struct coalesce_entry {
+	struct datapipe_coalescer *coalescer;
+	gpointer key;
+	gpointer last;
+	gpointer pending;
+	guint timeout_id;
+};
+
+static void coalesce_entry_free(gpointer data)
+{
+	struct coalesce_entry *entry = data;
+	const datapipe_struct *datapipe = entry->coalescer->datapipe;
+
+	if(entry->timeout_id)
+		g_source_remove(entry->timeout_id);
+	datapipe_free_data(datapipe, entry->pending);
+	datapipe_free_data(datapipe, entry->last);
+	datapipe_free_data(datapipe, entry->key);
+	g_free(entry);
+}
+
+static void coalesce_entry_set_last(struct coalesce_entry *entry, gconstpointer data)
+{
+	datapipe_struct *datapipe = entry->coalescer->datapipe;
+
+	datapipe_free_data(datapipe, entry->last);
+	entry->last = datapipe_copy_data(datapipe, data);
+}
+
+static gboolean coalesce_window_closed(gpointer user_data)
+{
+	struct coalesce_entry *entry = user_data;
+	struct datapipe_coalescer *coalescer = entry->coalescer;
+
+	if(!entry->pending) {
+		entry->timeout_id = 0;
+		g_hash_table_remove(coalescer->entries, entry->key);
+		return G_SOURCE_REMOVE;
+	}
+
+	/* the held event may be replaced by a reentrant execution while the triggers run */
+	gpointer data = entry->pending;
+	entry->pending = NULL;
+	coalesce_entry_set_last(entry, data);
+	datapipe_dispatch(coalescer->datapipe, data);
+	datapipe_free_data(coalescer->datapipe, data);
+	return G_SOURCE_CONTINUE;
+}
+
+/* Returns true if the event was held back */
+static bool datapipe_coalesce(datapipe_struct *const datapipe, gconstpointer indata)
+{
+	struct datapipe_coalescer *coalescer = datapipe->coalescer;
+	struct coalesce_entry *entry = g_hash_table_lookup(coalescer->entries, indata);
+
+	if(!entry) {
+		entry = g_malloc0(sizeof(*entry));
+		entry->coalescer = coalescer;
+		entry->key = datapipe_copy_data(datapipe, indata);
+		entry->last = datapipe_copy_data(datapipe, indata);
+		entry->timeout_id = g_timeout_add(coalescer->window_ms, coalesce_window_closed, entry);
+		g_hash_table_insert(coalescer->entries, entry->key, entry);
+		return false;
+	}
+
+	gpointer held = entry->pending;
+	entry->pending = NULL;
+	if(held && G_UNLIKELY(datapipe->stats))
+		++datapipe->stats->dropped;
+
+	if(coalescer->significant && coalescer->significant(entry->last, indata)) {
+		coalesce_entry_set_last(entry, indata);
+		g_source_remove(entry->timeout_id);
+		entry->timeout_id = g_timeout_add(coalescer->window_ms, coalesce_window_closed, entry);
+		if(!held || !coalescer->merge) {
+			datapipe_free_data(datapipe, held);
+			return false;
+		}
+
+		/* indata can not be modified, execute a merged copy in its place */
+		gpointer data = datapipe_copy_data(datapipe, indata);
+		coalescer->merge(data, held);
+		datapipe_free_data(datapipe, held);
+		datapipe_dispatch(datapipe, data);
+		datapipe_free_data(datapipe, data);
+		return true;
+	}
+
+	entry->pending = datapipe_copy_data(datapipe, indata);
+	if(held) {
+		if(coalescer->merge)
+			coalescer->merge(entry->pending, held);
+		datapipe_free_data(datapipe, held);
+	}
+	return true;
+}
+
+static void datapipe_coalescer_free(datapipe_struct *const datapipe, bool flush)
+{
+	struct datapipe_coalescer *coalescer = datapipe->coalescer;
+	if(!coalescer)
+		return;
+
+	datapipe->coalescer = NULL;
+
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, coalescer->entries);
+	while(flush && g_hash_table_iter_next(&iter, NULL, &value)) {
+		struct coalesce_entry *entry = value;
+		if(entry->pending) {
+			datapipe_dispatch(datapipe, entry->pending);
+			datapipe_free_data(datapipe, entry->pending);
+			entry->pending = NULL;
+		}
+	}
+
+	g_hash_table_destroy(coalescer->entries);
+	g_free(coalescer);
+}
+
+/**
+ * Coalesce bursts of events on a datapipe
+ *
+ * @param datapipe The datapipe to manipulate, must have a type
+ * @param window_ms The window in ms in which events with the same key are coalesced,
+ *                  0 disables coalescing and executes held events
+ * @param hash Hash function of the key of an event
+ * @param equal Returns true if two events have the same key
+ * @param significant Returns true if data differs from the last executed event
+ *                    with the same key in a way that may not be delayed, may be NULL
+ * @param merge Folds a held event that is dropped into data, the event replacing it, may be NULL
+ */
+void datapipe_set_coalescing(datapipe_struct *const datapipe, guint window_ms,
+							 GHashFunc hash, GEqualFunc equal,
+							 bool (*significant)(gconstpointer last, gconstpointer data),
+							 void (*merge)(gpointer data, gconstpointer held))
+{
+	if (datapipe == NULL) {
+		sphone_log(LL_ERR, "%s called without a valid datapipe", __func__);
+		return;
+	}
+
+	datapipe_coalescer_free(datapipe, true);
+
+	if(window_ms == 0)
+		return;
+
+	if(!datapipe->type) {
+		sphone_log(LL_ERR, "%s: %s has no type and can not be coalesced", __func__, datapipe_get_name(datapipe));
+		return;
+	}
+
+	struct datapipe_coalescer *coalescer = g_malloc0(sizeof(*coalescer));
+	coalescer->datapipe = datapipe;
+	coalescer->window_ms = window_ms;
+	coalescer->entries = g_hash_table_new_full(hash, equal, NULL, coalesce_entry_free);
+	coalescer->significant = significant;
+	coalescer->merge = merge;
+	datapipe->coalescer = coalescer;
+}
+
+/**
+ * Execute the datapipe
+ *
+ * Inside a transaction, events on typed datapipes are queued until the
+ * transaction is committed, on coalesced datapipes events may be held back.
+ * In both cases indata is returned unfiltered.
+ *
+ * @param datapipe The datapipe to execute
+ * @param indata The input data to run through the datapipe
+ * @return The processed data
+ */
+gconstpointer execute_datapipe(datapipe_struct *const datapipe, gpointer indata)
+{
+	if (datapipe == NULL) {
+		sphone_log(LL_ERR, "%s called without a valid datapipe", __func__);
+		return NULL;
+	}
+
+	if(G_UNLIKELY(datapipe->stats))
+		++datapipe->stats->events;
+
+	if(G_UNLIKELY(recorder) && datapipe->record)
+		recorder(datapipe_get_name(datapipe), indata ? datapipe->record(indata) : NULL);
+
+	if(transaction_queues(datapipe)) {
+		transaction_queue(datapipe, indata);
+		return indata;
+	}
+
+	if(datapipe->coalescer && indata && datapipe_coalesce(datapipe, indata))
+		return indata;
+
+	return datapipe_dispatch(datapipe, indata);
+}
+
+/*
+ * Events published from foreign threads
+ *
+ * Producers push onto a lock free stack, the main loop source takes the whole
+ * stack at once and reverses it to restore publication order. As the consumer
+ * never pops single elements the stack is not subject to ABA.
+ * The main context is only woken when the stack turns from empty to non-empty.
+ * Events taken from the stack wait in taken_events until they are dispatched,
+ * so free_datapipe() can drop the events of a datapipe that goes away.
+ */
+struct async_event {
+	struct async_event *next;
+	datapipe_struct *datapipe;
+	gpointer data;
+};
+
+static struct async_event *async_events = NULL;
+static GQueue taken_events = G_QUEUE_INIT;
+static GSource *async_source = NULL;
+
+static void async_event_free(struct async_event *event)
+{
+	if(event->data && event->datapipe->type && event->datapipe->type->free)
+		event->datapipe->type->free(event->data);
+	g_free(event);
+}
+
+/* Move the published events to taken_events in publication order, main loop only */
+static void async_events_take(void)
+{
+	struct async_event *head;
+	do {
+		head = g_atomic_pointer_get(&async_events);
+	} while(!g_atomic_pointer_compare_and_exchange(&async_events, head, NULL));
+
+	struct async_event *ordered = NULL;
+	while(head) {
+		struct async_event *next = head->next;
+		head->next = ordered;
+		ordered = head;
+		head = next;
+	}
+
+	for(; ordered; ordered = ordered->next)
+		g_queue_push_tail(&taken_events, ordered);
+}
+
+/* Drop the events published on a datapipe that were not dispatched yet */
+static void async_events_drop(const datapipe_struct *const datapipe)
+{
+	async_events_take();
+
+	GList *element = taken_events.head;
+	while(element) {
+		GList *next = element->next;
+		struct async_event *event = element->data;
+		if(event->datapipe == datapipe) {
+			g_queue_delete_link(&taken_events, element);
+			async_event_free(event);
+		}
+		element = next;
+	}
+}
+
+static gboolean async_source_prepare(GSource *source, gint *timeout)
+{
+	(void)source;
+	*timeout = -1;
+	return g_atomic_pointer_get(&async_events) != NULL || !g_queue_is_empty(&taken_events);
+}
+
+static gboolean async_source_check(GSource *source)
+{
+	(void)source;
+	return g_atomic_pointer_get(&async_events) != NULL || !g_queue_is_empty(&taken_events);
+}
+
+static gboolean async_source_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+{
+	(void)source;
+	(void)callback;
+	(void)user_data;
+
+	async_events_take();
+
+	struct async_event *event;
+	while((event = g_queue_pop_head(&taken_events))) {
+		execute_datapipe(event->datapipe, event->data);
+		async_event_free(event);
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs async_source_funcs = {
+	.prepare = async_source_prepare,
+	.check = async_source_check,
+	.dispatch = async_source_dispatch,
+};
+
+/**
+ * Execute a datapipe on the main loop from any thread
+ *
+ * The data is copied in the calling thread using the type of the datapipe and
+ * freed after the datapipe was executed on the main loop. Data published on
+ * datapipes without a type is passed as is and must stay valid until then.
+ * Events published from the same thread are executed in publication order.
+ * Events still pending when the datapipe is freed with free_datapipe() are dropped.
+ *
+ * @param datapipe The datapipe to execute
+ * @param indata The input data to run through the datapipe
+ */
+void execute_datapipe_async_from_thread(datapipe_struct *const datapipe, gconstpointer indata)
+{
+	static gsize source_initialized = 0;
+
+	if (datapipe == NULL) {
+		sphone_log(LL_ERR, "%s called without a valid datapipe", __func__);
+		return;
+	}
+
+	if (g_once_init_enter(&source_initialized)) {
+		async_source = g_source_new(&async_source_funcs, sizeof(GSource));
+		g_source_set_name(async_source, "sphone datapipe async");
+		g_source_set_priority(async_source, G_PRIORITY_DEFAULT);
+		g_source_attach(async_source, NULL);
+		g_once_init_leave(&source_initialized, 1);
+	}
+
+	struct async_event *event = g_malloc(sizeof(*event));
+	event->datapipe = datapipe;
+	if(indata && datapipe->type && datapipe->type->copy)
+		event->data = datapipe->type->copy(indata);
+	else
+		event->data = (gpointer)indata;
+
+	struct async_event *head;
+	do {
+		head = g_atomic_pointer_get(&async_events);
+		event->next = head;
+	} while(!g_atomic_pointer_compare_and_exchange(&async_events, head, event));
+
+	if(!head)
+		g_main_context_wakeup(g_source_get_context(async_source));
+}
+
 /**
- * Execute the filters of a datapipe
+ * Enable or disable the last value cache of a datapipe
  *
- * @param datapipe The datapipe to execute
- * @param indata The input data to run through the datapipe
- * @return The processed data
+ * A datapipe with enabled cache keeps a private copy of the last data that
+ * passed its filters, made with the type of the datapipe. The copy is updated
+ * before the triggers run, so triggers already see the new value.
+ *
+ * @param datapipe The datapipe to manipulate, must have a type
+ * @param enable true to enable the cache, false to disable and clear it
  */
-gconstpointer execute_datapipe_filters(datapipe_struct *const datapipe, gpointer indata)
+void datapipe_set_cache(datapipe_struct *const datapipe, bool enable)
 {
-	gpointer data = indata;
-	bool entryNull = !indata;
-
 	if (datapipe == NULL) {
 		sphone_log(LL_ERR, "%s called without a valid datapipe", __func__);
-		return NULL;
+		return;
 	}
 
-	struct callback *cb;
-	for (int i = 0; (cb = g_slist_nth_data(datapipe->filters, i)) != NULL; i++) {
-		gpointer (*filter)(gpointer data, gpointer user_data) = cb->callback;
-		gpointer tmp = filter(data, cb->data);
-		if(!entryNull && !tmp)
-			return NULL;
+	if (enable && !datapipe->type) {
+		sphone_log(LL_ERR, "%s: %s has no type and can not be cached", __func__, datapipe_get_name(datapipe));
+		return;
+	}
 
-		data = tmp;
+	if (!enable)
+		datapipe_cache_clear(datapipe);
+	datapipe->cache_enabled = enable;
+}
+
+/**
+ * Check if a cached datapipe has been executed since the cache was enabled
+ *
+ * @param datapipe The datapipe to check
+ * @return true if datapipe_get_last_data() returns a value that passed the datapipe
+ */
+bool datapipe_has_last_data(const datapipe_struct *const datapipe)
+{
+	if (datapipe == NULL) {
+		sphone_log(LL_ERR, "%s called without a valid datapipe", __func__);
+		return false;
 	}
 
-	return data;
+	return datapipe->cache_valid;
 }
 
 /**
- * Execute the output triggers of a datapipe
+ * Get the cached last data of a datapipe
  *
- * @param datapipe The datapipe to execute
- * @param indata The input data to run through the datapipe
+ * @param datapipe The datapipe to query, must have the cache enabled
+ * @return The data, owned by the datapipe and valid until the datapipe is executed again
  */
-void execute_datapipe_output_triggers(const datapipe_struct *const datapipe, gconstpointer indata)
+gconstpointer datapipe_get_last_data(const datapipe_struct *const datapipe)
 {
 	if (datapipe == NULL) {
 		sphone_log(LL_ERR, "%s called without a valid datapipe", __func__);
-		return;
+		return NULL;
 	}
 
-	struct callback *cb;
-	for (int i = 0; (cb = g_slist_nth_data(datapipe->output_triggers, i)) != NULL; i++) {
-		void (*trigger)(gconstpointer data, gpointer user_data) = cb->callback;
-		trigger(indata, cb->data);
+	if (!datapipe->cache_enabled)
+		sphone_log(LL_WARN, "%s called on %s which is not cached", __func__, datapipe_get_name(datapipe));
+
+	return datapipe->cached_data;
+}
+
+/**
+ * Get a copy of the cached last data of a datapipe
+ *
+ * @param datapipe The datapipe to query, must have the cache enabled
+ * @return A copy of the data to be freed with the free function of the datapipe type
+ */
+gpointer datapipe_dup_last_data(const datapipe_struct *const datapipe)
+{
+	gconstpointer data = datapipe_get_last_data(datapipe);
+
+	if (!data || !datapipe->type || !datapipe->type->copy)
+		return (gpointer)data;
+	return datapipe->type->copy(data);
+}
+
+/**
+ * Get the cached last data of a datapipe that carries integers encoded as pointers
+ *
+ * @param datapipe The datapipe to query, must have the cache enabled
+ * @return The last value or 0 if the datapipe was not executed yet
+ */
+int datapipe_get_last_data_int(const datapipe_struct *const datapipe)
+{
+	if (datapipe == NULL) {
+		sphone_log(LL_ERR, "%s called without a valid datapipe", __func__);
+		return -1;
 	}
+	return GPOINTER_TO_INT(datapipe_get_last_data(datapipe));
 }
 
 /**
- * Execute the datapipe
+ * Set the payload type of a datapipe
+ * The type is used to copy the data for triggers that are not run immediately
  *
- * @param datapipe The datapipe to execute
- * @param indata The input data to run through the datapipe
- * @param use_cache USE_CACHE to use data from cache,
- *                  USE_INDATA to use indata
- * @param cache_indata CACHE_INDATA to cache the indata,
- *                     DONT_CACHE_INDATA to keep the old data
- * @return The processed data
+ * @param datapipe The datapipe to manipulate
+ * @param type The type, must outlive the datapipe
  */
-gconstpointer execute_datapipe(datapipe_struct *const datapipe, gpointer indata)
+void datapipe_set_type(datapipe_struct *const datapipe, const datapipe_type_struct *type)
 {
-	gconstpointer data = NULL;
+	if (datapipe == NULL) {
+		sphone_log(LL_ERR, "%s called without a valid datapipe", __func__);
+		return;
+	}
 
+	datapipe->type = type;
+}
+
+/**
+ * Set the name of a datapipe, used in diagnostic output
+ *
+ * @param datapipe The datapipe to manipulate
+ * @param name A string that must outlive the datapipe
+ */
+void datapipe_set_name(datapipe_struct *const datapipe, const char *name)
+{
 	if (datapipe == NULL) {
 		sphone_log(LL_ERR, "%s called without a valid datapipe", __func__);
-		return NULL;
+		return;
 	}
 
-	data = execute_datapipe_filters(datapipe, indata);
+	datapipe->name = name;
+}
 
-	if(!data && indata)
+const char *datapipe_get_name(const datapipe_struct *const datapipe)
+{
+	if (datapipe == NULL) {
+		sphone_log(LL_ERR, "%s called without a valid datapipe", __func__);
 		return NULL;
+	}
 
-	execute_datapipe_output_triggers(datapipe, data);
+	return datapipe->name ? datapipe->name : "unnamed";
+}
 
-	datapipe->last_data = data;
+/**
+ * Enable or disable event counters and callback latency histograms on a datapipe
+ * Disabling discards the collected statistics, this must not be done from a
+ * filter or trigger of the same datapipe
+ *
+ * @param datapipe The datapipe to manipulate
+ * @param enable true to collect statistics
+ */
+void datapipe_set_stats_enabled(datapipe_struct *const datapipe, bool enable)
+{
+	if (datapipe == NULL) {
+		sphone_log(LL_ERR, "%s called without a valid datapipe", __func__);
+		return;
+	}
 
-	return data;
+	if(enable && !datapipe->stats) {
+		datapipe->stats = g_malloc0(sizeof(*datapipe->stats));
+		datapipe->stats->callbacks = g_hash_table_new_full(callback_stats_hash, callback_stats_equal, g_free, NULL);
+	} else if(!enable && datapipe->stats) {
+		g_hash_table_destroy(datapipe->stats->callbacks);
+		g_free(datapipe->stats);
+		datapipe->stats = NULL;
+	}
 }
 
-int datapipe_get_last_data_int(datapipe_struct *const datapipe)
+/**
+ * Append a human readable dump of the statistics of a datapipe to a string
+ *
+ * @param datapipe The datapipe to dump
+ * @param out The string to append to
+ * @param describe Optional function returning a newly allocated description
+ *                 of a callback, if NULL the callback address is used
+ */
+void datapipe_stats_dump(const datapipe_struct *const datapipe, GString *out,
+						 char *(*describe)(const void *callback))
 {
 	if (datapipe == NULL) {
 		sphone_log(LL_ERR, "%s called without a valid datapipe", __func__);
-		return -1;
+		return;
+	}
+
+	if(!datapipe->stats) {
+		g_string_append_printf(out, "%s: statistics disabled\n", datapipe_get_name(datapipe));
+		return;
 	}
-	return GPOINTER_TO_INT(datapipe->last_data);
+
+	g_string_append_printf(out, "%s: %llu events, %llu dropped by filters\n", datapipe_get_name(datapipe),
+						   (unsigned long long)datapipe->stats->events,
+						   (unsigned long long)datapipe->stats->dropped);
+
+	GList *callbacks = g_list_sort(g_hash_table_get_values(datapipe->stats->callbacks), callback_stats_compare);
+	for(GList *element = callbacks; element; element = element->next) {
+		const struct callback_stats *cb_stats = element->data;
+		char *description = describe ? describe(cb_stats->callback) : g_strdup_printf("%p", cb_stats->callback);
+
+		g_string_append_printf(out, "\t%s %s", cb_stats->filter ? "filter" : "trigger", description);
+		if(cb_stats->user_data)
+			g_string_append_printf(out, " (%p)", cb_stats->user_data);
+		g_string_append_printf(out, ": %llu calls, total %lluus, avg %lluus, max %lluus\n\t\t",
+							   (unsigned long long)cb_stats->count,
+							   (unsigned long long)cb_stats->total_us,
+							   (unsigned long long)(cb_stats->total_us/cb_stats->count),
+							   (unsigned long long)cb_stats->max_us);
+		for(unsigned int i = 0; i < DATAPIPE_STATS_BUCKETS; ++i) {
+			if(cb_stats->buckets[i] == 0)
+				continue;
+			if(i == DATAPIPE_STATS_BUCKETS-1)
+				g_string_append_printf(out, " >=%uus:%llu", 1u << (i-1), (unsigned long long)cb_stats->buckets[i]);
+			else
+				g_string_append_printf(out, " <%uus:%llu", 1u << i, (unsigned long long)cb_stats->buckets[i]);
+		}
+		g_string_append_c(out, '\n');
+		g_free(description);
+	}
+	g_list_free(callbacks);
 }
 
 /**
- * Append a filter to an existing datapipe
+ * Insert a filter into an existing datapipe
+ * Filters with a higher priority are executed first, filters with equal
+ * priority are executed in the order they where added
  *
  * @param datapipe The datapipe to manipulate
  * @param filter The filter to add to the datapipe
+ * @param user_data Data passed to the filter
+ * @param priority The priority of the filter, see datapipe_priority_t
  */
-void append_filter_to_datapipe(datapipe_struct *const datapipe,
+void insert_filter_to_datapipe(datapipe_struct *const datapipe,
 							   gpointer (*filter)(gpointer data, gpointer user_data),
-							   gpointer user_data)
+							   gpointer user_data, int priority)
 {
 	if (datapipe == NULL) {
 		sphone_log(LL_ERR, "%s called without a valid datapipe", __func__);
@@ -136,10 +1532,27 @@ void append_filter_to_datapipe(datapipe_struct *const datapipe,
 		return;
 	}
 	
-	struct callback *cb = g_malloc0(sizeof(*cb));
-	cb->callback = filter;
-	cb->data = user_data;
-	datapipe->filters = g_slist_append(datapipe->filters, cb);
+	struct callback entry = {
+		.callback = filter,
+		.data = user_data,
+		.priority = priority,
+		.exec = DATAPIPE_EXEC_IMMEDIATE
+	};
+	callback_array_insert(&datapipe->filters, &entry);
+}
+
+/**
+ * Append a filter to an existing datapipe with DATAPIPE_PRIORITY_DEFAULT
+ *
+ * @param datapipe The datapipe to manipulate
+ * @param filter The filter to add to the datapipe
+ * @param user_data Data passed to the filter
+ */
+void append_filter_to_datapipe(datapipe_struct *const datapipe,
+							   gpointer (*filter)(gpointer data, gpointer user_data),
+							   gpointer user_data)
+{
+	insert_filter_to_datapipe(datapipe, filter, user_data, DATAPIPE_PRIORITY_DEFAULT);
 }
 
 /**
@@ -162,16 +1575,7 @@ void remove_filter_from_datapipe(datapipe_struct *const datapipe, gpointer (*fil
 		return;
 	}
 
-	bool removed = false;
-	for (GSList *element = datapipe->filters; element; element = element->next) {
-		struct callback *cb = element->data;
-		if(cb->callback == filter && user_data == cb->data) {
-			datapipe->filters = g_slist_remove(datapipe->filters, cb);
-			g_free(cb);
-			removed = true;
-			break;
-		}
-	}
+	bool removed = callback_array_remove(&datapipe->filters, filter, user_data, NULL);
 
 	/* Did we remove any entry? */
 	if (!removed)
@@ -179,14 +1583,89 @@ void remove_filter_from_datapipe(datapipe_struct *const datapipe, gpointer (*fil
 }
 
 /**
- * Append an output trigger to an existing datapipe
+ * Insert an output trigger with an execution policy into an existing datapipe
+ * Triggers with a higher priority are executed or scheduled first, triggers
+ * with equal priority are executed in the order they where added
  *
  * @param datapipe The datapipe to manipulate
  * @param trigger The trigger to add to the datapipe
+ * @param user_data Data passed to the trigger
+ * @param priority The priority of the trigger, see datapipe_priority_t
+ * @param exec The execution policy of the trigger, deferred execution
+ *             falls back to DATAPIPE_EXEC_IMMEDIATE on datapipes without a type
  */
-void append_trigger_to_datapipe(datapipe_struct *const datapipe,
+void insert_trigger_to_datapipe_full(datapipe_struct *const datapipe,
+									 void (*trigger)(gconstpointer data, gpointer user_data),
+									 gpointer user_data, int priority, datapipe_exec_t exec)
+{
+	if (datapipe == NULL) {
+		sphone_log(LL_ERR, "%s called without a valid datapipe", __func__);
+		return;
+	}
+
+	if (trigger == NULL) {
+		sphone_log(LL_ERR, "%s called without a valid trigger", __func__);
+		return;
+	}
+
+	if (exec == DATAPIPE_EXEC_THREAD) {
+		sphone_log(LL_ERR, "%s: use insert_threaded_trigger_to_datapipe for threaded triggers", __func__);
+		return;
+	}
+
+	if (exec != DATAPIPE_EXEC_IMMEDIATE && !datapipe->type) {
+		sphone_log(LL_WARN, "%s has no type, trigger %p can not be deferred and will run immediately",
+				   datapipe_get_name(datapipe), trigger);
+		exec = DATAPIPE_EXEC_IMMEDIATE;
+	}
+
+	struct callback entry = {
+		.callback = trigger,
+		.data = user_data,
+		.priority = priority,
+		.exec = exec
+	};
+	callback_array_insert(&datapipe->output_triggers, &entry);
+}
+
+/**
+ * Insert an output trigger into an existing datapipe
+ * Triggers with a higher priority are executed first, triggers with equal
+ * priority are executed in the order they where added
+ *
+ * @param datapipe The datapipe to manipulate
+ * @param trigger The trigger to add to the datapipe
+ * @param user_data Data passed to the trigger
+ * @param priority The priority of the trigger, see datapipe_priority_t
+ */
+void insert_trigger_to_datapipe(datapipe_struct *const datapipe,
 								void (*trigger)(gconstpointer data, gpointer user_data),
-								gpointer user_data)
+								gpointer user_data, int priority)
+{
+	insert_trigger_to_datapipe_full(datapipe, trigger, user_data, priority, DATAPIPE_EXEC_IMMEDIATE);
+}
+
+/**
+ * Insert an output trigger that is run on a worker thread into an existing datapipe
+ *
+ * The trigger must be thread safe: it is called from a thread pool with a private
+ * copy of the data and may not touch state owned by the main loop, including
+ * datapipes. Events are delivered to a trigger in order, one at a time.
+ * Removing the trigger discards pending events and blocks until a running
+ * invocation has returned, see flush_trigger_of_datapipe() to deliver them first.
+ * On datapipes without a type the trigger is run immediately instead.
+ *
+ * @param datapipe The datapipe to manipulate
+ * @param trigger The thread safe trigger to add to the datapipe
+ * @param complete Optional callback run on the main loop after each invocation
+ *                 of trigger, with the same data
+ * @param user_data Data passed to trigger and complete
+ * @param priority The priority at which events are queued for the trigger
+ */
+void insert_threaded_trigger_to_datapipe(datapipe_struct *const datapipe,
+										 void (*trigger)(gconstpointer data, gpointer user_data),
+										 void (*complete)(gconstpointer data, gpointer user_data),
+										 gpointer user_data, int priority)
 {
 	if (datapipe == NULL) {
 		sphone_log(LL_ERR, "%s called without a valid datapipe", __func__);
@@ -198,15 +1677,47 @@ void append_trigger_to_datapipe(datapipe_struct *const datapipe,
 		return;
 	}
 
-	struct callback *cb = g_malloc0(sizeof(*cb));
-	cb->callback = trigger;
-	cb->data = user_data;
-	datapipe->output_triggers = g_slist_append(datapipe->output_triggers, cb);
+	if (!datapipe->type) {
+		sphone_log(LL_WARN, "%s has no type, trigger %p can not be threaded and will run immediately",
+				   datapipe_get_name(datapipe), trigger);
+		insert_trigger_to_datapipe(datapipe, trigger, user_data, priority);
+		return;
+	}
+
+	struct callback entry = {
+		.callback = trigger,
+		.data = user_data,
+		.priority = priority,
+		.exec = DATAPIPE_EXEC_THREAD,
+		.subscriber = thread_subscriber_new(datapipe, trigger, complete, user_data)
+	};
+
+	if (!entry.subscriber) {
+		insert_trigger_to_datapipe(datapipe, trigger, user_data, priority);
+		return;
+	}
+
+	callback_array_insert(&datapipe->output_triggers, &entry);
+}
+
+/**
+ * Append an output trigger to an existing datapipe with DATAPIPE_PRIORITY_DEFAULT
+ *
+ * @param datapipe The datapipe to manipulate
+ * @param trigger The trigger to add to the datapipe
+ * @param user_data Data passed to the trigger
+ */
+void append_trigger_to_datapipe(datapipe_struct *const datapipe,
+								void (*trigger)(gconstpointer data, gpointer user_data),
+								gpointer user_data)
+{
+	insert_trigger_to_datapipe(datapipe, trigger, user_data, DATAPIPE_PRIORITY_DEFAULT);
 }
 
 /**
  * Remove an output trigger from an existing datapipe
- * Non-existing triggers are ignored
+ * Non-existing triggers are ignored, pending events of a deferred trigger
+ * are discarded, see flush_trigger_of_datapipe()
  *
  * @param datapipe The datapipe to manipulate
  * @param trigger The trigger to remove from the datapipe
@@ -224,22 +1735,171 @@ void remove_trigger_from_datapipe(datapipe_struct *const datapipe, void (*trigge
 		return;
 	}
 
-	bool removed = false;
-	for (GSList *element = datapipe->output_triggers; element; element = element->next) {
-		struct callback *cb = element->data;
-		if(cb->callback == trigger && user_data == cb->data) {
-			datapipe->output_triggers = g_slist_remove(datapipe->output_triggers, cb);
-			g_free(cb);
-			removed = true;
-			break;
-		}
-	}
+	struct callback entry;
+	bool removed = callback_array_remove(&datapipe->output_triggers, trigger, user_data, &entry);
+	if (removed && entry.subscriber)
+		thread_subscriber_cancel(entry.subscriber);
+	else if (removed)
+		deferred_jobs_cancel(datapipe, trigger, user_data);
 
 	/* Did we remove any entry? */
 	if (!removed)
 		sphone_log(LL_WARN, "Trying to remove non-existing trigger. Offending callback: %p", trigger);
 }
 
+/**
+ * Deliver the events an output trigger has pending right away
+ * Deferred triggers are run for every event still waiting for its idle source,
+ * for threaded triggers this blocks until the worker threads delivered every
+ * queued event, so a trigger that must not lose events can be flushed before
+ * it is removed. Main loop only.
+ *
+ * @param datapipe The datapipe the trigger was added to
+ * @param trigger The trigger to flush
+ * @param user_data The user data the trigger was added with
+ */
+void flush_trigger_of_datapipe(datapipe_struct *const datapipe, void (*trigger)(gconstpointer data, gpointer user_data),
+							   gpointer user_data)
+{
+	if (datapipe == NULL) {
+		sphone_log(LL_ERR, "%s called without a valid datapipe", __func__);
+		return;
+	}
+
+	if (trigger == NULL) {
+		sphone_log(LL_ERR, "%s called without a valid trigger", __func__);
+		return;
+	}
+
+	struct callback_array *triggers = datapipe->output_triggers;
+	unsigned int index = triggers ? callback_array_find(triggers, trigger, user_data) : 0;
+	if (triggers && index < triggers->length && triggers->callbacks[index].subscriber)
+		thread_subscriber_drain(triggers->callbacks[index].subscriber);
+	else
+		deferred_jobs_flush(datapipe, trigger, user_data);
+}
+
+/**
+ * Enable keyed triggers on a datapipe
+ *
+ * Must be called before any keyed trigger is inserted.
+ *
+ * @param datapipe The datapipe to manipulate
+ * @param key_type The type of the keys, used to copy and free the registered keys
+ * @param hash Hash function of a key
+ * @param equal Returns true if two keys are equal
+ * @param get_key Returns the key of the data of an event, or NULL if it has none.
+ *                The key only needs to stay valid until the next call.
+ */
+void datapipe_set_key(datapipe_struct *const datapipe, const datapipe_type_struct *key_type,
+					  GHashFunc hash, GEqualFunc equal, gconstpointer (*get_key)(gconstpointer data))
+{
+	if (datapipe == NULL) {
+		sphone_log(LL_ERR, "%s called without a valid datapipe", __func__);
+		return;
+	}
+
+	if (datapipe->keys) {
+		if (g_hash_table_size(datapipe->keys->triggers) > 0) {
+			sphone_log(LL_ERR, "%s: %s still has keyed triggers", __func__, datapipe_get_name(datapipe));
+			return;
+		}
+		g_hash_table_destroy(datapipe->keys->triggers);
+		g_free(datapipe->keys);
+		datapipe->keys = NULL;
+	}
+
+	if (!key_type || !get_key)
+		return;
+
+	struct datapipe_keys *keys = g_malloc(sizeof(*keys));
+	keys->type = key_type;
+	keys->get_key = get_key;
+	keys->triggers = g_hash_table_new_full(hash, equal, NULL, keyed_triggers_free);
+	datapipe->keys = keys;
+}
+
+/**
+ * Insert an output trigger for a single key into an existing datapipe
+ * The trigger is only executed for data whose key equals key,
+ * ordered by priority among the triggers of that key
+ *
+ * @param datapipe The datapipe to manipulate, must have keys enabled with datapipe_set_key
+ * @param key The key the trigger is interested in, copied by the datapipe
+ * @param trigger The trigger to add to the datapipe
+ * @param user_data Data passed to the trigger
+ * @param priority The priority of the trigger, see datapipe_priority_t
+ */
+void insert_keyed_trigger_to_datapipe(datapipe_struct *const datapipe, gconstpointer key,
+									  void (*trigger)(gconstpointer data, gpointer user_data),
+									  gpointer user_data, int priority)
+{
+	if (datapipe == NULL) {
+		sphone_log(LL_ERR, "%s called without a valid datapipe", __func__);
+		return;
+	}
+
+	if (trigger == NULL || key == NULL) {
+		sphone_log(LL_ERR, "%s called without a valid trigger or key", __func__);
+		return;
+	}
+
+	if (!datapipe->keys) {
+		sphone_log(LL_ERR, "%s: %s has no keys", __func__, datapipe_get_name(datapipe));
+		return;
+	}
+
+	struct keyed_triggers *keyed = g_hash_table_lookup(datapipe->keys->triggers, key);
+	if (!keyed) {
+		keyed = g_malloc0(sizeof(*keyed));
+		keyed->type = datapipe->keys->type;
+		keyed->key = keyed->type->copy ? keyed->type->copy(key) : (gpointer)key;
+		g_hash_table_insert(datapipe->keys->triggers, keyed->key, keyed);
+	}
+
+	struct callback entry = {
+		.callback = trigger,
+		.data = user_data,
+		.priority = priority,
+		.exec = DATAPIPE_EXEC_IMMEDIATE
+	};
+	callback_array_insert(&keyed->triggers, &entry);
+}
+
+/**
+ * Remove a keyed output trigger from an existing datapipe
+ * Non-existing triggers are ignored
+ *
+ * @param datapipe The datapipe to manipulate
+ * @param key The key the trigger was inserted with
+ * @param trigger The trigger to remove from the datapipe
+ * @param user_data The data the trigger was inserted with
+ */
+void remove_keyed_trigger_from_datapipe(datapipe_struct *const datapipe, gconstpointer key,
+										void (*trigger)(gconstpointer data, gpointer user_data),
+										gpointer user_data)
+{
+	if (datapipe == NULL) {
+		sphone_log(LL_ERR, "%s called without a valid datapipe", __func__);
+		return;
+	}
+
+	if (trigger == NULL || key == NULL) {
+		sphone_log(LL_ERR, "%s called without a valid trigger or key", __func__);
+		return;
+	}
+
+	struct keyed_triggers *keyed = datapipe->keys ? g_hash_table_lookup(datapipe->keys->triggers, key) : NULL;
+	if (!keyed || !callback_array_remove(&keyed->triggers, trigger, user_data, NULL)) {
+		sphone_log(LL_WARN, "Trying to remove non-existing keyed trigger. Offending callback: %p", trigger);
+		return;
+	}
+
+	/* a dispatch still iterating over the removed array holds its own reference */
+	if (!keyed->triggers || keyed->triggers->length == 0)
+		g_hash_table_remove(datapipe->keys->triggers, key);
+}
+
 /**
  * Initialise a datapipe
  *
@@ -254,7 +1914,16 @@ void setup_datapipe(datapipe_struct *const datapipe)
 
 	datapipe->filters = NULL;
 	datapipe->output_triggers = NULL;
-	datapipe->last_data = NULL;
+	datapipe->cached_data = NULL;
+	datapipe->cache_enabled = false;
+	datapipe->cache_valid = false;
+	datapipe->name = NULL;
+	datapipe->stats = NULL;
+	datapipe->type = NULL;
+	datapipe->dispatch_depth = 0;
+	datapipe->coalescer = NULL;
+	datapipe->keys = NULL;
+	datapipe->record = NULL;
 }
 
 /**
@@ -272,23 +1941,42 @@ void free_datapipe(datapipe_struct *const datapipe)
 	}
 
 	/* Warn about still registered filters/triggers */
-	if (datapipe->filters != NULL) {
+	if (datapipe->filters != NULL && datapipe->filters->length > 0) {
 		sphone_log(LL_WARN,
 			"free_datapipe() called on a datapipe that "
 			"still has registered filter(s). Offending callbacks:");
-		for(GSList *element = datapipe->filters; element; element = element->next) {
-			struct callback *cb = element->data;
-			sphone_log(LL_WARN, "%p", cb->callback);
-		}
+		for(unsigned int i = 0; i < datapipe->filters->length; ++i)
+			sphone_log(LL_WARN, "%p", datapipe->filters->callbacks[i].callback);
 	}
 
-	if (datapipe->output_triggers != NULL) {
+	if (datapipe->output_triggers != NULL && datapipe->output_triggers->length > 0) {
 		sphone_log(LL_WARN,
 			"free_datapipe() called on a datapipe that "
 			"still has registered output_trigger(s). Offending callbacks:");
-		for(GSList *element = datapipe->output_triggers; element; element = element->next) {
-			struct callback *cb = element->data;
+		for(unsigned int i = 0; i < datapipe->output_triggers->length; ++i) {
+			const struct callback *cb = &datapipe->output_triggers->callbacks[i];
 			sphone_log(LL_WARN, "%p", cb->callback);
+			if(cb->subscriber)
+				thread_subscriber_cancel(cb->subscriber);
 		}
 	}
+
+	if (datapipe->keys && g_hash_table_size(datapipe->keys->triggers) > 0) {
+		sphone_log(LL_WARN,
+			"free_datapipe() called on a datapipe that "
+			"still has registered keyed output_trigger(s)");
+		g_hash_table_remove_all(datapipe->keys->triggers);
+	}
+	datapipe_set_key(datapipe, NULL, NULL, NULL, NULL);
+
+	deferred_jobs_cancel(datapipe, NULL, NULL);
+	async_events_drop(datapipe);
+	transaction_drop_datapipe(datapipe);
+	datapipe_coalescer_free(datapipe, false);
+	callback_array_unref(datapipe->filters);
+	callback_array_unref(datapipe->output_triggers);
+	datapipe->filters = NULL;
+	datapipe->output_triggers = NULL;
+	datapipe_set_stats_enabled(datapipe, false);
+	datapipe_set_cache(datapipe, false);
 }
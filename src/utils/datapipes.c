@@ -15,8 +15,16 @@
  * You should have received a copy of the GNU General Public License along
  * with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <dlfcn.h>
+#include <stdio.h>
+#include <errno.h>
 #include "datapipes.h"
 #include "sphone-conf.h"
+#include "sphone-modules.h"
+#include "sphone-log.h"
+#include "types.h"
+#include "comm.h"
+#include "storage.h"
 
 datapipe_struct audio_play_once_pipe;
 datapipe_struct audio_play_looping_pipe;
@@ -45,6 +53,9 @@ datapipe_struct contact_show_pipe;
 
 datapipe_struct comm_backend_added_pipe;
 datapipe_struct comm_backend_removed_pipe;
+datapipe_struct comm_backend_changed_pipe;
+
+datapipe_struct store_changed_pipe;
 
 void *drop(void *data, void *user_data)
 {
@@ -53,40 +64,419 @@ void *drop(void *data, void *user_data)
 	return NULL;
 }
 
+static gpointer string_copy(gconstpointer data)
+{
+	return g_strdup(data);
+}
+
+// Live calls are updated in place by the call registry, so copies are snapshots
+static gpointer call_copy(gconstpointer data)
+{
+	return call_properties_copy(data);
+}
+
+static void call_free(gpointer data)
+{
+	call_properties_unref(data);
+}
+
+static gpointer message_copy(gconstpointer data)
+{
+	return message_properties_ref(data);
+}
+
+static void message_free(gpointer data)
+{
+	message_properties_unref(data);
+}
+
+static gpointer contact_copy_data(gconstpointer data)
+{
+	return contact_copy(data);
+}
+
+static void contact_free_data(gpointer data)
+{
+	contact_unref(data);
+}
+
+static guint contact_hash_data(gconstpointer data)
+{
+	return contact_hash(data);
+}
+
+static gboolean contact_equal_data(gconstpointer a, gconstpointer b)
+{
+	return contact_cmp(a, b);
+}
+
+static gconstpointer message_contact_key(gconstpointer data)
+{
+	return contact_from_message(data);
+}
+
+static gpointer notification_copy_data(gconstpointer data)
+{
+	return notification_copy(data);
+}
+
+static void notification_free_data(gpointer data)
+{
+	notification_free(data);
+}
+
+// The strings of a StoreChange are interned, so a shallow copy is enough
+static gpointer store_change_copy(gconstpointer data)
+{
+	return g_memdup(data, sizeof(StoreChange));
+}
+
+// Keys are only used until the next one is looked up, so one contact is reused
+static gconstpointer store_change_contact_key(gconstpointer data)
+{
+	static Contact key;
+	const StoreChange *change = data;
+
+	if(!change->line_identifier)
+		return NULL;
+	key.line_identifier = change->line_identifier;
+	key.line_key = change->line_key;
+	key.backend = change->backend;
+	return &key;
+}
+
+static guint call_hash(gconstpointer data)
+{
+	return call_properties_hash(data);
+}
+
+static gboolean call_equal(gconstpointer a, gconstpointer b)
+{
+	return call_properties_comp(a, b);
+}
+
+/* Changes subscribers act on, these are never delayed by coalescing */
+static bool call_change_significant(gconstpointer last, gconstpointer data)
+{
+	const CallProperties *a = last;
+	const CallProperties *b = data;
+
+	return b->state == SPHONE_CALL_DISCONNECTED || a->state != b->state ||
+		a->answered != b->answered || a->needs_route != b->needs_route;
+}
+
+/* Keep the changes of a held event that is dropped in favour of a newer one */
+static void call_change_merge(gpointer data, gconstpointer held)
+{
+	CallProperties *call = data;
+	const CallProperties *dropped = held;
+
+	call->changes |= dropped->changes;
+}
+
+static GVariant *int_to_variant(gconstpointer data)
+{
+	return g_variant_new_int32(GPOINTER_TO_INT(data));
+}
+
+static gpointer int_from_variant(GVariant *variant)
+{
+	return g_variant_is_of_type(variant, G_VARIANT_TYPE_INT32) ? GINT_TO_POINTER(g_variant_get_int32(variant)) : NULL;
+}
+
+static GVariant *string_to_variant(gconstpointer data)
+{
+	return g_variant_new_string(data);
+}
+
+static gpointer string_from_variant(GVariant *variant)
+{
+	return g_variant_is_of_type(variant, G_VARIANT_TYPE_STRING) ? g_variant_dup_string(variant, NULL) : NULL;
+}
+
+static GVariant *call_to_variant(gconstpointer data)
+{
+	return call_properties_to_variant(data);
+}
+
+static gpointer call_from_variant(GVariant *variant)
+{
+	return call_properties_from_variant(variant);
+}
+
+static GVariant *message_to_variant(gconstpointer data)
+{
+	return message_properties_to_variant(data);
+}
+
+static gpointer message_from_variant(GVariant *variant)
+{
+	return message_properties_from_variant(variant);
+}
+
+static GVariant *contact_to_variant_data(gconstpointer data)
+{
+	return contact_to_variant(data);
+}
+
+static gpointer contact_from_variant_data(GVariant *variant)
+{
+	return contact_from_variant(variant);
+}
+
+static GVariant *notification_to_variant_data(gconstpointer data)
+{
+	return notification_to_variant(data);
+}
+
+static gpointer notification_from_variant_data(GVariant *variant)
+{
+	return notification_from_variant(variant);
+}
+
+static GVariant *comm_backend_to_variant(gconstpointer data)
+{
+	return sphone_comm_backend_to_variant(data);
+}
+
+static const datapipe_type_struct int_type = {"int", NULL, NULL, int_to_variant, int_from_variant};
+static const datapipe_type_struct string_type = {"string", string_copy, g_free, string_to_variant, string_from_variant};
+static const datapipe_type_struct call_type = {"CallProperties", call_copy, call_free, call_to_variant, call_from_variant};
+static const datapipe_type_struct message_type = {"MessageProperties", message_copy, message_free,
+												  message_to_variant, message_from_variant};
+static const datapipe_type_struct contact_type = {"Contact", contact_copy_data, contact_free_data,
+												  contact_to_variant_data, contact_from_variant_data};
+static const datapipe_type_struct notification_type = {"Notification", notification_copy_data, notification_free_data,
+													   notification_to_variant_data, notification_from_variant_data};
+static const datapipe_type_struct store_change_type = {"StoreChange", store_change_copy, g_free, NULL, NULL};
+
+/*
+ * Datapipes without a type carry data that can not be copied meaningfully,
+ * like the result pointer of audio_playing_pipe or the registry owned CommBackends.
+ * Cached datapipes carry state, their last value can be read with datapipe_get_last_data()
+ * Recorded datapipes are written to [Sphone] RecordFile if set, see the replay module
+ */
+static const struct {
+	datapipe_struct *pipe;
+	const char *name;
+	const datapipe_type_struct *type;
+	bool cached;
+	bool recorded;
+} datapipes[] = {
+	{&audio_play_once_pipe, "audio_play_once_pipe", &string_type, false, false},
+	{&audio_play_looping_pipe, "audio_play_looping_pipe", &string_type, false, false},
+	{&audio_stop_pipe, "audio_stop_pipe", &int_type, false, false},
+	{&audio_playing_pipe, "audio_playing_pipe", NULL, false, false},
+	{&audio_route_pipe, "audio_route_pipe", &int_type, true, false},
+	{&call_mode_pipe, "call_mode_pipe", &int_type, true, true},
+	{&gui_error_pipe, "gui_error_pipe", &string_type, false, false},
+	{&call_new_pipe, "call_new_pipe", &call_type, false, true},
+	{&call_hangup_pipe, "call_hangup_pipe", &call_type, false, true},
+	{&call_hold_pipe, "call_hold_pipe", &call_type, false, true},
+	{&call_dial_pipe, "call_dial_pipe", &call_type, false, true},
+	{&call_properties_changed_pipe, "call_properties_changed_pipe", &call_type, false, true},
+	{&vibrate_pipe, "vibrate_pipe", &int_type, false, false},
+	{&message_send_pipe, "message_send_pipe", &message_type, false, true},
+	{&message_received_pipe, "message_received_pipe", &message_type, false, true},
+	{&notification_raise_pipe, "notification_raise_pipe", &notification_type, false, false},
+	{&call_accept_pipe, "call_accept_pipe", &call_type, false, true},
+	{&contact_fill_pipe, "contact_fill_pipe", &contact_type, false, false},
+	{&comm_backend_added_pipe, "comm_backend_added_pipe", NULL, false, true},
+	{&comm_backend_removed_pipe, "comm_backend_removed_pipe", NULL, false, true},
+	{&comm_backend_changed_pipe, "comm_backend_changed_pipe", NULL, false, false},
+	{&store_changed_pipe, "store_changed_pipe", &store_change_type, false, false},
+};
+
+/**
+ * Find a datapipe by name
+ *
+ * @param name The name of the datapipe, e.g. "call_new_pipe"
+ * @return The datapipe or NULL if there is none with that name
+ */
+datapipe_struct *datapipes_find(const char *name)
+{
+	for(size_t i = 0; i < G_N_ELEMENTS(datapipes); ++i) {
+		if(g_strcmp0(datapipes[i].name, name) == 0)
+			return datapipes[i].pipe;
+	}
+	return NULL;
+}
+
+/*
+ * Recorder
+ *
+ * The record file is a sphone_types stream of SPHONE_TYPE_VARIANT records of
+ * type DATAPIPES_RECORD_TYPE: microseconds since the recording started, the
+ * name of the datapipe and the data of the event, if it has any.
+ * record_stream only ever holds the stream header and the record being written.
+ */
+#define DATAPIPES_RECORD_TYPE "(xsmv)"
+
+static FILE *record_file = NULL;
+static GByteArray *record_stream = NULL;
+static guint record_header_size;
+static gint64 record_start;
+
+static void datapipes_recorder_stop(void)
+{
+	datapipe_set_recorder(NULL);
+
+	if(record_file)
+		fclose(record_file);
+	record_file = NULL;
+
+	if(record_stream)
+		g_byte_array_unref(record_stream);
+	record_stream = NULL;
+}
+
+static void datapipes_record(const char *name, GVariant *data)
+{
+	GVariant *record = g_variant_ref_sink(g_variant_new(DATAPIPES_RECORD_TYPE,
+		g_get_monotonic_time() - record_start, name, data));
+
+	bool written = sphone_types_stream_append(record_stream, SPHONE_TYPE_VARIANT, record) &&
+		fwrite(record_stream->data + record_header_size, record_stream->len - record_header_size, 1, record_file) == 1;
+	g_byte_array_set_size(record_stream, record_header_size);
+	g_variant_unref(record);
+
+	if(!written) {
+		sphone_log(LL_ERR, "%s: failed to write record, recording stopped", __func__);
+		datapipes_recorder_stop();
+	}
+}
+
+static bool datapipes_recorder_start(const char *path)
+{
+	record_file = fopen(path, "wb");
+	if(!record_file) {
+		sphone_log(LL_ERR, "%s: can not open %s: %s", __func__, path, g_strerror(errno));
+		return false;
+	}
+
+	record_stream = g_byte_array_new();
+	sphone_types_stream_begin(record_stream);
+	record_header_size = record_stream->len;
+	if(fwrite(record_stream->data, record_stream->len, 1, record_file) != 1) {
+		sphone_log(LL_ERR, "%s: can not write to %s: %s", __func__, path, g_strerror(errno));
+		datapipes_recorder_stop();
+		return false;
+	}
+
+	record_start = g_get_monotonic_time();
+	datapipe_set_recorder(datapipes_record);
+	sphone_log(LL_INFO, "Recording datapipe events to %s", path);
+	return true;
+}
+
+/**
+ * Load a file written by the recorder
+ *
+ * @param path The file to load
+ * @return An array of GVariant records of type (xsmv): time in us, datapipe name
+ *         and data, or NULL on error. Free with g_ptr_array_unref()
+ */
+GPtrArray *datapipes_record_load(const char *path)
+{
+	GError *error = NULL;
+	GMappedFile *file = g_mapped_file_new(path, FALSE, &error);
+	if(!file) {
+		sphone_log(LL_ERR, "%s: can not open %s: %s", __func__, path, error->message);
+		g_error_free(error);
+		return NULL;
+	}
+
+	GBytes *bytes = g_mapped_file_get_bytes(file);
+	g_mapped_file_unref(file);
+
+	SphoneTypesStream stream;
+	bool valid = sphone_types_stream_init(&stream, bytes);
+	g_bytes_unref(bytes);
+	if(!valid) {
+		sphone_log(LL_ERR, "%s: %s is not a datapipe record file", __func__, path);
+		return NULL;
+	}
+
+	GPtrArray *records = g_ptr_array_new_with_free_func((GDestroyNotify)g_variant_unref);
+	sphone_type_tag_t tag;
+	gpointer data;
+	while((data = sphone_types_stream_next(&stream, &tag))) {
+		if(tag == SPHONE_TYPE_VARIANT && g_variant_is_of_type(data, G_VARIANT_TYPE(DATAPIPES_RECORD_TYPE))) {
+			g_ptr_array_add(records, data);
+		} else {
+			sphone_log(LL_WARN, "%s: skipping a record of unexpected type in %s", __func__, path);
+			sphone_types_free(tag, data);
+		}
+	}
+	sphone_types_stream_clear(&stream);
+
+	return records;
+}
+
+static char *datapipes_describe_callback(const void *callback)
+{
+	const char *module = sphone_module_get_name_for_address(callback);
+	Dl_info info;
+
+	if(dladdr(callback, &info) != 0 && info.dli_sname)
+		return g_strdup_printf("%s:%s", module ?: "core", info.dli_sname);
+	return g_strdup_printf("%s:%p", module ?: "core", callback);
+}
+
+/**
+ * Dump the statistics of all datapipes
+ * Statistics are only collected when [Sphone] DatapipeStats is set
+ *
+ * @return A newly allocated string
+ */
+char *datapipes_dump_stats(void)
+{
+	GString *out = g_string_new(NULL);
+
+	for(size_t i = 0; i < G_N_ELEMENTS(datapipes); ++i)
+		datapipe_stats_dump(datapipes[i].pipe, out, datapipes_describe_callback);
+
+	return g_string_free(out, FALSE);
+}
+
 void datapipes_init(void)
 {
-	setup_datapipe(&audio_play_once_pipe);
-	setup_datapipe(&audio_play_looping_pipe);
-	setup_datapipe(&audio_stop_pipe);
-	setup_datapipe(&audio_playing_pipe);
-	setup_datapipe(&audio_route_pipe);
-	setup_datapipe(&call_mode_pipe);
-	setup_datapipe(&gui_error_pipe);
-	setup_datapipe(&call_new_pipe);
-	setup_datapipe(&call_hangup_pipe);
-	setup_datapipe(&call_hold_pipe);
-	setup_datapipe(&call_dial_pipe);
-	setup_datapipe(&call_properties_changed_pipe);
-	setup_datapipe(&vibrate_pipe);
-	setup_datapipe(&message_send_pipe);
-	setup_datapipe(&message_received_pipe);
-	setup_datapipe(&notification_raise_pipe);
-	setup_datapipe(&call_accept_pipe);
-	setup_datapipe(&contact_fill_pipe);
-	setup_datapipe(&comm_backend_added_pipe);
-	setup_datapipe(&comm_backend_removed_pipe);
+	bool stats = sphone_conf_get_bool("Sphone", "DatapipeStats", FALSE, NULL);
+	int call_coalesce_ms = sphone_conf_get_int("Sphone", "CallCoalesceWindow", 0, NULL);
+	char *record_path = sphone_conf_get_string("Sphone", "RecordFile", NULL, NULL);
+	bool record = record_path && datapipes_recorder_start(record_path);
+	g_free(record_path);
+
+	for(size_t i = 0; i < G_N_ELEMENTS(datapipes); ++i) {
+		setup_datapipe(datapipes[i].pipe);
+		datapipe_set_name(datapipes[i].pipe, datapipes[i].name);
+		datapipe_set_type(datapipes[i].pipe, datapipes[i].type);
+		datapipe_set_cache(datapipes[i].pipe, datapipes[i].cached);
+		datapipe_set_stats_enabled(datapipes[i].pipe, stats);
+		if(record && datapipes[i].recorded)
+			datapipe_set_recorded(datapipes[i].pipe, datapipes[i].type ? datapipes[i].type->to_variant : comm_backend_to_variant);
+	}
+
+	/* message threads subscribe to the messages and store changes of a single contact */
+	datapipe_set_key(&message_send_pipe, &contact_type, contact_hash_data, contact_equal_data, message_contact_key);
+	datapipe_set_key(&message_received_pipe, &contact_type, contact_hash_data, contact_equal_data, message_contact_key);
+	datapipe_set_key(&store_changed_pipe, &contact_type, contact_hash_data, contact_equal_data, store_change_contact_key);
+
+	if(call_coalesce_ms > 0)
+		datapipe_set_coalescing(&call_properties_changed_pipe, call_coalesce_ms,
+								call_hash, call_equal, call_change_significant, call_change_merge);
 
 	if(!(sphone_conf_get_features() & SPHONE_FEATURE_CALLS)) {
-		append_filter_to_datapipe(&call_new_pipe, drop, NULL);
-		append_filter_to_datapipe(&call_hangup_pipe, drop, NULL);
-		append_filter_to_datapipe(&call_hold_pipe, drop, NULL);
-		append_filter_to_datapipe(&call_dial_pipe, drop, NULL);
-		append_filter_to_datapipe(&call_properties_changed_pipe, drop, NULL);
+		insert_filter_to_datapipe(&call_new_pipe, drop, NULL, DATAPIPE_PRIORITY_HIGHEST);
+		insert_filter_to_datapipe(&call_hangup_pipe, drop, NULL, DATAPIPE_PRIORITY_HIGHEST);
+		insert_filter_to_datapipe(&call_hold_pipe, drop, NULL, DATAPIPE_PRIORITY_HIGHEST);
+		insert_filter_to_datapipe(&call_dial_pipe, drop, NULL, DATAPIPE_PRIORITY_HIGHEST);
+		insert_filter_to_datapipe(&call_properties_changed_pipe, drop, NULL, DATAPIPE_PRIORITY_HIGHEST);
 	}
 
 	if(!(sphone_conf_get_features() & SPHONE_FEATURE_MESSAGES)) {
-		append_filter_to_datapipe(&message_send_pipe, drop, NULL);
-		append_filter_to_datapipe(&message_received_pipe, drop, NULL);
+		insert_filter_to_datapipe(&message_send_pipe, drop, NULL, DATAPIPE_PRIORITY_HIGHEST);
+		insert_filter_to_datapipe(&message_received_pipe, drop, NULL, DATAPIPE_PRIORITY_HIGHEST);
 	}
 }
 
@@ -105,24 +495,8 @@ void datapipes_exit(void)
 		remove_filter_from_datapipe(&message_received_pipe, drop, NULL);
 	}
 
-	free_datapipe(&audio_play_once_pipe);
-	free_datapipe(&audio_play_looping_pipe);
-	free_datapipe(&audio_stop_pipe);
-	free_datapipe(&audio_playing_pipe);
-	free_datapipe(&audio_route_pipe);
-	free_datapipe(&call_mode_pipe);
-	free_datapipe(&call_new_pipe);
-	free_datapipe(&call_hangup_pipe);
-	free_datapipe(&call_hold_pipe);
-	free_datapipe(&call_dial_pipe);
-	free_datapipe(&gui_error_pipe);
-	free_datapipe(&call_properties_changed_pipe);
-	free_datapipe(&vibrate_pipe);
-	free_datapipe(&message_send_pipe);
-	free_datapipe(&message_received_pipe);
-	free_datapipe(&notification_raise_pipe);
-	free_datapipe(&call_accept_pipe);
-	free_datapipe(&contact_fill_pipe);
-	free_datapipe(&comm_backend_added_pipe);
-	free_datapipe(&comm_backend_removed_pipe);
+	datapipes_recorder_stop();
+
+	for(size_t i = 0; i < G_N_ELEMENTS(datapipes); ++i)
+		free_datapipe(datapipes[i].pipe);
 }
@@ -0,0 +1,243 @@
+/*
+ * phonenumber.c
+ * Copyright (C) Carl Philipp Klemm 2021 <carl@uvos.xyz>
+ *
+ * phonenumber.c is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * phonenumber.c is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdbool.h>
+#include <string.h>
+#include <langinfo.h>
+#include <glib.h>
+#include "phonenumber.h"
+#include "types.h"
+#include "sphone-conf.h"
+#include "sphone-log.h"
+
+#define PHONE_NUMBER_GROUP "PhoneNumbers"
+#define PHONE_NUMBER_MAX_DIGITS 31
+#define PHONE_NUMBER_MAX_COUNTRY_CODE 3
+
+enum {
+	CH_OTHER = 0,
+	CH_DIGIT,
+	CH_SEPARATOR,
+	CH_PLUS,
+};
+
+// Characters not listed here make a line identifier not a phone number
+static const unsigned char char_class[256] = {
+	['0' ... '9'] = CH_DIGIT,
+	[' '] = CH_SEPARATOR,
+	['-'] = CH_SEPARATOR,
+	['.'] = CH_SEPARATOR,
+	['/'] = CH_SEPARATOR,
+	['('] = CH_SEPARATOR,
+	[')'] = CH_SEPARATOR,
+	['+'] = CH_PLUS,
+};
+
+struct phone_number_rules {
+	char *country_code;
+	char *trunk_prefix;
+	char *international_prefix;
+};
+
+G_LOCK_DEFINE_STATIC(keys);
+// Interned line identifiers to their interned keys
+static GHashTable *keys;
+static struct phone_number_rules rules;
+
+/*
+ * Copy the digits of a phone number to digits
+ *
+ * @return The number of digits or -1 if str is not a phone number
+ */
+static int phone_number_extract_digits(const char *str, char *digits, bool *plus)
+{
+	int count = 0;
+	*plus = false;
+
+	for(const unsigned char *ch = (const unsigned char*)str; *ch; ++ch) {
+		switch(char_class[*ch]) {
+			case CH_DIGIT:
+				if(count == PHONE_NUMBER_MAX_DIGITS)
+					return -1;
+				digits[count++] = *ch;
+				break;
+			case CH_SEPARATOR:
+				break;
+			case CH_PLUS:
+				if(*plus || count > 0)
+					return -1;
+				*plus = true;
+				break;
+			default:
+				return -1;
+		}
+	}
+
+	digits[count] = '\0';
+	return count;
+}
+
+static const char *phone_number_strip_prefix(const char *digits, const char *prefix)
+{
+	if(!prefix || !*prefix || !g_str_has_prefix(digits, prefix) || !digits[strlen(prefix)])
+		return NULL;
+	return digits + strlen(prefix);
+}
+
+static const char *phone_number_compute_key(const char *line_identifier)
+{
+	char digits[PHONE_NUMBER_MAX_DIGITS+1];
+	char key[PHONE_NUMBER_MAX_COUNTRY_CODE+PHONE_NUMBER_MAX_DIGITS+2];
+	bool plus;
+
+	if(phone_number_extract_digits(line_identifier, digits, &plus) <= 0)
+		return line_identifier;
+
+	const char *national;
+	if(plus)
+		g_snprintf(key, sizeof(key), "+%s", digits);
+	else if((national = phone_number_strip_prefix(digits, rules.international_prefix)))
+		g_snprintf(key, sizeof(key), "+%s", national);
+	else if(rules.country_code && (national = phone_number_strip_prefix(digits, rules.trunk_prefix)))
+		g_snprintf(key, sizeof(key), "+%s%s", rules.country_code, national);
+	else
+		return sphone_intern(digits);
+
+	return sphone_intern(key);
+}
+
+/**
+ * Get the canonical key of a line identifier
+ *
+ * @param line_identifier The line identifier, need not be interned
+ * @return The interned key or NULL if line_identifier is NULL
+ */
+const char *sphone_phone_number_key(const char *line_identifier)
+{
+	if(!line_identifier)
+		return NULL;
+	line_identifier = sphone_intern(line_identifier);
+
+	G_LOCK(keys);
+	if(!keys)
+		keys = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	const char *key = g_hash_table_lookup(keys, line_identifier);
+	if(!key) {
+		key = phone_number_compute_key(line_identifier);
+		g_hash_table_insert(keys, (gpointer)line_identifier, (gpointer)key);
+	}
+	G_UNLOCK(keys);
+
+	return key;
+}
+
+/**
+ * Get the E.164 form of a line identifier
+ *
+ * The E.164 form is the key of phone numbers whose country is known,
+ * so it is computed and cached along with the key.
+ *
+ * @param line_identifier The line identifier, need not be interned
+ * @return The interned E.164 number or NULL if line_identifier is not a
+ *         phone number or its country is unknown
+ */
+const char *sphone_phone_number_e164(const char *line_identifier)
+{
+	const char *key = sphone_phone_number_key(line_identifier);
+	return key && key[0] == '+' ? key : NULL;
+}
+
+static bool phone_number_valid_prefix(const char *prefix, size_t max_length)
+{
+	size_t length = strlen(prefix);
+	if(length == 0 || length > max_length)
+		return false;
+	for(size_t i = 0; i < length; ++i) {
+		if(char_class[(unsigned char)prefix[i]] != CH_DIGIT)
+			return false;
+	}
+	return true;
+}
+
+static char *phone_number_get_prefix(const char *key, const char *defaultval, size_t max_length)
+{
+	char *prefix = sphone_conf_get_string(PHONE_NUMBER_GROUP, key, defaultval, NULL);
+	if(prefix && !phone_number_valid_prefix(prefix, max_length)) {
+		sphone_log(LL_WARN, "%s: ignoring invalid %s %s", __func__, key, prefix);
+		g_free(prefix);
+		prefix = NULL;
+	}
+	return prefix;
+}
+
+/* Prefixes of the country of the LC_TELEPHONE locale, NULL if unknown */
+static void phone_number_locale_prefixes(const char **country_code, const char **international_prefix)
+{
+	*country_code = NULL;
+	*international_prefix = NULL;
+#ifdef __GLIBC__
+	const char *value = nl_langinfo(_NL_TELEPHONE_INT_PREFIX);
+	if(value && *value)
+		*country_code = value;
+	value = nl_langinfo(_NL_TELEPHONE_INT_SELECT);
+	if(value && *value)
+		*international_prefix = value;
+#endif
+}
+
+void sphone_phone_number_init(void)
+{
+	const char *locale_country_code;
+	const char *locale_international_prefix;
+	phone_number_locale_prefixes(&locale_country_code, &locale_international_prefix);
+
+	// Without configuration the country of the locale is used, e.g. 49 and 00 for de_DE
+	struct phone_number_rules new_rules = {
+		.country_code = phone_number_get_prefix("CountryCode", locale_country_code, PHONE_NUMBER_MAX_COUNTRY_CODE),
+		.trunk_prefix = phone_number_get_prefix("TrunkPrefix", "0", PHONE_NUMBER_MAX_DIGITS),
+		.international_prefix = phone_number_get_prefix("InternationalPrefix",
+			locale_international_prefix ?: "00", PHONE_NUMBER_MAX_DIGITS),
+	};
+
+	sphone_log(LL_DEBUG, "%s: country code %s trunk prefix %s international prefix %s", __func__,
+			   new_rules.country_code ?: "none", new_rules.trunk_prefix ?: "none",
+			   new_rules.international_prefix ?: "none");
+
+	G_LOCK(keys);
+	g_free(rules.country_code);
+	g_free(rules.trunk_prefix);
+	g_free(rules.international_prefix);
+	rules = new_rules;
+	// Keys computed with the old rules are stale
+	if(keys)
+		g_hash_table_remove_all(keys);
+	G_UNLOCK(keys);
+}
+
+void sphone_phone_number_exit(void)
+{
+	G_LOCK(keys);
+	g_free(rules.country_code);
+	g_free(rules.trunk_prefix);
+	g_free(rules.international_prefix);
+	memset(&rules, 0, sizeof(rules));
+	if(keys)
+		g_hash_table_destroy(keys);
+	keys = NULL;
+	G_UNLOCK(keys);
+}
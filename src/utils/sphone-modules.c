@@ -20,6 +20,7 @@
 
 #include <glib.h>
 #include <gmodule.h>
+#include <dlfcn.h>
 #include "sphone-modules.h"
 #include "sphone-log.h"
 #include "sphone-conf.h"
@@ -40,6 +41,29 @@ static module_info_struct *sphone_modules_get_info(struct sphone_module *module)
 	return (module_info_struct*)mip;
 }
 
+/**
+ * Find the module that contains a given address, e.g. a datapipe callback
+ *
+ * @param address The address to look up
+ * @return The name of the module or NULL if the address is not part of a loaded module
+ */
+const char *sphone_module_get_name_for_address(const void *address)
+{
+	Dl_info address_info;
+
+	if(!address || dladdr(address, &address_info) == 0)
+		return NULL;
+
+	for (GSList *element = modules; element; element = element->next) {
+		module_info_struct *info = sphone_modules_get_info(element->data);
+		Dl_info module_info;
+		if(info && dladdr(info, &module_info) != 0 && module_info.dli_fbase == address_info.dli_fbase)
+			return info->name;
+	}
+
+	return NULL;
+}
+
 static char *sphone_modules_build_module_filename(const char *name)
 {
 	return g_strconcat("lib", name, ".", G_MODULE_SUFFIX, NULL);
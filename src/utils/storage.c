@@ -15,13 +15,29 @@
  * You should have received a copy of the GNU General Public License along
  * with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <stdlib.h>
+#include <string.h>
 #include "storage.h"
 #include "sphone-log.h"
 #include "datapipes.h"
 #include "datapipe.h"
+#include "contacts.h"
 
 GList *(*get_messages_for_contact_backend)(Contact *contact, unsigned int limit);
 GList *(*get_calls_for_contact_backend)(Contact *contact, unsigned int limit);
+static const StoreCursorBackend *cursor_backend;
+static GList *(*get_conversations_backend)(void);
+/* cursors are closed when their backend goes away, they then read as at the end */
+static GSList *open_cursors;
+
+struct _StoreCursor {
+	const StoreCursorBackend *backend;
+	void *stream;
+	store_event_t type;
+	store_sort_t sort;
+	gint64 position;
+	bool at_end;
+};
 
 int store_register_backend(GList *(*get_messages_for_contact)(Contact *contact, unsigned int limit),
 						   GList *(*get_calls_for_contact)(Contact *contact, unsigned int limit))
@@ -31,8 +47,184 @@ int store_register_backend(GList *(*get_messages_for_contact)(Contact *contact,
 	return 0;
 }
 
+int store_register_cursor_backend(const StoreCursorBackend *backend)
+{
+	cursor_backend = backend;
+	return 0;
+}
+
+int store_register_conversation_backend(GList *(*get_conversations)(void))
+{
+	get_conversations_backend = get_conversations;
+	return 0;
+}
+
+static char store_event_token_char(store_event_t type)
+{
+	return type == STORE_EVENT_MESSAGE ? 'm' : 'c';
+}
+
+static char store_sort_token_char(store_sort_t sort)
+{
+	return sort == STORE_SORT_OLDEST_FIRST ? 'o' : 'n';
+}
+
+static bool store_parse_resume_token(const char *token, store_event_t type, store_sort_t sort, gint64 *position)
+{
+	if(token[0] != store_event_token_char(type) ||
+	   token[1] != store_sort_token_char(sort) || token[2] != ':')
+		return false;
+
+	char *end;
+	long long value = strtoll(token+3, &end, 10);
+	if(end == token+3 || *end || value < -1)
+		return false;
+
+	*position = value;
+	return true;
+}
+
+void store_query_init(StoreQuery *query, store_event_t type)
+{
+	memset(query, 0, sizeof(*query));
+	query->type = type;
+	query->backend = -1;
+}
+
+static StoreCursor *store_cursor_open(const StoreQuery *query, store_sort_t sort, gint64 position)
+{
+	if(!cursor_backend) {
+		sphone_log(LL_ERR, "%s used without backend", __func__);
+		return NULL;
+	}
+
+	void *stream = cursor_backend->open(query, sort, position);
+	if(!stream)
+		return NULL;
+
+	StoreCursor *cursor = g_new0(StoreCursor, 1);
+	cursor->backend = cursor_backend;
+	cursor->stream = stream;
+	cursor->type = query->type;
+	cursor->sort = sort;
+	cursor->position = position;
+	open_cursors = g_slist_prepend(open_cursors, cursor);
+	return cursor;
+}
+
+StoreCursor *store_cursor_new_for_query(const StoreQuery *query, store_sort_t sort, const char *resume_token)
+{
+	gint64 position = -1;
+	if(resume_token && !store_parse_resume_token(resume_token, query->type, sort, &position)) {
+		sphone_log(LL_WARN, "%s: invalid resume token %s", __func__, resume_token);
+		return NULL;
+	}
+
+	return store_cursor_open(query, sort, position);
+}
+
+StoreCursor *store_cursor_new(store_event_t type, const Contact *contact, store_sort_t sort, const char *resume_token)
+{
+	StoreQuery query;
+	store_query_init(&query, type);
+	query.contact = contact;
+	return store_cursor_new_for_query(&query, sort, resume_token);
+}
+
+GList *store_cursor_next_page(StoreCursor *cursor, unsigned int page_size)
+{
+	if(cursor->at_end)
+		return NULL;
+
+	GList *rows = NULL;
+	unsigned int count = 0;
+	while(count < page_size) {
+		gint64 position;
+		void *row = cursor->backend->next(cursor->stream, &position);
+		if(!row) {
+			cursor->at_end = true;
+			break;
+		}
+		cursor->position = position;
+		rows = g_list_prepend(rows, row);
+		++count;
+	}
+
+	if(!cursor->at_end && cursor->backend->suspend)
+		cursor->backend->suspend(cursor->stream);
+
+	return g_list_reverse(rows);
+}
+
+bool store_cursor_at_end(const StoreCursor *cursor)
+{
+	return cursor->at_end;
+}
+
+char *store_cursor_get_resume_token(const StoreCursor *cursor)
+{
+	return g_strdup_printf("%c%c:%lld", store_event_token_char(cursor->type),
+						   store_sort_token_char(cursor->sort), (long long)cursor->position);
+}
+
+gint64 store_cursor_get_position(const StoreCursor *cursor)
+{
+	return cursor->position;
+}
+
+void store_cursor_free(StoreCursor *cursor)
+{
+	if(!cursor)
+		return;
+	open_cursors = g_slist_remove(open_cursors, cursor);
+	if(cursor->backend)
+		cursor->backend->close(cursor->stream);
+	g_free(cursor);
+}
+
+static GList *store_get_all_from_cursor(store_event_t type, Contact *contact, unsigned int limit)
+{
+	StoreCursor *cursor = store_cursor_new(type, contact, STORE_SORT_NEWEST_FIRST, NULL);
+	if(!cursor)
+		return NULL;
+	GList *rows = store_cursor_next_page(cursor, limit > 0 ? limit : G_MAXUINT);
+	store_cursor_free(cursor);
+	return rows;
+}
+
+static GList *store_get_since(store_event_t type, Contact *contact, gint64 position, gint64 *last_position)
+{
+	StoreQuery query;
+	store_query_init(&query, type);
+	query.contact = contact;
+
+	GList *rows = NULL;
+	StoreCursor *cursor = store_cursor_open(&query, STORE_SORT_OLDEST_FIRST, position);
+	if(cursor) {
+		rows = store_cursor_next_page(cursor, G_MAXUINT);
+		position = cursor->position;
+		store_cursor_free(cursor);
+	}
+
+	if(last_position)
+		*last_position = position;
+	return rows;
+}
+
+GList *store_get_calls_since(Contact *contact, gint64 position, gint64 *last_position)
+{
+	return store_get_since(STORE_EVENT_CALL, contact, position, last_position);
+}
+
+GList *store_get_messages_since(Contact *contact, gint64 position, gint64 *last_position)
+{
+	return store_get_since(STORE_EVENT_MESSAGE, contact, position, last_position);
+}
+
 GList *store_get_messages_for_contact(Contact *contact, unsigned int limit)
 {
+	if(cursor_backend)
+		return store_get_all_from_cursor(STORE_EVENT_MESSAGE, contact, limit);
 	if(!get_messages_for_contact_backend) {
 		sphone_log(LL_ERR, "%s used without backend", __func__);
 		return NULL;
@@ -42,6 +234,8 @@ GList *store_get_messages_for_contact(Contact *contact, unsigned int limit)
 
 GList *store_get_calls_for_contact(Contact *contact, unsigned int limit)
 {
+	if(cursor_backend)
+		return store_get_all_from_cursor(STORE_EVENT_CALL, contact, limit);
 	if(!get_calls_for_contact_backend) {
 		sphone_log(LL_ERR, "%s used without backend", __func__);
 		return NULL;
@@ -49,34 +243,45 @@ GList *store_get_calls_for_contact(Contact *contact, unsigned int limit)
 	return get_calls_for_contact_backend(contact, limit);
 }
 
-static bool store_is_contact_in_list(GList *contacts, const char* line_id, int backend)
+static bool store_is_contact_in_list(GList *contacts, const Contact *needle)
 {
 	for(GList *element = contacts; element; element = element->next) {
-		Contact* contact = element->data;
-		if(contact->backend == backend && g_strcmp0(contact->line_identifier, line_id) == 0)
+		if(contact_cmp(element->data, needle))
 			return true;
 	}
 	return false;
 }
 
+GList *store_get_conversations(void)
+{
+	if(!get_conversations_backend) {
+		sphone_log(LL_ERR, "%s used without backend", __func__);
+		return NULL;
+	}
+	return get_conversations_backend();
+}
+
 GList *store_get_interacted_msg_contacts(void)
 {
+	if(get_conversations_backend) {
+		GList *conversations = get_conversations_backend();
+		GList *contacts = NULL;
+		for(GList *element = conversations; element; element = element->next) {
+			StoreConversation *conversation = element->data;
+			if(conversation->contact)
+				contacts = g_list_prepend(contacts, contact_ref(conversation->contact));
+		}
+		store_free_conversation_list(conversations);
+		return g_list_reverse(contacts);
+	}
+
 	GList *messages = store_get_messages(0);
 	GList *contacts = NULL;
 	for(GList *element = messages; element; element = element->next) {
 		MessageProperties* msg = element->data;
-		if(!store_is_contact_in_list(contacts, msg->line_identifier, msg->backend)) {
-			if(msg->contact && msg->contact->line_identifier) {
-				if(!msg->contact->name)
-					execute_datapipe_filters(&contact_fill_pipe, msg->contact);
-				contacts = g_list_append(contacts, contact_copy(msg->contact));
-			} else {
-				Contact *contact = g_malloc0(sizeof(*contact));
-				contact->line_identifier = g_strdup(msg->line_identifier);
-				contact->backend = msg->backend;
-				execute_datapipe_filters(&contact_fill_pipe, contact);
-				contacts = g_list_append(contacts, contact);
-			}
+		if(msg->line_identifier && !store_is_contact_in_list(contacts, contact_from_message(msg))) {
+			const char *name = msg->contact ? msg->contact->name : NULL;
+			contacts = g_list_append(contacts, sphone_contacts_get(msg->backend, msg->line_identifier, name));
 		}
 	}
 	store_free_message_list(messages);
@@ -96,25 +301,50 @@ GList *store_get_messages(unsigned int limit)
 void store_free_call_list(GList *list)
 {
 	for(GList *element = list; element; element = element->next)
-		call_properties_free(element->data);
+		call_properties_unref(element->data);
 	g_list_free(list);
 }
 
 void store_free_contacts_list(GList *list)
 {
 	for(GList *element = list; element; element = element->next)
-		contact_free(element->data);
+		contact_unref(element->data);
+	g_list_free(list);
+}
+
+void store_free_conversation_list(GList *list)
+{
+	for(GList *element = list; element; element = element->next) {
+		StoreConversation *conversation = element->data;
+		if(conversation->contact)
+			contact_unref(conversation->contact);
+		g_free(conversation->last_text);
+		g_free(conversation);
+	}
 	g_list_free(list);
 }
 
 void store_free_message_list(GList *list)
 {
 	for(GList *element = list; element; element = element->next)
-		message_properties_free(element->data);
+		message_properties_unref(element->data);
 	g_list_free(list);
 }
 
 void store_unregister_backend(int id)
 {
 	(void)id;
+	for(GSList *element = open_cursors; element; element = element->next) {
+		StoreCursor *cursor = element->data;
+		cursor->backend->close(cursor->stream);
+		cursor->backend = NULL;
+		cursor->stream = NULL;
+		cursor->at_end = true;
+	}
+	g_slist_free(open_cursors);
+	open_cursors = NULL;
+	cursor_backend = NULL;
+	get_conversations_backend = NULL;
+	get_messages_for_contact_backend = NULL;
+	get_calls_for_contact_backend = NULL;
 }
@@ -15,9 +15,11 @@
  * You should have received a copy of the GNU General Public License along
  * with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <string.h>
 #include "types.h"
 #include "sphone-log.h"
 #include "comm.h"
+#include "phonenumber.h"
 
 const char *sphone_get_state_string(sphone_call_state_t state)
 {
@@ -41,22 +43,88 @@ const char *sphone_get_state_string(sphone_call_state_t state)
 	}
 }
 
-void contact_free(Contact *contact)
+G_LOCK_DEFINE_STATIC(interned);
+static GHashTable *interned;
+static GStringChunk *interned_chunk;
+
+static const char *sphone_intern_locked(const char *str, bool insert)
 {
-	if(!contact)
+	if(!interned) {
+		if(!insert)
+			return NULL;
+		interned = g_hash_table_new(g_str_hash, g_str_equal);
+		interned_chunk = g_string_chunk_new(1024);
+	}
+
+	char *canonical = g_hash_table_lookup(interned, str);
+	if(!canonical && insert) {
+		canonical = g_string_chunk_insert(interned_chunk, str);
+		g_hash_table_add(interned, canonical);
+	}
+	return canonical;
+}
+
+const char *sphone_intern(const char *str)
+{
+	if(!str)
+		return NULL;
+	G_LOCK(interned);
+	const char *canonical = sphone_intern_locked(str, true);
+	G_UNLOCK(interned);
+	return canonical;
+}
+
+const char *sphone_intern_lookup(const char *str)
+{
+	if(!str)
+		return NULL;
+	G_LOCK(interned);
+	const char *canonical = sphone_intern_locked(str, false);
+	G_UNLOCK(interned);
+	return canonical;
+}
+
+static inline const char *line_key(const char *key, const char *line_identifier)
+{
+	return key ?: sphone_phone_number_key(line_identifier);
+}
+
+Contact *contact_new(void)
+{
+	Contact *contact = g_malloc0(sizeof(*contact));
+	g_atomic_ref_count_init(&contact->ref_count);
+	return contact;
+}
+
+Contact *contact_ref(const Contact *contact)
+{
+	Contact *shared = (Contact*)contact;
+	g_atomic_ref_count_inc(&shared->ref_count);
+	return shared;
+}
+
+void contact_unref(Contact *contact)
+{
+	if(!contact || !g_atomic_ref_count_dec(&contact->ref_count))
 		return;
 	g_free(contact->name);
-	g_free(contact->line_identifier);
 	g_free(contact);
 }
 
+/**
+ * Copy a contact to keep it, contacts of the contact registry are referenced instead
+ */
 Contact *contact_copy(const Contact *contact)
 {
 	if(!contact)
 		return NULL;
-	Contact *new_contact = g_malloc0(sizeof(*new_contact));
+	if(contact->shared)
+		return contact_ref(contact);
+	Contact *new_contact = contact_new();
 	new_contact->name = g_strdup(contact->name);
-	new_contact->line_identifier = g_strdup(contact->line_identifier);
+	new_contact->line_identifier = contact->line_identifier;
+	new_contact->line_key = line_key(contact->line_key, contact->line_identifier);
+	new_contact->line_identifier_field = contact->line_identifier_field;
 	new_contact->backend = contact->backend;
 	return new_contact;
 }
@@ -65,7 +133,53 @@ bool contact_cmp(const Contact *a, const Contact *b)
 {
 	if(!a || !b)
 		return !a && !b;
-	return a->backend == b->backend && g_strcmp0(a->line_identifier, b->line_identifier) == 0;
+	return a->backend == b->backend &&
+		line_key(a->line_key, a->line_identifier) == line_key(b->line_key, b->line_identifier);
+}
+
+unsigned int contact_hash(const Contact *contact)
+{
+	return g_direct_hash(line_key(contact->line_key, contact->line_identifier)) ^ (unsigned int)contact->backend;
+}
+
+#define CONTACT_VARIANT_TYPE "(msmsii)"
+
+GVariant *contact_to_variant(const Contact *contact)
+{
+	return g_variant_new(CONTACT_VARIANT_TYPE, contact->name, contact->line_identifier,
+						 (gint32)contact->line_identifier_field, (gint32)contact->backend);
+}
+
+Contact *contact_from_variant(GVariant *variant)
+{
+	if(!g_variant_is_of_type(variant, G_VARIANT_TYPE(CONTACT_VARIANT_TYPE)))
+		return NULL;
+
+	Contact *contact = contact_new();
+	const char *line_identifier;
+	gint32 field;
+	gint32 backend;
+	g_variant_get(variant, "(msm&sii)", &contact->name, &line_identifier, &field, &backend);
+	contact->line_identifier = sphone_intern(line_identifier);
+	contact->line_key = sphone_phone_number_key(line_identifier);
+	contact->line_identifier_field = field;
+	contact->backend = backend;
+	return contact;
+}
+
+static GVariant *contact_to_maybe_variant(const Contact *contact)
+{
+	return g_variant_new_maybe(G_VARIANT_TYPE(CONTACT_VARIANT_TYPE), contact ? contact_to_variant(contact) : NULL);
+}
+
+static Contact *contact_from_maybe_variant(GVariant *variant)
+{
+	GVariant *child = g_variant_get_maybe(variant);
+	if(!child)
+		return NULL;
+	Contact *contact = contact_from_variant(child);
+	g_variant_unref(child);
+	return contact;
 }
 
 void contact_print(const Contact *contact, const char *module_name)
@@ -86,6 +200,7 @@ const Contact *contact_from_message(const MessageProperties *msg)
 {
 	static Contact contact = {0};
 	contact.line_identifier = msg->line_identifier;
+	contact.line_key = msg->line_key;
 	contact.backend = msg->backend;
 	return &contact;
 }
@@ -94,43 +209,116 @@ const Contact *contact_from_call(const CallProperties *call)
 {
 	static Contact contact = {0};
 	contact.line_identifier = call->line_identifier;
+	contact.line_key = call->line_key;
 	contact.backend = call->backend;
 	return &contact;
 }
 
-void call_properties_free(CallProperties *properties)
+CallProperties *call_properties_new(void)
 {
-	if(!properties)
+	CallProperties *properties = g_malloc0(sizeof(*properties));
+	g_atomic_ref_count_init(&properties->ref_count);
+	return properties;
+}
+
+CallProperties *call_properties_ref(const CallProperties *properties)
+{
+	CallProperties *shared = (CallProperties*)properties;
+	g_atomic_ref_count_inc(&shared->ref_count);
+	return shared;
+}
+
+void call_properties_unref(CallProperties *properties)
+{
+	if(!properties || !g_atomic_ref_count_dec(&properties->ref_count))
 		return;
-	contact_free(properties->contact);
-	g_free(properties->line_identifier);
+	contact_unref(properties->contact);
 	g_free(properties->backend_data);
 	g_free(properties);
 }
 
 bool call_properties_comp(const CallProperties *a, const CallProperties *b)
 {
-	return a->backend == b->backend && g_strcmp0(a->line_identifier, b->line_identifier) == 0;
+	return a->backend == b->backend &&
+		line_key(a->line_key, a->line_identifier) == line_key(b->line_key, b->line_identifier);
+}
+
+unsigned int call_properties_hash(const CallProperties *call)
+{
+	return g_direct_hash(line_key(call->line_key, call->line_identifier)) ^ (unsigned int)call->backend;
 }
 
+/**
+ * Create an unshared snapshot of a call
+ */
 CallProperties *call_properties_copy(const CallProperties *properties)
 {
 	if(!properties)
 		return NULL;
-	CallProperties *new_props = g_malloc0(sizeof(*new_props));
+	CallProperties *new_props = call_properties_new();
 	new_props->contact = contact_copy(properties->contact);
-	new_props->line_identifier = g_strdup(properties->line_identifier);
+	new_props->line_identifier = properties->line_identifier;
+	new_props->line_key = line_key(properties->line_key, properties->line_identifier);
 	new_props->backend_data = g_strdup(properties->backend_data);
 	new_props->start_time = properties->start_time;
 	new_props->end_time = properties->end_time;
+	new_props->emergency = properties->emergency;
 	new_props->answered = properties->answered;
 	new_props->backend = properties->backend;
 	new_props->state = properties->state;
 	new_props->needs_route = properties->needs_route;
 	new_props->outbound = properties->outbound;
+	new_props->changes = properties->changes;
 	return new_props;
 }
 
+#define CALL_VARIANT_TYPE "(m" CONTACT_VARIANT_TYPE "msiimsxxbbbbu)"
+
+GVariant *call_properties_to_variant(const CallProperties *properties)
+{
+	return g_variant_new("(@m" CONTACT_VARIANT_TYPE "msiimsxxbbbbu)", contact_to_maybe_variant(properties->contact),
+						 properties->line_identifier, (gint32)properties->state, (gint32)properties->backend,
+						 properties->backend_data, (gint64)properties->start_time, (gint64)properties->end_time,
+						 properties->emergency, properties->answered, properties->needs_route, properties->outbound,
+						 (guint32)properties->changes);
+}
+
+CallProperties *call_properties_from_variant(GVariant *variant)
+{
+	if(!g_variant_is_of_type(variant, G_VARIANT_TYPE(CALL_VARIANT_TYPE)))
+		return NULL;
+
+	CallProperties *properties = call_properties_new();
+	GVariant *contact;
+	const char *line_identifier;
+	gint32 state;
+	gint32 backend;
+	gint64 start_time;
+	gint64 end_time;
+	gboolean emergency;
+	gboolean answered;
+	gboolean needs_route;
+	gboolean outbound;
+	guint32 changes;
+	g_variant_get(variant, "(@m" CONTACT_VARIANT_TYPE "m&siimsxxbbbbu)", &contact, &line_identifier, &state, &backend,
+				  &properties->backend_data, &start_time, &end_time, &emergency, &answered, &needs_route, &outbound,
+				  &changes);
+	properties->contact = contact_from_maybe_variant(contact);
+	g_variant_unref(contact);
+	properties->line_identifier = sphone_intern(line_identifier);
+	properties->line_key = sphone_phone_number_key(line_identifier);
+	properties->state = state;
+	properties->backend = backend;
+	properties->start_time = start_time;
+	properties->end_time = end_time;
+	properties->emergency = emergency;
+	properties->answered = answered;
+	properties->needs_route = needs_route;
+	properties->outbound = outbound;
+	properties->changes = changes;
+	return properties;
+}
+
 void call_properties_print(const CallProperties *call, const char *module_name)
 {
 	if(!call) {
@@ -151,14 +339,44 @@ void call_properties_print(const CallProperties *call, const char *module_name)
 		       call->start_time, call->answered, sphone_get_state_string(call->state), call->outbound);
 }
 
+MessageProperties *message_properties_new(void)
+{
+	MessageProperties *properties = g_malloc0(sizeof(*properties));
+	g_atomic_ref_count_init(&properties->ref_count);
+	return properties;
+}
+
+MessageProperties *message_properties_ref(const MessageProperties *properties)
+{
+	MessageProperties *shared = (MessageProperties*)properties;
+	g_atomic_ref_count_inc(&shared->ref_count);
+	return shared;
+}
+
+void message_properties_unref(MessageProperties *properties)
+{
+	if(!properties || !g_atomic_ref_count_dec(&properties->ref_count))
+		return;
+	contact_unref(properties->contact);
+	g_free(properties->technology);
+	if(properties->text)
+		g_ref_string_release(properties->text);
+	g_free(properties->backend_data);
+	g_free(properties);
+}
+
+/**
+ * Create an unshared copy of a message that may be modified, the text is shared
+ */
 MessageProperties *message_properties_copy(const MessageProperties *properties)
 {
 	if(!properties)
 		return NULL;
-	MessageProperties *new_props = g_malloc0(sizeof(*new_props));
+	MessageProperties *new_props = message_properties_new();
 	new_props->contact = contact_copy(properties->contact);
-	new_props->text = g_strdup(properties->text);
-	new_props->line_identifier = g_strdup(properties->line_identifier);
+	new_props->text = properties->text ? g_ref_string_acquire(properties->text) : NULL;
+	new_props->line_identifier = properties->line_identifier;
+	new_props->line_key = line_key(properties->line_key, properties->line_identifier);
 	new_props->technology = g_strdup(properties->technology);
 	new_props->backend_data = g_strdup(properties->backend_data);
 	new_props->time = properties->time;
@@ -167,14 +385,39 @@ MessageProperties *message_properties_copy(const MessageProperties *properties)
 	return new_props;
 }
 
-void message_properties_free(MessageProperties *properties)
+#define MESSAGE_VARIANT_TYPE "(m" CONTACT_VARIANT_TYPE "msmsmsimsxb)"
+
+GVariant *message_properties_to_variant(const MessageProperties *properties)
 {
-	contact_free(properties->contact);
-	g_free(properties->line_identifier);
-	g_free(properties->technology);
-	g_free(properties->text);
-	g_free(properties->backend_data);
-	g_free(properties);
+	return g_variant_new("(@m" CONTACT_VARIANT_TYPE "msmsmsimsxb)", contact_to_maybe_variant(properties->contact),
+						 properties->line_identifier, properties->technology, properties->text,
+						 (gint32)properties->backend, properties->backend_data, (gint64)properties->time,
+						 properties->outbound);
+}
+
+MessageProperties *message_properties_from_variant(GVariant *variant)
+{
+	if(!g_variant_is_of_type(variant, G_VARIANT_TYPE(MESSAGE_VARIANT_TYPE)))
+		return NULL;
+
+	MessageProperties *properties = message_properties_new();
+	GVariant *contact;
+	const char *line_identifier;
+	const char *text;
+	gint32 backend;
+	gint64 time;
+	gboolean outbound;
+	g_variant_get(variant, "(@m" CONTACT_VARIANT_TYPE "m&smsm&simsxb)", &contact, &line_identifier,
+				  &properties->technology, &text, &backend, &properties->backend_data, &time, &outbound);
+	properties->contact = contact_from_maybe_variant(contact);
+	g_variant_unref(contact);
+	properties->line_identifier = sphone_intern(line_identifier);
+	properties->line_key = sphone_phone_number_key(line_identifier);
+	properties->text = text ? g_ref_string_new(text) : NULL;
+	properties->backend = backend;
+	properties->time = time;
+	properties->outbound = outbound;
+	return properties;
 }
 
 void message_properties_print(const MessageProperties *msg, const char *module_name)
@@ -197,9 +440,345 @@ void message_properties_print(const MessageProperties *msg, const char *module_n
 		       msg->time, msg->text, msg->outbound);
 }
 
+Notification *notification_copy(const Notification *notification)
+{
+	Notification *copy = g_malloc0(sizeof(*copy));
+	copy->title = g_strdup(notification->title);
+	copy->text = g_strdup(notification->text);
+	return copy;
+}
+
 void notification_free(Notification *notification)
 {
 	g_free(notification->title);
 	g_free(notification->text);
 	g_free(notification);
 }
+
+#define NOTIFICATION_VARIANT_TYPE "(msms)"
+
+GVariant *notification_to_variant(const Notification *notification)
+{
+	return g_variant_new(NOTIFICATION_VARIANT_TYPE, notification->title, notification->text);
+}
+
+Notification *notification_from_variant(GVariant *variant)
+{
+	if(!g_variant_is_of_type(variant, G_VARIANT_TYPE(NOTIFICATION_VARIANT_TYPE)))
+		return NULL;
+
+	Notification *notification = g_malloc0(sizeof(*notification));
+	g_variant_get(variant, NOTIFICATION_VARIANT_TYPE, &notification->title, &notification->text);
+	return notification;
+}
+
+#define TYPES_STREAM_MAGIC "SPHT"
+#define TYPES_STREAM_HEADER_SIZE 8
+#define TYPES_RECORD_HEADER_SIZE 8
+#define TYPES_ALIGNMENT 8
+
+static inline gsize types_padded(gsize size)
+{
+	return (size + TYPES_ALIGNMENT - 1) & ~(gsize)(TYPES_ALIGNMENT - 1);
+}
+
+static const char *types_variant_type(sphone_type_tag_t tag)
+{
+	switch(tag) {
+		case SPHONE_TYPE_CONTACT:
+			return CONTACT_VARIANT_TYPE;
+		case SPHONE_TYPE_CALL:
+			return CALL_VARIANT_TYPE;
+		case SPHONE_TYPE_MESSAGE:
+			return MESSAGE_VARIANT_TYPE;
+		case SPHONE_TYPE_NOTIFICATION:
+			return NOTIFICATION_VARIANT_TYPE;
+		case SPHONE_TYPE_VARIANT:
+			return "v";
+		default:
+			return NULL;
+	}
+}
+
+static GVariant *types_to_variant(sphone_type_tag_t tag, gconstpointer data)
+{
+	switch(tag) {
+		case SPHONE_TYPE_CONTACT:
+			return contact_to_variant(data);
+		case SPHONE_TYPE_CALL:
+			return call_properties_to_variant(data);
+		case SPHONE_TYPE_MESSAGE:
+			return message_properties_to_variant(data);
+		case SPHONE_TYPE_NOTIFICATION:
+			return notification_to_variant(data);
+		case SPHONE_TYPE_VARIANT:
+			return g_variant_new_variant((GVariant *)data);
+		default:
+			return NULL;
+	}
+}
+
+static gpointer types_from_variant(sphone_type_tag_t tag, GVariant *variant)
+{
+	switch(tag) {
+		case SPHONE_TYPE_CONTACT:
+			return contact_from_variant(variant);
+		case SPHONE_TYPE_CALL:
+			return call_properties_from_variant(variant);
+		case SPHONE_TYPE_MESSAGE:
+			return message_properties_from_variant(variant);
+		case SPHONE_TYPE_NOTIFICATION:
+			return notification_from_variant(variant);
+		case SPHONE_TYPE_VARIANT:
+			return g_variant_get_variant(variant);
+		default:
+			return NULL;
+	}
+}
+
+/**
+ * Free data decoded by sphone_types_stream_next() or sphone_types_decode()
+ */
+void sphone_types_free(sphone_type_tag_t tag, gpointer data)
+{
+	if(!data)
+		return;
+
+	switch(tag) {
+		case SPHONE_TYPE_CONTACT:
+			contact_unref(data);
+			break;
+		case SPHONE_TYPE_CALL:
+			call_properties_unref(data);
+			break;
+		case SPHONE_TYPE_MESSAGE:
+			message_properties_unref(data);
+			break;
+		case SPHONE_TYPE_NOTIFICATION:
+			notification_free(data);
+			break;
+		case SPHONE_TYPE_VARIANT:
+			g_variant_unref(data);
+			break;
+		default:
+			sphone_log(LL_WARN, "%s: unknown type %d", __func__, tag);
+			break;
+	}
+}
+
+/**
+ * Write the stream header to an empty byte array
+ */
+void sphone_types_stream_begin(GByteArray *stream)
+{
+	guint8 header[TYPES_STREAM_HEADER_SIZE] = {0};
+	guint16 version = GUINT16_TO_LE(SPHONE_TYPES_ENCODING_VERSION);
+
+	g_return_if_fail(stream->len == 0);
+	memcpy(header, TYPES_STREAM_MAGIC, strlen(TYPES_STREAM_MAGIC));
+	memcpy(header + strlen(TYPES_STREAM_MAGIC), &version, sizeof(version));
+	g_byte_array_append(stream, header, sizeof(header));
+}
+
+/**
+ * Append a record to a stream started with sphone_types_stream_begin()
+ *
+ * @param stream The stream
+ * @param tag The type of data
+ * @param data A Contact, CallProperties, MessageProperties, Notification or for
+ *             SPHONE_TYPE_VARIANT a GVariant, a floating reference is sunk
+ * @return true on success
+ */
+bool sphone_types_stream_append(GByteArray *stream, sphone_type_tag_t tag, gconstpointer data)
+{
+	g_return_val_if_fail(stream->len >= TYPES_STREAM_HEADER_SIZE && stream->len % TYPES_ALIGNMENT == 0, false);
+
+	GVariant *variant = data ? types_to_variant(tag, data) : NULL;
+	if(!variant) {
+		sphone_log(LL_WARN, "%s: can not encode type %d", __func__, tag);
+		return false;
+	}
+	g_variant_ref_sink(variant);
+
+	if(G_BYTE_ORDER == G_BIG_ENDIAN) {
+		GVariant *swapped = g_variant_byteswap(variant);
+		g_variant_unref(variant);
+		variant = swapped;
+	}
+
+	gsize size = g_variant_get_size(variant);
+	if(size > G_MAXUINT32) {
+		sphone_log(LL_WARN, "%s: record of type %d is too large", __func__, tag);
+		g_variant_unref(variant);
+		return false;
+	}
+
+	guint8 header[TYPES_RECORD_HEADER_SIZE] = {0};
+	guint32 length = GUINT32_TO_LE((guint32)size);
+	memcpy(header, &length, sizeof(length));
+	header[sizeof(length)] = tag;
+	g_byte_array_append(stream, header, sizeof(header));
+
+	gsize offset = stream->len;
+	g_byte_array_set_size(stream, offset + types_padded(size));
+	g_variant_store(variant, stream->data + offset);
+	memset(stream->data + offset + size, 0, types_padded(size) - size);
+
+	g_variant_unref(variant);
+	return true;
+}
+
+/**
+ * Start reading an encoded stream
+ *
+ * @param stream The cursor to initialize, release it with sphone_types_stream_clear()
+ * @param bytes The stream, it should be 8 byte aligned like memory from g_malloc() or a mapped file
+ * @return true if bytes is a stream of the current encoding version
+ */
+bool sphone_types_stream_init(SphoneTypesStream *stream, GBytes *bytes)
+{
+	gsize size;
+	const guint8 *data = g_bytes_get_data(bytes, &size);
+
+	stream->bytes = NULL;
+	stream->offset = 0;
+
+	if(size < TYPES_STREAM_HEADER_SIZE || memcmp(data, TYPES_STREAM_MAGIC, strlen(TYPES_STREAM_MAGIC)) != 0) {
+		sphone_log(LL_WARN, "%s: not an encoded stream", __func__);
+		return false;
+	}
+
+	guint16 version;
+	memcpy(&version, data + strlen(TYPES_STREAM_MAGIC), sizeof(version));
+	version = GUINT16_FROM_LE(version);
+	if(version != SPHONE_TYPES_ENCODING_VERSION) {
+		sphone_log(LL_WARN, "%s: unsupported encoding version %u", __func__, version);
+		return false;
+	}
+
+	stream->bytes = g_bytes_ref(bytes);
+	stream->offset = TYPES_STREAM_HEADER_SIZE;
+	return true;
+}
+
+/**
+ * Read the next record of a stream without decoding it
+ *
+ * On little endian hosts the returned GVariant references the stream in place,
+ * strings read from it with "&s" point into the stream and are not copied.
+ * The data is not trusted, malformed records read as default values.
+ *
+ * @param stream The cursor
+ * @param tag Returns the type of the record, may be NULL
+ * @return The GVariant of the record or NULL at the end of the stream or on a corrupt record.
+ *         Free with g_variant_unref()
+ */
+GVariant *sphone_types_stream_next_view(SphoneTypesStream *stream, sphone_type_tag_t *tag)
+{
+	if(!stream->bytes)
+		return NULL;
+
+	gsize size;
+	const guint8 *data = g_bytes_get_data(stream->bytes, &size);
+	if(size - stream->offset < TYPES_RECORD_HEADER_SIZE) {
+		if(stream->offset != size)
+			sphone_log(LL_WARN, "%s: stream is truncated", __func__);
+		stream->offset = size;
+		return NULL;
+	}
+
+	guint32 length;
+	memcpy(&length, data + stream->offset, sizeof(length));
+	length = GUINT32_FROM_LE(length);
+	sphone_type_tag_t record_tag = data[stream->offset + sizeof(length)];
+	gsize start = stream->offset + TYPES_RECORD_HEADER_SIZE;
+
+	if(!types_variant_type(record_tag) || length > size - start) {
+		sphone_log(LL_WARN, "%s: corrupt record at offset %zu", __func__, stream->offset);
+		stream->offset = size;
+		return NULL;
+	}
+	stream->offset = types_padded(length) > size - start ? size : start + types_padded(length);
+
+	GBytes *record = g_bytes_new_from_bytes(stream->bytes, start, length);
+	GVariant *variant = g_variant_ref_sink(g_variant_new_from_bytes(G_VARIANT_TYPE(types_variant_type(record_tag)),
+																	record, FALSE));
+	g_bytes_unref(record);
+
+	if(G_BYTE_ORDER == G_BIG_ENDIAN) {
+		GVariant *swapped = g_variant_byteswap(variant);
+		g_variant_unref(variant);
+		variant = swapped;
+	}
+
+	if(tag)
+		*tag = record_tag;
+	return variant;
+}
+
+/**
+ * Decode the next record of a stream
+ *
+ * @param stream The cursor
+ * @param tag Returns the type of the record, may be NULL
+ * @return The decoded data or NULL at the end of the stream or on a corrupt record.
+ *         Free with sphone_types_free()
+ */
+gpointer sphone_types_stream_next(SphoneTypesStream *stream, sphone_type_tag_t *tag)
+{
+	sphone_type_tag_t record_tag;
+	GVariant *variant = sphone_types_stream_next_view(stream, &record_tag);
+	if(!variant)
+		return NULL;
+
+	gpointer data = types_from_variant(record_tag, variant);
+	g_variant_unref(variant);
+
+	if(tag)
+		*tag = record_tag;
+	return data;
+}
+
+/**
+ * Release the stream held by a cursor
+ */
+void sphone_types_stream_clear(SphoneTypesStream *stream)
+{
+	if(stream->bytes)
+		g_bytes_unref(stream->bytes);
+	stream->bytes = NULL;
+	stream->offset = 0;
+}
+
+/**
+ * Encode a single Contact, CallProperties, MessageProperties or Notification as a stream of one record
+ *
+ * @return The encoded data or NULL on error, free with g_bytes_unref()
+ */
+GBytes *sphone_types_encode(sphone_type_tag_t tag, gconstpointer data)
+{
+	GByteArray *stream = g_byte_array_new();
+	sphone_types_stream_begin(stream);
+	if(!sphone_types_stream_append(stream, tag, data)) {
+		g_byte_array_unref(stream);
+		return NULL;
+	}
+	return g_byte_array_free_to_bytes(stream);
+}
+
+/**
+ * Decode the first record of data encoded by sphone_types_encode()
+ *
+ * @param bytes The encoded data
+ * @param tag Returns the type of the record, may be NULL
+ * @return The decoded data or NULL on error, free with sphone_types_free()
+ */
+gpointer sphone_types_decode(GBytes *bytes, sphone_type_tag_t *tag)
+{
+	SphoneTypesStream stream;
+	if(!sphone_types_stream_init(&stream, bytes))
+		return NULL;
+	gpointer data = sphone_types_stream_next(&stream, tag);
+	sphone_types_stream_clear(&stream);
+	return data;
+}